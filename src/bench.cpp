@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "sim/flip_solver.h"
+#include "sim/fluid_solver.h"
+#include "sim/fluid_solver_3d.h"
+#include "sim/frame_archive.h"
+#include "sim/lbm_solver.h"
+#include "sim/particle_sort.h"
+#include "sim/pbf_solver.h"
+#include "sim/poisson.h"
+#include "sim/scene.h"
+#include "sim/sph_solver.h"
+
+// Microbenchmarks for the solver kernels over problem sizes and thread counts. Grid benchmarks report cells
+// per second, particle benchmarks particles per second, and kernels with a fixed memory footprint also
+// report bytes per second.
+
+namespace {
+
+constexpr int gridSizes[] = { 128, 256, 512, 1024 };
+constexpr int volumeSizes[] = { 32, 64, 128 };
+
+// Smooth swirling velocity and a density blob, so backtraces land all over the grid like a real run.
+struct BenchFields {
+    explicit BenchFields(int size) {
+        for (Grid2D* grid : { &velocityX, &velocityY, &density, &out }) {
+            grid->resize(size, size);
+        }
+        for (int y = 1; y <= size; y++) {
+            for (int x = 1; x <= size; x++) {
+                float fx = static_cast<float>(x) / size;
+                float fy = static_cast<float>(y) / size;
+                velocityX(x, y) = 40.0f * std::sin(6.2831853f * fy);
+                velocityY(x, y) = 40.0f * std::sin(6.2831853f * fx);
+                density(x, y) = std::exp(-20.0f * ((fx - 0.5f) * (fx - 0.5f) + (fy - 0.5f) * (fy - 0.5f)));
+            }
+        }
+        setBoundary(velocityX, BoundaryType::VelocityX);
+        setBoundary(velocityY, BoundaryType::VelocityY);
+        setBoundary(density, BoundaryType::Scalar);
+    }
+
+    Grid2D velocityX;
+    Grid2D velocityY;
+    Grid2D density;
+    Grid2D out;
+};
+
+void setThroughput(benchmark::State& state, double cells, double bytesPerCell) {
+    state.counters["cells/s"] = benchmark::Counter(cells * state.iterations(), benchmark::Counter::kIsRate);
+    if (bytesPerCell > 0.0) {
+        state.SetBytesProcessed(static_cast<std::int64_t>(cells * bytesPerCell * state.iterations()));
+    }
+}
+
+// Every grid size on one thread and on all hardware threads.
+void gridArguments(benchmark::internal::Benchmark* benchmark) {
+    int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    benchmark->ArgNames({ "size", "threads" });
+    for (int size : gridSizes) {
+        benchmark->Args({ size, 1 });
+        if (hardware > 1) {
+            benchmark->Args({ size, hardware });
+        }
+    }
+}
+
+// Every cube size on one thread and on all hardware threads.
+void volumeArguments(benchmark::internal::Benchmark* benchmark) {
+    int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    benchmark->ArgNames({ "size", "threads" });
+    for (int size : volumeSizes) {
+        benchmark->Args({ size, 1 });
+        if (hardware > 1) {
+            benchmark->Args({ size, hardware });
+        }
+    }
+}
+
+// Grid arguments for each SIMD level this CPU supports.
+void advectArguments(benchmark::internal::Benchmark* benchmark) {
+    int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    benchmark->ArgNames({ "size", "threads", "simd" });
+    for (int level = 0; level <= static_cast<int>(detectSimdLevel()); level++) {
+        for (int size : gridSizes) {
+            benchmark->Args({ size, 1, level });
+            if (hardware > 1) {
+                benchmark->Args({ size, hardware, level });
+            }
+        }
+    }
+}
+
+void BM_Advect(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    const SimdLevel simd = static_cast<SimdLevel>(state.range(2));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    BenchFields fields(size);
+    for (auto _ : state) {
+        advect(pool, fields.out, fields.density, fields.velocityX, fields.velocityY, 1.0f / 60.0f, 1.0f, BoundaryType::Scalar, simd);
+        benchmark::DoNotOptimize(fields.out.data());
+    }
+    state.SetLabel(simdLevelNames[static_cast<int>(simd)]);
+    // Streams velocity, source and destination; the four bilinear taps mostly hit cache.
+    setThroughput(state, static_cast<double>(size) * size, 4 * sizeof(float));
+}
+
+// Forward and backward passes, the BFECC re-advection and the limiter, each on the same fields as BM_Advect.
+void BM_AdvectCorrected(benchmark::State& state, AdvectionScheme scheme) {
+    const int size = static_cast<int>(state.range(0));
+    const SimdLevel simd = static_cast<SimdLevel>(state.range(2));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    BenchFields fields(size);
+    Grid2D scratch;
+    scratch.resize(size, size);
+    for (auto _ : state) {
+        advectCorrected(pool, fields.out, scratch, fields.density, fields.velocityX, fields.velocityY, 1.0f / 60.0f, 1.0f, BoundaryType::Scalar,
+                        scheme, simd);
+        benchmark::DoNotOptimize(fields.out.data());
+    }
+    state.SetLabel(simdLevelNames[static_cast<int>(simd)]);
+    setThroughput(state, static_cast<double>(size) * size, 0.0);
+}
+
+void BM_Divergence(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    BenchFields fields(size);
+    for (auto _ : state) {
+        computeDivergence(pool, fields.out, fields.velocityX, fields.velocityY);
+        benchmark::DoNotOptimize(fields.out.data());
+    }
+    setThroughput(state, static_cast<double>(size) * size, 3 * sizeof(float));
+}
+
+void BM_JacobiSweep(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    BenchFields fields(size);
+    computeDivergence(pool, fields.out, fields.velocityX, fields.velocityY);
+    Grid2D pressure(size, size);
+    Grid2D next(size, size);
+    for (auto _ : state) {
+        jacobiSweep(pool, next, pressure, fields.out);
+        std::swap(pressure, next);
+        benchmark::DoNotOptimize(pressure.data());
+    }
+    setThroughput(state, static_cast<double>(size) * size, 3 * sizeof(float));
+}
+
+// Full pressure solve from a zero initial guess to the default tolerance.
+void BM_PressureSolve(benchmark::State& state, PressureSolverType type) {
+    const int size = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    FluidSettings settings;
+    settings.width = size;
+    settings.height = size;
+    FluidSolver solver(settings, pool);
+    BenchFields fields(size);
+    computeDivergence(pool, solver.divergence, fields.velocityX, fields.velocityY);
+    MultigridSolver multigrid(pool);
+    PcgSolver pcg(pool);
+
+    PressureSolveStats stats;
+    for (auto _ : state) {
+        std::fill(solver.pressure.values.begin(), solver.pressure.values.end(), 0.0f);
+        if (type == PressureSolverType::Multigrid) {
+            stats = multigrid.solve(solver.pressure, solver.divergence, settings.multigrid);
+        } else {
+            stats = pcg.solve(solver.pressure, solver.divergence, solver.solid, solver.solidRevision, settings.pcg);
+        }
+        benchmark::DoNotOptimize(solver.pressure.data());
+    }
+    state.counters["iterations"] = stats.iterations;
+    state.counters["residual"] = stats.residual;
+    setThroughput(state, static_cast<double>(size) * size, 0.0);
+}
+
+// One whole solver step of the plume scene with each pressure solver, the work behind every sim frame.
+void BM_Step(benchmark::State& state, PressureSolverType type) {
+    const int size = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    FluidSettings settings;
+    settings.width = size;
+    settings.height = size;
+    settings.pressureSolver = type;
+    FluidSolver solver(settings, pool);
+    setupScene(solver, SceneType::Plume);
+    // Warm up so the plume has developed and the solvers see realistic right-hand sides.
+    for (int i = 0; i < 30; i++) {
+        solver.step(1.0f / 60.0f);
+    }
+    for (auto _ : state) {
+        solver.step(1.0f / 60.0f);
+    }
+    setThroughput(state, static_cast<double>(size) * size, 0.0);
+}
+
+// Particle counts for the SPH benchmarks, each on one thread and on all hardware threads.
+void particleArguments(benchmark::internal::Benchmark* benchmark) {
+    int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    benchmark->ArgNames({ "particles", "threads" });
+    for (int count : { 50000, 200000, 800000 }) {
+        benchmark->Args({ count, 1 });
+        if (hardware > 1) {
+            benchmark->Args({ count, hardware });
+        }
+    }
+}
+
+// Rebuilding the cell-linked grid over a settled dam, which SPH does before every substep.
+void BM_NeighborSearch(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    SphSettings settings;
+    settings.particleCount = count;
+    SphSolver solver(settings, pool);
+    for (int i = 0; i < 5; i++) {
+        solver.step(1.0f / 60.0f);
+    }
+    NeighborGrid grid;
+    for (auto _ : state) {
+        grid.build(pool, solver.particles.positionX, solver.particles.positionY, solver.smoothingRadius(), settings.domainWidth, settings.domainHeight);
+        benchmark::DoNotOptimize(grid.sortedX.data());
+    }
+    state.counters["particles/s"] = benchmark::Counter(static_cast<double>(count) * state.iterations(), benchmark::Counter::kIsRate);
+}
+
+// Morton reorder of a dam shuffled into random memory order, the worst case of the drift it undoes.
+void BM_MortonSort(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    SphSettings settings;
+    settings.particleCount = count;
+    SphSolver solver(settings, pool);
+    ParticleSet shuffled = solver.particles;
+    std::mt19937 random(1);
+    for (int i = count - 1; i > 0; i--) {
+        int j = std::uniform_int_distribution<int>(0, i)(random);
+        std::swap(shuffled.positionX[i], shuffled.positionX[j]);
+        std::swap(shuffled.positionY[i], shuffled.positionY[j]);
+    }
+    MortonSorter sorter;
+    for (auto _ : state) {
+        state.PauseTiming();
+        solver.particles = shuffled;
+        state.ResumeTiming();
+        sorter.sort(pool, solver.particles, solver.smoothingRadius(), settings.domainWidth, settings.domainHeight);
+        benchmark::DoNotOptimize(solver.particles.positionX.data());
+    }
+    state.counters["particles/s"] = benchmark::Counter(static_cast<double>(count) * state.iterations(), benchmark::Counter::kIsRate);
+}
+
+void BM_SphStep(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    SphSettings settings;
+    settings.particleCount = count;
+    SphSolver solver(settings, pool);
+    int substeps = 0;
+    for (auto _ : state) {
+        solver.step(1.0f / 60.0f);
+        substeps += solver.stats.substeps;
+    }
+    state.counters["particle-substeps/s"] = benchmark::Counter(static_cast<double>(count) * substeps, benchmark::Counter::kIsRate);
+}
+
+
+void BM_PbfStep(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    PbfSettings settings;
+    settings.particleCount = count;
+    // At these counts the iterations alone would run into their cap, so the grid projection is on.
+    settings.densityProjection = true;
+    PbfSolver solver(settings, pool);
+    int substeps = 0;
+    for (auto _ : state) {
+        solver.step(1.0f / 60.0f);
+        substeps += solver.stats.substeps;
+    }
+    state.counters["particle-substeps/s"] = benchmark::Counter(static_cast<double>(count) * substeps, benchmark::Counter::kIsRate);
+}
+
+void BM_FlipStep(benchmark::State& state, FlipTransfer transfer) {
+    const int count = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    FlipSettings settings;
+    settings.particleCount = count;
+    settings.transfer = transfer;
+    FlipSolver solver(settings, pool);
+    int substeps = 0;
+    for (auto _ : state) {
+        solver.step(1.0f / 60.0f);
+        substeps += solver.stats.substeps;
+    }
+    state.counters["particle-substeps/s"] = benchmark::Counter(static_cast<double>(count) * substeps, benchmark::Counter::kIsRate);
+}
+
+// Square lattice with the default cylinder, one update of ten lattice steps per iteration.
+void BM_LbmStep(benchmark::State& state, LbmCollision collision) {
+    const int size = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    LbmSettings settings;
+    settings.width = settings.height = size;
+    settings.collision = collision;
+    settings.stepsPerUpdate = 10;
+    settings.simd = static_cast<SimdLevel>(state.range(2));
+    LbmSolver solver(settings, pool);
+    std::int64_t steps = 0;
+    for (auto _ : state) {
+        solver.step();
+        steps += solver.stats.steps;
+    }
+    const double nodeUpdates = static_cast<double>(size) * size * steps;
+    state.counters["lattice-updates/s"] = benchmark::Counter(nodeUpdates, benchmark::Counter::kIsRate);
+    // Nine populations read and written per node update.
+    state.SetBytesProcessed(static_cast<std::int64_t>(nodeUpdates * 2 * lbmDirections * sizeof(float)));
+}
+
+// Cubic box with the default emitter, warmed up so the plume and a warm-started pressure solve are running.
+// Throughput counts the stored cells, all of them in a dense grid.
+void BM_Step3D(benchmark::State& state, bool sparse) {
+    const int size = static_cast<int>(state.range(0));
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    FluidSettings3D settings;
+    settings.width = settings.height = settings.depth = size;
+    settings.sparse = sparse;
+    FluidSolver3D solver(settings, pool);
+    for (int i = 0; i < 10; i++) {
+        solver.step(1.0f / 60.0f);
+    }
+    for (auto _ : state) {
+        solver.step(1.0f / 60.0f);
+    }
+    setThroughput(state, static_cast<double>(solver.activeBricks()) * BrickGrid::brickCells, 0.0);
+    state.counters["bricks"] = solver.activeBricks();
+}
+
+
+// Writes frames of a developed plume to an archive and reads every field back through FrameArchiveReader,
+// failing unless each one matches what was written. The fields take all three filters: the density shuffled
+// and compressed, a byte quantization of it compressed as is, and noise that is stored raw.
+void BM_ArchiveRoundTrip(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    constexpr int frames = 4;
+    ThreadPool pool;
+    FluidSettings settings;
+    settings.width = size;
+    settings.height = size;
+    FluidSolver solver(settings, pool);
+    setupScene(solver, SceneType::Plume);
+    for (int i = 0; i < 30; i++) {
+        solver.step(1.0f / 60.0f);
+    }
+    std::vector<float> density;
+    std::vector<unsigned char> quantized;
+    std::vector<float> noise(static_cast<std::size_t>(size) * size);
+    for (int y = 1; y <= size; y++) {
+        for (int x = 1; x <= size; x++) {
+            density.push_back(solver.density(x, y));
+            quantized.push_back(static_cast<unsigned char>(std::clamp(solver.density(x, y), 0.0f, 1.0f) * 255.0f));
+        }
+    }
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    for (float& value : noise) {
+        value = distribution(random);
+    }
+    struct Field {
+        const char* name;
+        SnapshotType type;
+        const void* values;
+        std::size_t bytes;
+    };
+    const Field fields[] = { { "density", SnapshotType::Float32, density.data(), density.size() * sizeof(float) },
+                             { "quantized", SnapshotType::UInt8, quantized.data(), quantized.size() },
+                             { "noise", SnapshotType::Float32, noise.data(), noise.size() * sizeof(float) } };
+
+    const std::string path = (std::filesystem::temp_directory_path() / "fluids_bench_round_trip.fla").string();
+    FrameArchiveWriter writer;
+    FrameArchiveReader reader;
+    std::vector<unsigned char> values;
+    double rawBytes = 0.0;
+    for (auto _ : state) {
+        if (!writer.open(path)) {
+            state.SkipWithError("failed to create the archive");
+            break;
+        }
+        for (int frame = 0; frame < frames; frame++) {
+            ArchiveFrame* archived = writer.beginFrame(static_cast<std::uint64_t>(frame), true);
+            for (const Field& field : fields) {
+                archived->add(field.name, field.type, field.values, field.bytes, size, size);
+            }
+            writer.submit(archived);
+        }
+        if (!writer.close() || !reader.open(path) || reader.frameCount() != frames) {
+            state.SkipWithError("failed to write or reopen the archive");
+            break;
+        }
+        bool matches = true;
+        for (int frame = 0; frame < frames && matches; frame++) {
+            for (const Field& field : fields) {
+                matches = matches && reader.read(frame, field.name, values) && values.size() == field.bytes
+                    && std::memcmp(values.data(), field.values, field.bytes) == 0;
+                rawBytes += static_cast<double>(field.bytes);
+            }
+        }
+        if (!matches) {
+            state.SkipWithError("a field read back differs from the one written");
+            break;
+        }
+    }
+    std::filesystem::remove(path);
+    state.SetBytesProcessed(static_cast<std::int64_t>(rawBytes));
+}
+}
+
+BENCHMARK(BM_Advect)->Apply(advectArguments)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_AdvectCorrected, maccormack, AdvectionScheme::MacCormack)->Apply(advectArguments)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_AdvectCorrected, bfecc, AdvectionScheme::Bfecc)->Apply(advectArguments)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Divergence)->Apply(gridArguments)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_JacobiSweep)->Apply(gridArguments)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_PressureSolve, multigrid, PressureSolverType::Multigrid)->Apply(gridArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_PressureSolve, pcg, PressureSolverType::ConjugateGradient)->Apply(gridArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Step, multigrid, PressureSolverType::Multigrid)->Apply(gridArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Step, pcg, PressureSolverType::ConjugateGradient)->Apply(gridArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Step3D, dense, false)->Apply(volumeArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Step3D, sparse, true)->Apply(volumeArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_NeighborSearch)->Apply(particleArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MortonSort)->Apply(particleArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SphStep)->Apply(particleArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PbfStep)->Apply(particleArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_FlipStep, flip, FlipTransfer::Flip)->Apply(particleArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_FlipStep, apic, FlipTransfer::Apic)->Apply(particleArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ArchiveRoundTrip)->ArgName("size")->Arg(256)->Arg(1024)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_LbmStep, bgk, LbmCollision::Bgk)->Apply(advectArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_LbmStep, mrt, LbmCollision::Mrt)->Apply(advectArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
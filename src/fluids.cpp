@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <string>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
@@ -8,11 +10,134 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
+#include "sim/scene.h"
+#include "sim/simulation_thread.h"
+#include "ui/field_renderer.h"
+#include "ui/frame_profiler.h"
+#include "ui/particle_renderer.h"
+#include "ui/solver_panel.h"
+
 void errorCallback(int error, const char* message) {
     std::cout << "Error (" << error << "): " << message << std::endl;
 }
 
-int main() {
+// Zones written when a trace is requested, and where they go.
+constexpr double traceSeconds = 10.0;
+constexpr const char* tracePath = "fluids_trace.json";
+
+void writeTrace() {
+    if (!tracingEnabled()) {
+        std::cout << "Tracing is off; enable it in the profiler window or start with --trace." << std::endl;
+        return;
+    }
+    if (writeChromeTrace(tracePath, traceSeconds)) {
+        std::cout << "Wrote the last " << traceSeconds << " s of trace zones to " << tracePath << "." << std::endl;
+    } else {
+        std::cerr << "Failed to write trace to " << tracePath << "." << std::endl;
+    }
+}
+
+// Owns everything that needs the GL context, so it is all released before the context is destroyed.
+void runMainLoop(GLFWwindow* window) {
+    SimulationControls controls;
+    SceneType scene = SceneType::Plume;
+    ThreadPool pool;
+    SimulationThread simulation(controls, pool, scene);
+    simulation.setControls(controls);
+    Grid2D displayDensity;
+    FrameProfiler profiler;
+    GpuTimer gpuTimer;
+    ParticleRenderer particleRenderer;
+    FieldRenderer fieldRenderer;
+    DisplayField displayField = DisplayField::Density;
+    bool traceKeyDown = false;
+
+    double previousFrameTime = glfwGetTime();
+
+    while (!glfwWindowShouldClose(window)) {
+        double frameTime = glfwGetTime();
+        double elapsedSeconds = frameTime - previousFrameTime;
+        previousFrameTime = frameTime;
+        profiler.record(ProfilePhase::Frame, elapsedSeconds);
+
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        {
+            ScopedCpuTimer timer(profiler, ProfilePhase::Poll);
+            glfwPollEvents();
+        }
+        bool traceKeyWasDown = traceKeyDown;
+        traceKeyDown = glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS;
+        if (traceKeyDown && !traceKeyWasDown) {
+            writeTrace();
+        }
+
+        const SimulationFrame& frame = simulation.latestFrame();
+        profiler.recordSimulation(frame);
+        {
+            ScopedCpuTimer timer(profiler, ProfilePhase::Interpolate);
+            if (frame.mode == SimulationMode::Grid) {
+                // The latest state becomes current when published, so blend towards it over one sim step.
+                float alpha = frame.stepSeconds > 0.0 ? static_cast<float>((steadySeconds() - frame.publishTime) / frame.stepSeconds) : 1.0f;
+                interpolateGrid(displayDensity, frame.previousDensity, frame.density, std::clamp(alpha, 0.0f, 1.0f));
+            }
+        }
+
+        double gpuSeconds = 0.0;
+        while (gpuTimer.poll(gpuSeconds)) {
+            profiler.record(ProfilePhase::Gpu, gpuSeconds);
+        }
+
+        {
+            ScopedCpuTimer timer(profiler, ProfilePhase::Ui);
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            SolverPanelResult panel = drawSolverPanel(controls, scene, displayField, frame, pool.threadCount(), elapsedSeconds);
+            if (panel.controlsChanged) {
+                simulation.setControls(controls);
+            }
+            if (panel.resetRequested) {
+                simulation.reset(scene);
+            }
+            if (drawProfilerPanel(profiler)) {
+                writeTrace();
+            }
+        }
+
+        {
+            ScopedCpuTimer timer(profiler, ProfilePhase::Render);
+            gpuTimer.begin();
+            glViewport(0, 0, width, height);
+            glClear(GL_COLOR_BUFFER_BIT);
+            if (frame.mode == SimulationMode::Grid) {
+                fieldRenderer.draw(displayField, displayDensity, frame, width, height);
+            } else if (frame.mode == SimulationMode::Lbm || frame.mode == SimulationMode::Grid3D) {
+                fieldRenderer.draw(displayField, frame.density, frame, width, height);
+            } else {
+                particleRenderer.draw(frame, width, height);
+            }
+
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            gpuTimer.end();
+        }
+
+        {
+            ScopedCpuTimer timer(profiler, ProfilePhase::Swap);
+            glfwSwapBuffers(window);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    setTraceThreadName("main");
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--trace") {
+            setTracingEnabled(true);
+        }
+    }
+
     if (!glfwInit()) {
         std::cerr << "Failed to init GLFW." << std::endl;
         glfwTerminate();
@@ -38,30 +163,7 @@ int main() {
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init();
 
-    double previousFrameTime = glfwGetTime();
-
-    while (!glfwWindowShouldClose(window)) {
-        double frameTime = glfwGetTime();
-        double elapsedSeconds = frameTime - previousFrameTime;
-        previousFrameTime = frameTime;
-
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-        glfwPollEvents();
-
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
-        ImGui::ShowDemoWindow();
-
-        glViewport(0, 0, width, height);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-        glfwSwapBuffers(window);
-    }
+    runMainLoop(window);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -0,0 +1,738 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "sim/field_io.h"
+#include "sim/flip_solver.h"
+#include "sim/fluid_solver.h"
+#include "sim/fluid_solver_3d.h"
+#include "sim/frame_archive.h"
+#include "sim/lbm_solver.h"
+#include "sim/pbf_solver.h"
+#include "sim/scene.h"
+#include "sim/simulation_mode.h"
+#include "sim/snapshot.h"
+#include "sim/sph_solver.h"
+#include "sim/trace.h"
+
+// Batch runner for machines without a display: steps the solver at full speed with no GLFW, GL or ImGui.
+struct HeadlessOptions {
+    int steps = 600;
+    double stepHz = 60.0;
+    int outputEvery = 0;
+    int volumeEvery = 0;
+    std::string outputDirectory = "output";
+    std::string metricsPath;
+    std::string tracePath;
+    double traceSeconds = 10.0;
+    std::string checkpointPath;
+    int checkpointEvery = 0;
+    std::string restartPath;
+    std::string archivePath;
+    int archiveEvery = 1;
+    SimulationMode mode = SimulationMode::Grid;
+    SceneType scene = SceneType::Plume;
+    int threads = 0;
+    bool pinThreads = false;
+    FluidSettings settings;
+    SphSettings sph;
+    PbfSettings pbf;
+    FlipSettings flip;
+    LbmSettings lbm;
+    FluidSettings3D grid3d;
+};
+
+// For particle modes, iterations holds the substeps and residual the density error, or the pressure
+// residual for FLIP. For the lattice, iterations holds the lattice steps and residual the max speed.
+// The 3D grid reports its pressure solve like the 2D one.
+struct StepMetrics {
+    double seconds = 0.0;
+    int iterations = 0;
+    float residual = 0.0f;
+    SolverPhaseTimes phaseTimes;
+};
+
+void printUsage() {
+    std::cout << "Usage: fluids_headless [options]\n"
+              << "  --steps N                 Number of solver steps to run (default 600)\n"
+              << "  --size N                  Grid width and height in cells (default 512)\n"
+              << "  --width N, --height N     Grid or lattice dimensions in cells\n"
+              << "  --depth N                 Depth of the 3D grid in cells; --size sets all three (default 64x96x64)\n"
+              << "  --sparse                  Store only the bricks of the 3D grid near smoke\n"
+              << "  --threads N               Worker threads including the main thread, 0 for one per hardware thread\n"
+              << "  --pin-threads             Pin each worker thread to its own CPU\n"
+              << "  --hz HZ                   Simulation rate, each step advances 1/HZ seconds (default 60)\n"
+              << "  --cfl C                   Cells the fastest flow may cross per substep in the grid modes, 0 for\n"
+              << "                            whole steps (default " << FluidSettings().cflNumber << " in 2D, " << FluidSettings3D().cflNumber << " in 3D)\n"
+              << "  --max-substeps N          Substeps per step allowed by the CFL number in the grid modes (default 8)\n"
+              << "  --mode NAME               grid (stable fluids), grid3d, sph, pbf, flip or lbm (default grid)\n"
+              << "  --particles N             Particle count for particle modes (default 200000, 1000 for SPH and PBF)\n"
+              << "  --pbf-substeps N          PBF substeps per step (default 4)\n"
+              << "  --pbf-iterations N        Least density constraint iterations per PBF substep (default 4)\n"
+              << "  --pbf-max-iterations N    Most iterations per PBF substep while the density error is above\n"
+              << "                            --pbf-tolerance (default 100)\n"
+              << "  --pbf-tolerance E         Mean PBF density error the iterations stop at (default 0.01)\n"
+              << "  --pbf-projection          Project the PBF compression out on a grid before the iterations\n"
+              << "  --flip-transfer NAME      pic, flip or apic particle update for FLIP (default flip)\n"
+              << "  --flip-ratio R            Share of the FLIP update blended with PIC (default 0.95)\n"
+              << "  --lbm-collision NAME      bgk or mrt collision for the lattice Boltzmann mode (default mrt)\n"
+              << "  --lbm-steps N             Lattice steps per step (default 20)\n"
+              << "  --reynolds R              Reynolds number of the lattice Boltzmann cylinder flow (default 200)\n"
+              << "  --reorder-interval N      Steps between Morton reorders of the particles, 0 for never (default 5)\n"
+              << "  --scene NAME              plume or obstacle (default plume)\n"
+              << "  --pressure-solver NAME    jacobi, multigrid or pcg (default multigrid)\n"
+              << "  --jacobi-iterations N     Jacobi sweeps per step\n"
+              << "  --multigrid-cycles N      Maximum multigrid cycles per step\n"
+              << "  --pcg-iterations N        Maximum conjugate gradient iterations per step\n"
+              << "  --pressure-tolerance T    Relative residual at which the pressure solve stops\n"
+              << "  --advection NAME          semi-lagrangian, maccormack or bfecc advection in the grid modes\n"
+              << "                            (default semi-lagrangian)\n"
+              << "  --simd NAME               scalar, sse2, avx2 or avx512 advection and lattice kernel, capped at what the CPU supports\n"
+              << "  --output-dir DIR          Directory for density frames (default output)\n"
+              << "  --output-every N          Write the density field every N steps, 0 for the final step only.\n"
+              << "                            Particle modes write particle density rasterized to --width cells,\n"
+              << "                            the lattice Boltzmann mode writes the flow speed and the 3D grid\n"
+              << "                            the density averaged along z\n"
+              << "  --volume-every N          Write the 3D density as a .vol volume every N steps, cropped to the\n"
+              << "                            bricks holding smoke, and the same bricks alone as a sparse, indexed\n"
+              << "                            .bricks file, 0 for none (default 0)\n"
+              << "  --metrics FILE            Write per-step timings as CSV\n"
+              << "  --trace FILE              Record timing zones and write the end of the run as Chrome trace JSON\n"
+              << "  --trace-seconds S         Seconds of history written with --trace (default 10)\n"
+              << "  --checkpoint FILE         Write the solver state to FILE in the background for --restart\n"
+              << "  --checkpoint-every N      Checkpoint every N steps, 0 for the final step only\n"
+              << "  --restart FILE            Resume from a checkpoint taken with the same options, up to --steps\n"
+              << "  --archive FILE            Append compressed frames of density, velocity or particles to FILE\n"
+              << "  --archive-every N         Archive every N steps (default 1)\n";
+}
+
+bool parseOptions(int argc, char** argv, HeadlessOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--help" || argument == "-h") {
+            printUsage();
+            std::exit(EXIT_SUCCESS);
+        }
+        if (argument == "--pin-threads") {
+            options.pinThreads = true;
+            continue;
+        }
+        if (argument == "--sparse") {
+            options.grid3d.sparse = true;
+            continue;
+        }
+        if (argument == "--pbf-projection") {
+            options.pbf.densityProjection = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << argument << "." << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (argument == "--steps") {
+            options.steps = std::atoi(value.c_str());
+        } else if (argument == "--size") {
+            options.settings.width = options.settings.height = std::atoi(value.c_str());
+            options.grid3d.width = options.grid3d.height = options.grid3d.depth = options.settings.width;
+        } else if (argument == "--width") {
+            options.settings.width = options.grid3d.width = std::atoi(value.c_str());
+        } else if (argument == "--height") {
+            options.settings.height = options.grid3d.height = std::atoi(value.c_str());
+        } else if (argument == "--depth") {
+            options.grid3d.depth = std::atoi(value.c_str());
+        } else if (argument == "--threads") {
+            options.threads = std::atoi(value.c_str());
+        } else if (argument == "--hz") {
+            options.stepHz = std::atof(value.c_str());
+        } else if (argument == "--cfl") {
+            options.settings.cflNumber = options.grid3d.cflNumber = static_cast<float>(std::atof(value.c_str()));
+        } else if (argument == "--max-substeps") {
+            options.settings.maxSubsteps = options.grid3d.maxSubsteps = std::atoi(value.c_str());
+        } else if (argument == "--mode") {
+            if (value == "grid") {
+                options.mode = SimulationMode::Grid;
+            } else if (value == "grid3d") {
+                options.mode = SimulationMode::Grid3D;
+            } else if (value == "sph") {
+                options.mode = SimulationMode::Sph;
+            } else if (value == "pbf") {
+                options.mode = SimulationMode::Pbf;
+            } else if (value == "flip") {
+                options.mode = SimulationMode::Flip;
+            } else if (value == "lbm") {
+                options.mode = SimulationMode::Lbm;
+            } else {
+                std::cerr << "Unknown mode " << value << "." << std::endl;
+                return false;
+            }
+        } else if (argument == "--particles") {
+            options.sph.particleCount = options.pbf.particleCount = options.flip.particleCount = std::atoi(value.c_str());
+        } else if (argument == "--pbf-substeps") {
+            options.pbf.substeps = std::atoi(value.c_str());
+        } else if (argument == "--pbf-iterations") {
+            options.pbf.iterations = std::atoi(value.c_str());
+        } else if (argument == "--pbf-max-iterations") {
+            options.pbf.maxIterations = std::atoi(value.c_str());
+        } else if (argument == "--pbf-tolerance") {
+            options.pbf.densityTolerance = static_cast<float>(std::atof(value.c_str()));
+        } else if (argument == "--flip-transfer") {
+            if (value == "pic") {
+                options.flip.transfer = FlipTransfer::Pic;
+            } else if (value == "flip") {
+                options.flip.transfer = FlipTransfer::Flip;
+            } else if (value == "apic") {
+                options.flip.transfer = FlipTransfer::Apic;
+            } else {
+                std::cerr << "Unknown FLIP transfer " << value << "." << std::endl;
+                return false;
+            }
+        } else if (argument == "--flip-ratio") {
+            options.flip.flipRatio = static_cast<float>(std::atof(value.c_str()));
+        } else if (argument == "--lbm-collision") {
+            if (value == "bgk") {
+                options.lbm.collision = LbmCollision::Bgk;
+            } else if (value == "mrt") {
+                options.lbm.collision = LbmCollision::Mrt;
+            } else {
+                std::cerr << "Unknown lattice Boltzmann collision " << value << "." << std::endl;
+                return false;
+            }
+        } else if (argument == "--lbm-steps") {
+            options.lbm.stepsPerUpdate = std::atoi(value.c_str());
+        } else if (argument == "--reynolds") {
+            options.lbm.reynolds = static_cast<float>(std::atof(value.c_str()));
+        } else if (argument == "--reorder-interval") {
+            options.sph.reorderInterval = options.pbf.reorderInterval = options.flip.reorderInterval = std::atoi(value.c_str());
+        } else if (argument == "--scene") {
+            if (value == "plume") {
+                options.scene = SceneType::Plume;
+            } else if (value == "obstacle") {
+                options.scene = SceneType::Obstacle;
+            } else {
+                std::cerr << "Unknown scene " << value << "." << std::endl;
+                return false;
+            }
+        } else if (argument == "--pressure-solver") {
+            if (value == "jacobi") {
+                options.settings.pressureSolver = PressureSolverType::Jacobi;
+            } else if (value == "multigrid") {
+                options.settings.pressureSolver = PressureSolverType::Multigrid;
+            } else if (value == "pcg") {
+                options.settings.pressureSolver = PressureSolverType::ConjugateGradient;
+            } else {
+                std::cerr << "Unknown pressure solver " << value << "." << std::endl;
+                return false;
+            }
+        } else if (argument == "--jacobi-iterations") {
+            options.settings.jacobiIterations = std::atoi(value.c_str());
+        } else if (argument == "--multigrid-cycles") {
+            options.settings.multigrid.maxCycles = std::atoi(value.c_str());
+        } else if (argument == "--pcg-iterations") {
+            options.settings.pcg.maxIterations = options.grid3d.pcg.maxIterations = std::atoi(value.c_str());
+        } else if (argument == "--pressure-tolerance") {
+            float tolerance = static_cast<float>(std::atof(value.c_str()));
+            options.settings.multigrid.tolerance = tolerance;
+            options.settings.pcg.tolerance = tolerance;
+            options.grid3d.pcg.tolerance = tolerance;
+        } else if (argument == "--advection") {
+            if (value == "semi-lagrangian") {
+                options.settings.advection = AdvectionScheme::SemiLagrangian;
+            } else if (value == "maccormack") {
+                options.settings.advection = AdvectionScheme::MacCormack;
+            } else if (value == "bfecc") {
+                options.settings.advection = AdvectionScheme::Bfecc;
+            } else {
+                std::cerr << "Unknown advection scheme " << value << "." << std::endl;
+                return false;
+            }
+            options.grid3d.advection = options.settings.advection;
+        } else if (argument == "--simd") {
+            if (value == "scalar") {
+                options.settings.simd = SimdLevel::Scalar;
+            } else if (value == "sse2") {
+                options.settings.simd = SimdLevel::Sse2;
+            } else if (value == "avx2") {
+                options.settings.simd = SimdLevel::Avx2;
+            } else if (value == "avx512") {
+                options.settings.simd = SimdLevel::Avx512;
+            } else {
+                std::cerr << "Unknown SIMD level " << value << "." << std::endl;
+                return false;
+            }
+            options.settings.simd = supportedSimdLevel(options.settings.simd);
+            options.lbm.simd = options.settings.simd;
+        } else if (argument == "--output-dir") {
+            options.outputDirectory = value;
+        } else if (argument == "--output-every") {
+            options.outputEvery = std::atoi(value.c_str());
+        } else if (argument == "--volume-every") {
+            options.volumeEvery = std::atoi(value.c_str());
+        } else if (argument == "--metrics") {
+            options.metricsPath = value;
+        } else if (argument == "--trace") {
+            options.tracePath = value;
+        } else if (argument == "--trace-seconds") {
+            options.traceSeconds = std::atof(value.c_str());
+        } else if (argument == "--checkpoint") {
+            options.checkpointPath = value;
+        } else if (argument == "--checkpoint-every") {
+            options.checkpointEvery = std::atoi(value.c_str());
+        } else if (argument == "--restart") {
+            options.restartPath = value;
+        } else if (argument == "--archive") {
+            options.archivePath = value;
+        } else if (argument == "--archive-every") {
+            options.archiveEvery = std::atoi(value.c_str());
+        } else {
+            std::cerr << "Unknown option " << argument << "." << std::endl;
+            return false;
+        }
+    }
+
+    if (options.steps < 0 || options.stepHz <= 0.0 || options.settings.width <= 0 || options.settings.height <= 0 ||
+        options.grid3d.width <= 0 || options.grid3d.height <= 0 || options.grid3d.depth <= 0 || options.sph.particleCount <= 0 || options.pbf.substeps <= 0 || options.pbf.iterations <= 0 || options.pbf.maxIterations <= 0 || options.pbf.densityTolerance < 0.0f || options.lbm.stepsPerUpdate <= 0 ||
+        options.checkpointEvery < 0 || options.archiveEvery <= 0 ||
+        options.volumeEvery < 0 || options.settings.cflNumber < 0.0f || options.settings.maxSubsteps <= 0) {
+        std::cerr << "Invalid options." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool writeFrame(const HeadlessOptions& options, const Grid2D& field, const char* prefix, int step) {
+    char name[48];
+    std::snprintf(name, sizeof(name), "%s_%06d.pfm", prefix, step);
+    std::filesystem::path path = std::filesystem::path(options.outputDirectory) / name;
+    if (!writePfm(path.string(), field)) {
+        std::cerr << "Failed to write " << path.string() << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Bins particles into cells and scales counts so fluid at rest spacing reads as 1.
+void rasterizeParticles(const ParticleSet& particles, float spacing, float domainWidth, float domainHeight, Grid2D& out) {
+    std::fill(out.values.begin(), out.values.end(), 0.0f);
+    const float scaleX = out.width / domainWidth;
+    const float scaleY = out.height / domainHeight;
+    const float weight = spacing * spacing * scaleX * scaleY;
+    for (int i = 0; i < particles.size(); i++) {
+        int x = std::clamp(static_cast<int>(particles.positionX[i] * scaleX), 0, out.width - 1);
+        int y = std::clamp(static_cast<int>(particles.positionY[i] * scaleY), 0, out.height - 1);
+        out(x + 1, y + 1) += weight;
+    }
+}
+
+int main(int argc, char** argv) {
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(options.outputDirectory, error);
+    if (error) {
+        std::cerr << "Failed to create output directory " << options.outputDirectory << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!options.tracePath.empty()) {
+        setTraceThreadName("main");
+        setTracingEnabled(true);
+    }
+
+    ThreadPool pool(options.threads, options.pinThreads);
+    std::optional<FluidSolver> solver;
+    std::optional<SphSolver> sph;
+    std::optional<PbfSolver> pbf;
+    std::optional<FlipSolver> flip;
+    std::optional<LbmSolver> lbm;
+    std::optional<FluidSolver3D> grid3d;
+    const ParticleSet* particles = nullptr;
+    Grid2D particleField;
+    Grid2D speedField;
+    // Views of the 3D grid; only the density one is written.
+    Grid2D viewDensity;
+    Grid2D viewVelocityX;
+    Grid2D viewVelocityY;
+    Grid2D viewPressure;
+    if (options.mode == SimulationMode::Grid) {
+        solver.emplace(options.settings, pool);
+        setupScene(*solver, options.scene);
+    } else if (options.mode == SimulationMode::Lbm) {
+        options.lbm.width = options.settings.width;
+        options.lbm.height = options.settings.height;
+        lbm.emplace(options.lbm, pool);
+        speedField.resize(lbm->density.width, lbm->density.height);
+    } else if (options.mode == SimulationMode::Grid3D) {
+        grid3d.emplace(options.grid3d, pool);
+    } else {
+        if (options.mode == SimulationMode::Sph) {
+            particles = &sph.emplace(options.sph, pool).particles;
+        } else if (options.mode == SimulationMode::Pbf) {
+            particles = &pbf.emplace(options.pbf, pool).particles;
+        } else {
+            particles = &flip.emplace(options.flip, pool).particles;
+        }
+        int height = std::max(1, static_cast<int>(options.settings.width * options.sph.domainHeight / options.sph.domainWidth));
+        particleField.resize(options.settings.width, height);
+    }
+
+    auto writeOutput = [&](int step) {
+        if (solver) {
+            return writeFrame(options, solver->density, "density", step);
+        }
+        if (lbm) {
+            for (std::size_t i = 0; i < speedField.size(); i++) {
+                speedField.values[i] = std::hypot(lbm->velocityX.values[i], lbm->velocityY.values[i]);
+            }
+            return writeFrame(options, speedField, "speed", step);
+        }
+        if (grid3d) {
+            extractVolumeView(pool, *grid3d, { VolumeView::Projection, ViewAxis::Z }, viewDensity, viewVelocityX, viewVelocityY,
+                              viewPressure);
+            return writeFrame(options, viewDensity, "density3d", step);
+        }
+        float spacing = sph ? sph->particleSpacing() : pbf ? pbf->particleSpacing() : flip->particleSpacing();
+        rasterizeParticles(*particles, spacing, options.sph.domainWidth, options.sph.domainHeight, particleField);
+        return writeFrame(options, particleField, "particles", step);
+    };
+
+    using Clock = std::chrono::steady_clock;
+    auto saveState = [&](SnapshotWriter& snapshot) {
+        if (solver) {
+            solver->saveState(snapshot);
+        } else if (sph) {
+            sph->saveState(snapshot);
+        } else if (pbf) {
+            pbf->saveState(snapshot);
+        } else if (lbm) {
+            lbm->saveState(snapshot);
+        } else if (grid3d) {
+            grid3d->saveState(snapshot);
+        } else {
+            flip->saveState(snapshot);
+        }
+    };
+
+    int firstStep = 1;
+    if (!options.restartPath.empty()) {
+        Clock::time_point restoreStart = Clock::now();
+        Snapshot snapshot;
+        if (!snapshot.open(options.restartPath)) {
+            std::cerr << "Failed to open checkpoint: " << snapshot.error << "." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (snapshot.mode() != options.mode) {
+            std::cerr << "Failed to restart: " << options.restartPath << " holds a " << simulationModeNames[static_cast<int>(snapshot.mode())]
+                      << " run." << std::endl;
+            return EXIT_FAILURE;
+        }
+        const bool loaded = solver ? solver->loadState(snapshot)
+                            : sph  ? sph->loadState(snapshot)
+                            : pbf  ? pbf->loadState(snapshot)
+                            : lbm  ? lbm->loadState(snapshot)
+                            : grid3d ? grid3d->loadState(snapshot)
+                                     : flip->loadState(snapshot);
+        if (!loaded) {
+            std::cerr << "Failed to restart from " << options.restartPath << ": " << snapshot.error << "." << std::endl;
+            return EXIT_FAILURE;
+        }
+        firstStep = static_cast<int>(snapshot.step()) + 1;
+        std::printf("restarted at step %d from %s, %.1f MB in %.3f ms\n", firstStep - 1, options.restartPath.c_str(),
+                    snapshot.bytes() / 1048576.0, std::chrono::duration<double>(Clock::now() - restoreStart).count() * 1e3);
+    }
+
+    // Checkpoints are copied out between steps and written while the solver carries on.
+    AsyncSnapshotWriter checkpointWriter;
+    int checkpoints = 0;
+    double checkpointBytes = 0.0;
+    double captureSeconds = 0.0;
+    auto checkpoint = [&](int step) {
+        Clock::time_point captureStart = Clock::now();
+        SnapshotWriter snapshot = checkpointWriter.take(options.mode, static_cast<std::uint64_t>(step));
+        saveState(snapshot);
+        checkpointBytes = static_cast<double>(snapshot.bytes());
+        checkpointWriter.submit(std::move(snapshot), options.checkpointPath);
+        captureSeconds += std::chrono::duration<double>(Clock::now() - captureStart).count();
+        checkpoints++;
+    };
+
+    // Frames are copied into the archive's buffers between steps and compressed and written by its workers.
+    // A run never drops a frame; when the workers fall behind, the wait shows up as archive stall time.
+    FrameArchiveWriter archive;
+    if (!options.archivePath.empty() && !archive.open(options.archivePath)) {
+        std::cerr << "Failed to create archive " << options.archivePath << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    double archiveCaptureSeconds = 0.0;
+    auto archiveFrame = [&](int step) {
+        Clock::time_point captureStart = Clock::now();
+        ArchiveFrame* frame = archive.beginFrame(static_cast<std::uint64_t>(step), true);
+        if (solver) {
+            solver->addArchiveFields(*frame);
+        } else if (sph) {
+            sph->addArchiveFields(*frame);
+        } else if (pbf) {
+            pbf->addArchiveFields(*frame);
+        } else if (lbm) {
+            lbm->addArchiveFields(*frame);
+        } else if (grid3d) {
+            grid3d->addArchiveFields(*frame);
+        } else {
+            flip->addArchiveFields(*frame);
+        }
+        archive.submit(frame);
+        archiveCaptureSeconds += std::chrono::duration<double>(Clock::now() - captureStart).count();
+    };
+
+    int volumes = 0;
+    double volumeSeconds = 0.0;
+    double volumeBytes = 0.0;
+    double brickVolumeBytes = 0.0;
+    auto writeVolume = [&](int step) {
+        Clock::time_point writeStart = Clock::now();
+        char name[48];
+        std::snprintf(name, sizeof(name), "density_%06d.vol", step);
+        std::filesystem::path path = std::filesystem::path(options.outputDirectory) / name;
+        if (!writeVol(path.string(), grid3d->density, options.grid3d.activeDensity)) {
+            std::cerr << "Failed to write " << path.string() << "." << std::endl;
+            return false;
+        }
+        volumeBytes += static_cast<double>(std::filesystem::file_size(path, error));
+        path.replace_extension(".bricks");
+        if (!writeBrickVolume(path.string(), grid3d->density, static_cast<std::uint64_t>(step), options.grid3d.activeDensity)) {
+            std::cerr << "Failed to write " << path.string() << "." << std::endl;
+            return false;
+        }
+        volumeSeconds += std::chrono::duration<double>(Clock::now() - writeStart).count();
+        brickVolumeBytes += static_cast<double>(std::filesystem::file_size(path, error));
+        volumes++;
+        return true;
+    };
+
+    const float dt = static_cast<float>(1.0 / options.stepHz);
+    std::vector<StepMetrics> stepMetrics;
+    stepMetrics.reserve(options.steps);
+
+    Clock::time_point runStart = Clock::now();
+    double simulatedSeconds = 0.0;
+    double gatherCacheLines = 0.0;
+    double pbfIterations = 0.0;
+    // Substeps the grid modes split their steps into, and the fastest flow they saw.
+    long long gridSubsteps = 0;
+    int mostSubsteps = 0;
+    float maxSpeed = 0.0f;
+    auto recordSubsteps = [&](const SubstepStats& stats) {
+        simulatedSeconds += stats.simulatedSeconds;
+        gridSubsteps += stats.substeps;
+        mostSubsteps = std::max(mostSubsteps, stats.substeps);
+        maxSpeed = std::max(maxSpeed, stats.maxSpeed);
+    };
+    // Time in the lattice steps alone, without refreshing the macroscopic fields after each update.
+    double latticeSeconds = 0.0;
+    for (int step = firstStep; step <= options.steps; step++) {
+        Clock::time_point stepStart = Clock::now();
+        if (solver) {
+            solver->step(dt);
+        } else if (sph) {
+            sph->step(dt);
+        } else if (pbf) {
+            pbf->step(dt);
+        } else if (lbm) {
+            lbm->step();
+        } else if (grid3d) {
+            grid3d->step(dt);
+        } else {
+            flip->step(dt);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - stepStart).count();
+        if (solver) {
+            stepMetrics.push_back({ seconds, solver->pressureStats.iterations, solver->pressureStats.residual, solver->phaseTimes });
+            recordSubsteps(solver->substepStats);
+        } else if (sph) {
+            stepMetrics.push_back({ seconds, sph->stats.substeps, sph->stats.densityError, {} });
+            simulatedSeconds += sph->stats.simulatedSeconds;
+            gatherCacheLines += sph->stats.gatherCacheLines;
+        } else if (pbf) {
+            stepMetrics.push_back({ seconds, pbf->stats.substeps, pbf->stats.densityError, {} });
+            simulatedSeconds += pbf->stats.simulatedSeconds;
+            gatherCacheLines += pbf->stats.gatherCacheLines;
+            pbfIterations += pbf->stats.iterations;
+        } else if (lbm) {
+            stepMetrics.push_back({ seconds, lbm->stats.steps, lbm->stats.maxSpeed, {} });
+            latticeSeconds += lbm->stats.mlups <= 0.0 ? 0.0 : static_cast<double>(speedField.width) * speedField.height * lbm->stats.steps / (lbm->stats.mlups * 1e6);
+        } else if (grid3d) {
+            stepMetrics.push_back({ seconds, grid3d->pressureStats.iterations, grid3d->pressureStats.residual, grid3d->phaseTimes });
+            recordSubsteps(grid3d->substepStats);
+        } else {
+            stepMetrics.push_back({ seconds, flip->stats.substeps, flip->pressureStats.residual, {} });
+            simulatedSeconds += flip->stats.simulatedSeconds;
+            gatherCacheLines += flip->stats.gatherCacheLines;
+        }
+
+        if (options.outputEvery > 0 && step % options.outputEvery == 0 && !writeOutput(step)) {
+            return EXIT_FAILURE;
+        }
+        if (!options.checkpointPath.empty() && options.checkpointEvery > 0 && step % options.checkpointEvery == 0) {
+            checkpoint(step);
+        }
+        if (archive.isOpen() && step % options.archiveEvery == 0) {
+            archiveFrame(step);
+        }
+        if (grid3d && options.volumeEvery > 0 && step % options.volumeEvery == 0 && !writeVolume(step)) {
+            return EXIT_FAILURE;
+        }
+    }
+    double totalSeconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+
+    // Frames still in flight when the run ends are finished here, outside the timed steps.
+    Clock::time_point drainStart = Clock::now();
+    if (!archive.close()) {
+        std::cerr << "Failed to write archive " << options.archivePath << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    const double archiveDrainSeconds = std::chrono::duration<double>(Clock::now() - drainStart).count();
+
+    if (!options.checkpointPath.empty()) {
+        if (options.checkpointEvery == 0 || options.steps % options.checkpointEvery != 0) {
+            checkpoint(std::max(options.steps, firstStep - 1));
+        }
+        if (!checkpointWriter.finish()) {
+            std::cerr << "Failed to write checkpoint " << options.checkpointPath << "." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.outputEvery == 0 && !writeOutput(options.steps)) {
+        return EXIT_FAILURE;
+    }
+
+    if (!options.tracePath.empty() && !writeChromeTrace(options.tracePath, options.traceSeconds)) {
+        std::cerr << "Failed to write trace to " << options.tracePath << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!options.metricsPath.empty()) {
+        std::ofstream metrics(options.metricsPath);
+        if (!metrics) {
+            std::cerr << "Failed to write metrics to " << options.metricsPath << "." << std::endl;
+            return EXIT_FAILURE;
+        }
+        metrics << (solver || grid3d ? "step,seconds,pressure_iterations,pressure_residual\n"
+                    : flip  ? "step,seconds,substeps,pressure_residual\n"
+                    : lbm   ? "step,seconds,lattice_steps,max_speed\n"
+                            : "step,seconds,substeps,density_error\n");
+        for (std::size_t i = 0; i < stepMetrics.size(); i++) {
+            const StepMetrics& step = stepMetrics[i];
+            metrics << firstStep + i << "," << step.seconds << "," << step.iterations << "," << step.residual << "\n";
+        }
+    }
+
+    if (!stepMetrics.empty()) {
+        std::vector<double> sorted;
+        double solverSeconds = 0.0;
+        SolverPhaseTimes phaseSeconds;
+        long long substeps = 0;
+        for (const StepMetrics& step : stepMetrics) {
+            sorted.push_back(step.seconds);
+            solverSeconds += step.seconds;
+            phaseSeconds.advect += step.phaseTimes.advect;
+            phaseSeconds.forces += step.phaseTimes.forces;
+            phaseSeconds.divergence += step.phaseTimes.divergence;
+            phaseSeconds.pressure += step.phaseTimes.pressure;
+            phaseSeconds.gradient += step.phaseTimes.gradient;
+            substeps += step.iterations;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        std::size_t p99 = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+        const int stepsRun = static_cast<int>(sorted.size());
+        if (solver) {
+            std::printf("grid %dx%d, %d steps on %d threads in %.3f s, %s %s advection\n", options.settings.width,
+                        options.settings.height, stepsRun, pool.threadCount(), totalSeconds,
+                        simdLevelNames[static_cast<int>(options.settings.simd)], advectionSchemeNames[static_cast<int>(options.settings.advection)]);
+        } else if (grid3d) {
+            std::printf("grid %dx%dx%d, %d of %d bricks active, %d steps on %d threads in %.3f s, %s advection\n", grid3d->width(),
+                        grid3d->height(), grid3d->depth(), grid3d->activeBricks(), grid3d->density.totalBricks(), stepsRun, pool.threadCount(),
+                        totalSeconds, advectionSchemeNames[static_cast<int>(options.grid3d.advection)]);
+        } else if (lbm) {
+            std::printf("lattice Boltzmann %dx%d, %s collision, %d steps (%lld lattice steps) on %d threads in %.3f s, %s kernel\n",
+                        speedField.width, speedField.height, lbmCollisionNames[static_cast<int>(options.lbm.collision)], stepsRun,
+                        substeps, pool.threadCount(), totalSeconds, simdLevelNames[static_cast<int>(options.lbm.simd)]);
+        } else {
+            std::printf("%s, %d particles, %d steps on %d threads in %.3f s, %.3f s simulated\n",
+                        simulationModeNames[static_cast<int>(options.mode)], particles->size(), stepsRun,
+                        pool.threadCount(), totalSeconds, simulatedSeconds);
+        }
+        std::printf("step ms: min %.3f  avg %.3f  p99 %.3f  max %.3f\n", sorted.front() * 1e3,
+                    solverSeconds / sorted.size() * 1e3, sorted[p99] * 1e3, sorted.back() * 1e3);
+        if (!lbm) {
+            // Capped substeps simulate less than the steps asked for, and slow steps take longer than they simulate.
+            const double requestedSeconds = stepsRun / options.stepHz;
+            std::printf("real time: %.3f s simulated of %.3f s requested (%.1f%%), %.2fx wall clock\n", simulatedSeconds, requestedSeconds,
+                        100.0 * simulatedSeconds / requestedSeconds, simulatedSeconds / solverSeconds);
+        }
+        if (solver || grid3d) {
+            double toAverageMs = 1e3 / sorted.size();
+            double cells = solver ? static_cast<double>(options.settings.width) * options.settings.height
+                                  : static_cast<double>(grid3d->activeBricks()) * BrickGrid::brickCells;
+            std::printf("phase avg ms: advect %.3f  forces %.3f  divergence %.3f  pressure %.3f  gradient %.3f\n",
+                        phaseSeconds.advect * toAverageMs, phaseSeconds.forces * toAverageMs, phaseSeconds.divergence * toAverageMs,
+                        phaseSeconds.pressure * toAverageMs, phaseSeconds.gradient * toAverageMs);
+            std::printf("throughput: %.2f Mcells/s\n", cells * sorted.size() / solverSeconds * 1e-6);
+            std::printf("substeps: %.2f per step, at most %d, max speed %.1f cells/s, %.3f s simulated\n",
+                        static_cast<double>(gridSubsteps) / sorted.size(), mostSubsteps, maxSpeed, simulatedSeconds);
+        } else if (lbm) {
+            double nodes = static_cast<double>(speedField.width) * speedField.height;
+            std::printf("throughput: %.1f MLUPS, %.1f MLUPS with macroscopic fields, tau %.4f, max speed %.4f\n",
+                        nodes * substeps / latticeSeconds * 1e-6, nodes * substeps / solverSeconds * 1e-6, lbm->stats.tau,
+                        lbm->stats.maxSpeed);
+        } else {
+            std::printf("substeps: %.2f per step, throughput: %.2f Mparticle-substeps/s\n", static_cast<double>(substeps) / sorted.size(),
+                        static_cast<double>(particles->size()) * substeps / solverSeconds * 1e-6);
+            if (pbf) {
+                std::printf("iterations: %.1f per substep\n", pbfIterations / sorted.size());
+            }
+            std::printf("gather cache lines: %.3f per particle\n", gatherCacheLines / sorted.size());
+            if (!flip) {
+                double errorSum = 0.0;
+                float errorMax = 0.0f;
+                for (const StepMetrics& step : stepMetrics) {
+                    errorSum += step.residual;
+                    errorMax = std::max(errorMax, step.residual);
+                }
+                std::printf("density error: mean %.4f  max %.4f\n", errorSum / stepMetrics.size(), errorMax);
+            }
+        }
+        if (!options.archivePath.empty()) {
+            const FrameArchiveStats written = archive.stats();
+            std::printf("archive: %llu frames, %.1f MB -> %.1f MB (%.2fx), %.3f ms average capture, compression %.0f MB/s, %.3f s stalled, %.3f s draining at exit\n",
+                        static_cast<unsigned long long>(written.framesWritten), written.rawBytes / 1048576.0, written.storedBytes / 1048576.0,
+                        written.storedBytes > 0 ? static_cast<double>(written.rawBytes) / written.storedBytes : 0.0,
+                        written.framesWritten > 0 ? archiveCaptureSeconds / written.framesWritten * 1e3 : 0.0,
+                        written.compressSeconds > 0.0 ? written.rawBytes / written.compressSeconds / 1048576.0 : 0.0, written.stallSeconds,
+                        archiveDrainSeconds);
+        }
+        if (volumes > 0) {
+            std::printf("volumes: %d of %.1f MB .vol and %.1f MB .bricks average, %.3f ms average write\n", volumes,
+                        volumeBytes / volumes / 1048576.0, brickVolumeBytes / volumes / 1048576.0, volumeSeconds / volumes * 1e3);
+        }
+        if (checkpoints > 0) {
+            std::printf("checkpoints: %d of %.1f MB, %.3f ms average capture\n", checkpoints, checkpointBytes / 1048576.0,
+                        captureSeconds / checkpoints * 1e3);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#include "advect_kernels.h"
+
+#include <immintrin.h>
+
+// Compiled with AVX2 enabled; only reached through selectAdvectKernel and selectLimitKernel once CPUID reports
+// support.
+namespace {
+
+constexpr int lanes = 8;
+
+// Corners of the input around the backtraced positions of one vector of cells, and the bilinear weights.
+struct Backtrace {
+    __m256 s00;
+    __m256 s01;
+    __m256 s10;
+    __m256 s11;
+    __m256 sx;
+    __m256 sy;
+};
+
+Backtrace backtrace(const AdvectKernelArgs& args, int start, int y) {
+    const int stride = args.stride;
+    const int index = start + y * stride;
+    const __m256 dt = _mm256_set1_ps(args.dt);
+    const __m256 minPosition = _mm256_set1_ps(0.5f);
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 xV = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(start), laneOffsets));
+    __m256 yV = _mm256_set1_ps(static_cast<float>(y));
+
+    __m256 px = _mm256_sub_ps(xV, _mm256_mul_ps(dt, _mm256_loadu_ps(args.velocityX + index)));
+    __m256 py = _mm256_sub_ps(yV, _mm256_mul_ps(dt, _mm256_loadu_ps(args.velocityY + index)));
+    px = _mm256_min_ps(_mm256_max_ps(px, minPosition), _mm256_set1_ps(args.maxX));
+    py = _mm256_min_ps(_mm256_max_ps(py, minPosition), _mm256_set1_ps(args.maxY));
+    __m256i x0 = _mm256_cvttps_epi32(px);
+    __m256i y0 = _mm256_cvttps_epi32(py);
+
+    Backtrace result;
+    result.sx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(x0));
+    result.sy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(y0));
+    __m256i sample = _mm256_add_epi32(x0, _mm256_mullo_epi32(y0, _mm256_set1_epi32(stride)));
+    result.s00 = _mm256_i32gather_ps(args.in, sample, 4);
+    result.s01 = _mm256_i32gather_ps(args.in + 1, sample, 4);
+    result.s10 = _mm256_i32gather_ps(args.in + stride, sample, 4);
+    result.s11 = _mm256_i32gather_ps(args.in + stride + 1, sample, 4);
+    return result;
+}
+
+}
+
+void advectTileAvx2(const AdvectKernelArgs& args, const Tile& tile) {
+    if (tile.xEnd - tile.xBegin < lanes) {
+        advectTileScalar(args, tile);
+        return;
+    }
+    const __m256 decay = _mm256_set1_ps(args.decay);
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < tile.xEnd; x += lanes) {
+            // Shift the last vector back to overlap its neighbour instead of running a scalar remainder.
+            const int start = x + lanes <= tile.xEnd ? x : tile.xEnd - lanes;
+            const Backtrace s = backtrace(args, start, y);
+            __m256 bottom = _mm256_add_ps(s.s00, _mm256_mul_ps(s.sx, _mm256_sub_ps(s.s01, s.s00)));
+            __m256 top = _mm256_add_ps(s.s10, _mm256_mul_ps(s.sx, _mm256_sub_ps(s.s11, s.s10)));
+            __m256 value = _mm256_add_ps(bottom, _mm256_mul_ps(s.sy, _mm256_sub_ps(top, bottom)));
+            _mm256_storeu_ps(args.out + start + y * args.stride, _mm256_mul_ps(decay, value));
+        }
+    }
+}
+
+// Updates out in place, so the remainder of each row runs scalar rather than overlapping a vector already stored.
+void limitTileAvx2(const AdvectKernelArgs& args, const Tile& tile) {
+    const int vectorEnd = tile.xBegin + (tile.xEnd - tile.xBegin) / lanes * lanes;
+    const __m256 decay = _mm256_set1_ps(args.decay);
+    const __m256 errorWeight = _mm256_set1_ps(args.errorWeight);
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < vectorEnd; x += lanes) {
+            const int index = x + y * args.stride;
+            const Backtrace s = backtrace(args, x, y);
+            __m256 low = _mm256_min_ps(_mm256_min_ps(s.s00, s.s01), _mm256_min_ps(s.s10, s.s11));
+            __m256 high = _mm256_max_ps(_mm256_max_ps(s.s00, s.s01), _mm256_max_ps(s.s10, s.s11));
+            __m256 value = _mm256_loadu_ps(args.out + index);
+            if (args.error != nullptr) {
+                __m256 error = _mm256_sub_ps(_mm256_loadu_ps(args.in + index), _mm256_loadu_ps(args.error + index));
+                value = _mm256_add_ps(value, _mm256_mul_ps(errorWeight, error));
+            }
+            _mm256_storeu_ps(args.out + index, _mm256_mul_ps(decay, _mm256_min_ps(_mm256_max_ps(value, low), high)));
+        }
+    }
+    if (vectorEnd < tile.xEnd) {
+        limitTileScalar(args, { tile.index, vectorEnd, tile.xEnd, tile.yBegin, tile.yEnd });
+    }
+}
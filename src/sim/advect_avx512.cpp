@@ -0,0 +1,91 @@
+#include "advect_kernels.h"
+
+#include <immintrin.h>
+
+// Compiled with AVX-512F enabled; only reached through selectAdvectKernel and selectLimitKernel once CPUID reports
+// support.
+namespace {
+
+constexpr int lanes = 16;
+
+// Corners of the input around the backtraced positions of one vector of cells, and the bilinear weights.
+struct Backtrace {
+    __m512 s00;
+    __m512 s01;
+    __m512 s10;
+    __m512 s11;
+    __m512 sx;
+    __m512 sy;
+};
+
+Backtrace backtrace(const AdvectKernelArgs& args, int start, int y) {
+    const int stride = args.stride;
+    const int index = start + y * stride;
+    const __m512 dt = _mm512_set1_ps(args.dt);
+    const __m512 minPosition = _mm512_set1_ps(0.5f);
+    const __m512i laneOffsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m512 xV = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(start), laneOffsets));
+    __m512 yV = _mm512_set1_ps(static_cast<float>(y));
+
+    __m512 px = _mm512_sub_ps(xV, _mm512_mul_ps(dt, _mm512_loadu_ps(args.velocityX + index)));
+    __m512 py = _mm512_sub_ps(yV, _mm512_mul_ps(dt, _mm512_loadu_ps(args.velocityY + index)));
+    px = _mm512_min_ps(_mm512_max_ps(px, minPosition), _mm512_set1_ps(args.maxX));
+    py = _mm512_min_ps(_mm512_max_ps(py, minPosition), _mm512_set1_ps(args.maxY));
+    __m512i x0 = _mm512_cvttps_epi32(px);
+    __m512i y0 = _mm512_cvttps_epi32(py);
+
+    Backtrace result;
+    result.sx = _mm512_sub_ps(px, _mm512_cvtepi32_ps(x0));
+    result.sy = _mm512_sub_ps(py, _mm512_cvtepi32_ps(y0));
+    __m512i sample = _mm512_add_epi32(x0, _mm512_mullo_epi32(y0, _mm512_set1_epi32(stride)));
+    result.s00 = _mm512_i32gather_ps(sample, args.in, 4);
+    result.s01 = _mm512_i32gather_ps(sample, args.in + 1, 4);
+    result.s10 = _mm512_i32gather_ps(sample, args.in + stride, 4);
+    result.s11 = _mm512_i32gather_ps(sample, args.in + stride + 1, 4);
+    return result;
+}
+
+}
+
+void advectTileAvx512(const AdvectKernelArgs& args, const Tile& tile) {
+    if (tile.xEnd - tile.xBegin < lanes) {
+        advectTileScalar(args, tile);
+        return;
+    }
+    const __m512 decay = _mm512_set1_ps(args.decay);
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < tile.xEnd; x += lanes) {
+            // Shift the last vector back to overlap its neighbour instead of running a scalar remainder.
+            const int start = x + lanes <= tile.xEnd ? x : tile.xEnd - lanes;
+            const Backtrace s = backtrace(args, start, y);
+            __m512 bottom = _mm512_add_ps(s.s00, _mm512_mul_ps(s.sx, _mm512_sub_ps(s.s01, s.s00)));
+            __m512 top = _mm512_add_ps(s.s10, _mm512_mul_ps(s.sx, _mm512_sub_ps(s.s11, s.s10)));
+            __m512 value = _mm512_add_ps(bottom, _mm512_mul_ps(s.sy, _mm512_sub_ps(top, bottom)));
+            _mm512_storeu_ps(args.out + start + y * args.stride, _mm512_mul_ps(decay, value));
+        }
+    }
+}
+
+// Updates out in place, so the remainder of each row runs scalar rather than overlapping a vector already stored.
+void limitTileAvx512(const AdvectKernelArgs& args, const Tile& tile) {
+    const int vectorEnd = tile.xBegin + (tile.xEnd - tile.xBegin) / lanes * lanes;
+    const __m512 decay = _mm512_set1_ps(args.decay);
+    const __m512 errorWeight = _mm512_set1_ps(args.errorWeight);
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < vectorEnd; x += lanes) {
+            const int index = x + y * args.stride;
+            const Backtrace s = backtrace(args, x, y);
+            __m512 low = _mm512_min_ps(_mm512_min_ps(s.s00, s.s01), _mm512_min_ps(s.s10, s.s11));
+            __m512 high = _mm512_max_ps(_mm512_max_ps(s.s00, s.s01), _mm512_max_ps(s.s10, s.s11));
+            __m512 value = _mm512_loadu_ps(args.out + index);
+            if (args.error != nullptr) {
+                __m512 error = _mm512_sub_ps(_mm512_loadu_ps(args.in + index), _mm512_loadu_ps(args.error + index));
+                value = _mm512_add_ps(value, _mm512_mul_ps(errorWeight, error));
+            }
+            _mm512_storeu_ps(args.out + index, _mm512_mul_ps(decay, _mm512_min_ps(_mm512_max_ps(value, low), high)));
+        }
+    }
+    if (vectorEnd < tile.xEnd) {
+        limitTileScalar(args, { tile.index, vectorEnd, tile.xEnd, tile.yBegin, tile.yEnd });
+    }
+}
@@ -0,0 +1,157 @@
+#include "advect_kernels.h"
+
+#include <algorithm>
+
+#if defined(FLUIDS_X86_KERNELS) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace {
+
+void advectCell(const AdvectKernelArgs& args, int x, int y) {
+    const int stride = args.stride;
+    const int index = x + y * stride;
+    float px = std::clamp(x - args.dt * args.velocityX[index], 0.5f, args.maxX);
+    float py = std::clamp(y - args.dt * args.velocityY[index], 0.5f, args.maxY);
+    int x0 = static_cast<int>(px);
+    int y0 = static_cast<int>(py);
+    float sx = px - x0;
+    float sy = py - y0;
+    const float* s = args.in + x0 + y0 * stride;
+    float bottom = s[0] + sx * (s[1] - s[0]);
+    float top = s[stride] + sx * (s[stride + 1] - s[stride]);
+    args.out[index] = args.decay * (bottom + sy * (top - bottom));
+}
+
+// Operands in the order of the SIMD min and max instructions, which return the second on a tie, so signed
+// zeros come out the same as in the vector kernels.
+float minLane(float a, float b) {
+    return a < b ? a : b;
+}
+
+float maxLane(float a, float b) {
+    return a > b ? a : b;
+}
+
+void limitCell(const AdvectKernelArgs& args, int x, int y) {
+    const int stride = args.stride;
+    const int index = x + y * stride;
+    float px = std::clamp(x - args.dt * args.velocityX[index], 0.5f, args.maxX);
+    float py = std::clamp(y - args.dt * args.velocityY[index], 0.5f, args.maxY);
+    const float* s = args.in + static_cast<int>(px) + static_cast<int>(py) * stride;
+    float low = minLane(minLane(s[0], s[1]), minLane(s[stride], s[stride + 1]));
+    float high = maxLane(maxLane(s[0], s[1]), maxLane(s[stride], s[stride + 1]));
+    float value = args.out[index];
+    if (args.error != nullptr) {
+        value = value + args.errorWeight * (args.in[index] - args.error[index]);
+    }
+    args.out[index] = args.decay * minLane(maxLane(value, low), high);
+}
+
+#ifdef FLUIDS_X86_KERNELS
+SimdLevel queryCpu() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    bool osSavesZmm = osSavesYmm && (_xgetbv(0) & 0xe6) == 0xe6;
+    bool avx2 = false;
+    bool avx512 = false;
+    if (maxLeaf >= 7) {
+        int extended[4];
+        __cpuidex(extended, 7, 0);
+        avx2 = osSavesYmm && (extended[1] & (1 << 5));
+        avx512 = osSavesZmm && (extended[1] & (1 << 16));
+    }
+    if (avx512) {
+        return SimdLevel::Avx512;
+    }
+    if (avx2) {
+        return SimdLevel::Avx2;
+    }
+    return SimdLevel::Sse2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::Sse2;
+    }
+    return SimdLevel::Scalar;
+#endif
+}
+#endif
+
+}
+
+SimdLevel detectSimdLevel() {
+#ifdef FLUIDS_X86_KERNELS
+    static const SimdLevel level = queryCpu();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel supportedSimdLevel(SimdLevel requested) {
+    return std::min(requested, detectSimdLevel());
+}
+
+void advectTileScalar(const AdvectKernelArgs& args, const Tile& tile) {
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < tile.xEnd; x++) {
+            advectCell(args, x, y);
+        }
+    }
+}
+
+void limitTileScalar(const AdvectKernelArgs& args, const Tile& tile) {
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < tile.xEnd; x++) {
+            limitCell(args, x, y);
+        }
+    }
+}
+
+AdvectTileKernel selectAdvectKernel(SimdLevel level) {
+#ifdef FLUIDS_X86_KERNELS
+    switch (supportedSimdLevel(level)) {
+    case SimdLevel::Avx512:
+        return advectTileAvx512;
+    case SimdLevel::Avx2:
+        return advectTileAvx2;
+    case SimdLevel::Sse2:
+        return advectTileSse2;
+    case SimdLevel::Scalar:
+        break;
+    }
+#else
+    (void)level;
+#endif
+    return advectTileScalar;
+}
+
+AdvectTileKernel selectLimitKernel(SimdLevel level) {
+#ifdef FLUIDS_X86_KERNELS
+    switch (supportedSimdLevel(level)) {
+    case SimdLevel::Avx512:
+        return limitTileAvx512;
+    case SimdLevel::Avx2:
+        return limitTileAvx2;
+    case SimdLevel::Sse2:
+        return limitTileSse2;
+    case SimdLevel::Scalar:
+        break;
+    }
+#else
+    (void)level;
+#endif
+    return limitTileScalar;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "thread_pool.h"
+
+// Instruction sets the advection kernel is built for, in increasing order of width.
+enum class SimdLevel {
+    Scalar,
+    Sse2,
+    Avx2,
+    Avx512
+};
+
+// Display names indexed by SimdLevel.
+inline constexpr const char* simdLevelNames[] = { "Scalar", "SSE2", "AVX2", "AVX-512" };
+
+// Widest level that both this build and the running CPU (and OS) support. Detected once with CPUID.
+SimdLevel detectSimdLevel();
+
+// Clamps a requested level to what the machine supports.
+SimdLevel supportedSimdLevel(SimdLevel requested);
+
+// Raw pointers into padded grids that all share one stride. Positions are clamped to [0.5, max].
+struct AdvectKernelArgs {
+    float* out = nullptr;
+    const float* in = nullptr;
+    const float* velocityX = nullptr;
+    const float* velocityY = nullptr;
+    int stride = 0;
+    float dt = 0.0f;
+    float decay = 1.0f;
+    float maxX = 0.0f;
+    float maxY = 0.0f;
+    // Limiter only: errorWeight times the difference of in and error is added to out before clamping. Null
+    // for a plain clamp.
+    const float* error = nullptr;
+    float errorWeight = 0.0f;
+};
+
+using AdvectTileKernel = void (*)(const AdvectKernelArgs& args, const Tile& tile);
+
+// Reference path, and the fallback for tiles narrower than one vector.
+void advectTileScalar(const AdvectKernelArgs& args, const Tile& tile);
+// Limiter of the second-order schemes: backtraces like the advection kernel, then clamps out, corrected by
+// error if set, to the four values of in that the bilinear sample reads, and scales it by decay.
+void limitTileScalar(const AdvectKernelArgs& args, const Tile& tile);
+#ifdef FLUIDS_X86_KERNELS
+// Each lives in its own translation unit compiled for that instruction set; only call after dispatch.
+void advectTileSse2(const AdvectKernelArgs& args, const Tile& tile);
+void advectTileAvx2(const AdvectKernelArgs& args, const Tile& tile);
+void advectTileAvx512(const AdvectKernelArgs& args, const Tile& tile);
+void limitTileSse2(const AdvectKernelArgs& args, const Tile& tile);
+void limitTileAvx2(const AdvectKernelArgs& args, const Tile& tile);
+void limitTileAvx512(const AdvectKernelArgs& args, const Tile& tile);
+#endif
+
+AdvectTileKernel selectAdvectKernel(SimdLevel level);
+AdvectTileKernel selectLimitKernel(SimdLevel level);
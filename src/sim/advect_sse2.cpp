@@ -0,0 +1,102 @@
+#include "advect_kernels.h"
+
+#include <emmintrin.h>
+
+// SSE2 has no gather, so the four bilinear corners are loaded per lane and the arithmetic stays vectorized.
+namespace {
+
+constexpr int lanes = 4;
+
+// Corners of the input around the backtraced positions of one vector of cells, and the bilinear weights.
+struct Backtrace {
+    __m128 s00;
+    __m128 s01;
+    __m128 s10;
+    __m128 s11;
+    __m128 sx;
+    __m128 sy;
+};
+
+Backtrace backtrace(const AdvectKernelArgs& args, int start, int y) {
+    const int stride = args.stride;
+    const int index = start + y * stride;
+    const __m128 dt = _mm_set1_ps(args.dt);
+    const __m128 minPosition = _mm_set1_ps(0.5f);
+    const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+    __m128 xV = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(start), laneOffsets));
+    __m128 yV = _mm_set1_ps(static_cast<float>(y));
+
+    __m128 px = _mm_sub_ps(xV, _mm_mul_ps(dt, _mm_loadu_ps(args.velocityX + index)));
+    __m128 py = _mm_sub_ps(yV, _mm_mul_ps(dt, _mm_loadu_ps(args.velocityY + index)));
+    px = _mm_min_ps(_mm_max_ps(px, minPosition), _mm_set1_ps(args.maxX));
+    py = _mm_min_ps(_mm_max_ps(py, minPosition), _mm_set1_ps(args.maxY));
+    __m128i x0 = _mm_cvttps_epi32(px);
+    __m128i y0 = _mm_cvttps_epi32(py);
+
+    alignas(16) int x0Lanes[lanes];
+    alignas(16) int y0Lanes[lanes];
+    alignas(16) float corners[4][lanes];
+    _mm_store_si128(reinterpret_cast<__m128i*>(x0Lanes), x0);
+    _mm_store_si128(reinterpret_cast<__m128i*>(y0Lanes), y0);
+    for (int lane = 0; lane < lanes; lane++) {
+        const float* s = args.in + x0Lanes[lane] + y0Lanes[lane] * stride;
+        corners[0][lane] = s[0];
+        corners[1][lane] = s[1];
+        corners[2][lane] = s[stride];
+        corners[3][lane] = s[stride + 1];
+    }
+
+    Backtrace result;
+    result.sx = _mm_sub_ps(px, _mm_cvtepi32_ps(x0));
+    result.sy = _mm_sub_ps(py, _mm_cvtepi32_ps(y0));
+    result.s00 = _mm_load_ps(corners[0]);
+    result.s01 = _mm_load_ps(corners[1]);
+    result.s10 = _mm_load_ps(corners[2]);
+    result.s11 = _mm_load_ps(corners[3]);
+    return result;
+}
+
+}
+
+void advectTileSse2(const AdvectKernelArgs& args, const Tile& tile) {
+    if (tile.xEnd - tile.xBegin < lanes) {
+        advectTileScalar(args, tile);
+        return;
+    }
+    const __m128 decay = _mm_set1_ps(args.decay);
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < tile.xEnd; x += lanes) {
+            // Shift the last vector back to overlap its neighbour instead of running a scalar remainder.
+            const int start = x + lanes <= tile.xEnd ? x : tile.xEnd - lanes;
+            const Backtrace s = backtrace(args, start, y);
+            __m128 bottom = _mm_add_ps(s.s00, _mm_mul_ps(s.sx, _mm_sub_ps(s.s01, s.s00)));
+            __m128 top = _mm_add_ps(s.s10, _mm_mul_ps(s.sx, _mm_sub_ps(s.s11, s.s10)));
+            __m128 value = _mm_add_ps(bottom, _mm_mul_ps(s.sy, _mm_sub_ps(top, bottom)));
+            _mm_storeu_ps(args.out + start + y * args.stride, _mm_mul_ps(decay, value));
+        }
+    }
+}
+
+// Updates out in place, so the remainder of each row runs scalar rather than overlapping a vector already stored.
+void limitTileSse2(const AdvectKernelArgs& args, const Tile& tile) {
+    const int vectorEnd = tile.xBegin + (tile.xEnd - tile.xBegin) / lanes * lanes;
+    const __m128 decay = _mm_set1_ps(args.decay);
+    const __m128 errorWeight = _mm_set1_ps(args.errorWeight);
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < vectorEnd; x += lanes) {
+            const int index = x + y * args.stride;
+            const Backtrace s = backtrace(args, x, y);
+            __m128 low = _mm_min_ps(_mm_min_ps(s.s00, s.s01), _mm_min_ps(s.s10, s.s11));
+            __m128 high = _mm_max_ps(_mm_max_ps(s.s00, s.s01), _mm_max_ps(s.s10, s.s11));
+            __m128 value = _mm_loadu_ps(args.out + index);
+            if (args.error != nullptr) {
+                __m128 error = _mm_sub_ps(_mm_loadu_ps(args.in + index), _mm_loadu_ps(args.error + index));
+                value = _mm_add_ps(value, _mm_mul_ps(errorWeight, error));
+            }
+            _mm_storeu_ps(args.out + index, _mm_mul_ps(decay, _mm_min_ps(_mm_max_ps(value, low), high)));
+        }
+    }
+    if (vectorEnd < tile.xEnd) {
+        limitTileScalar(args, { tile.index, vectorEnd, tile.xEnd, tile.yBegin, tile.yEnd });
+    }
+}
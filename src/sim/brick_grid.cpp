@@ -0,0 +1,161 @@
+#include "brick_grid.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+// Spreads the low 10 bits of value three bits apart.
+std::uint32_t spreadBits(std::uint32_t value) {
+    value &= 0x3ff;
+    value = (value | (value << 16)) & 0x030000ff;
+    value = (value | (value << 8)) & 0x0300f00f;
+    value = (value | (value << 4)) & 0x030c30c3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+}
+
+std::uint32_t mortonCode3(const BrickCoord& brick) {
+    return spreadBits(brick.x) | (spreadBits(brick.y) << 1) | (spreadBits(brick.z) << 2);
+}
+
+}
+
+void BrickGrid::resizeIndex(int newWidth, int newHeight, int newDepth) {
+    bricksX = std::max(1, (newWidth + brickMask) >> brickShift);
+    bricksY = std::max(1, (newHeight + brickMask) >> brickShift);
+    bricksZ = std::max(1, (newDepth + brickMask) >> brickShift);
+    width = bricksX * brickSize;
+    height = bricksY * brickSize;
+    depth = bricksZ * brickSize;
+    tilesX = (bricksX + tileMask) >> tileShift;
+    tilesY = (bricksY + tileMask) >> tileShift;
+    tilesZ = (bricksZ + tileMask) >> tileShift;
+    rootTiles.assign(static_cast<std::size_t>(tilesX) * tilesY * tilesZ, -1);
+    tileSlots.clear();
+    brickCoords.clear();
+    values.clear();
+}
+
+void BrickGrid::setBrickSlot(const BrickCoord& brick, int slot) {
+    int& tile = rootTiles[(brick.x >> tileShift) + ((brick.y >> tileShift) + (brick.z >> tileShift) * tilesY) * tilesX];
+    if (tile < 0) {
+        tile = static_cast<int>(tileSlots.size());
+        tileSlots.resize(tileSlots.size() + tileBricks, -1);
+    }
+    tileSlots[tile + (brick.x & tileMask) + ((brick.y & tileMask) << tileShift) + ((brick.z & tileMask) << (2 * tileShift))] = slot;
+}
+
+void BrickGrid::resize(int newWidth, int newHeight, int newDepth) {
+    resizeIndex(newWidth, newHeight, newDepth);
+    brickCoords.reserve(static_cast<std::size_t>(totalBricks()));
+    for (int z = 0; z < bricksZ; z++) {
+        for (int y = 0; y < bricksY; y++) {
+            for (int x = 0; x < bricksX; x++) {
+                brickCoords.push_back({ x, y, z });
+            }
+        }
+    }
+    // Stable, so every grid of the same size gets the same layout.
+    std::stable_sort(brickCoords.begin(), brickCoords.end(),
+                     [](const BrickCoord& a, const BrickCoord& b) { return mortonCode3(a) < mortonCode3(b); });
+    for (int slot = 0; slot < brickCount(); slot++) {
+        setBrickSlot(brickCoords[slot], slot);
+    }
+    values.assign(brickCoords.size() * brickCells, 0.0f);
+}
+
+void BrickGrid::resizeSparse(int newWidth, int newHeight, int newDepth) {
+    resizeIndex(newWidth, newHeight, newDepth);
+}
+
+int BrickGrid::setActiveBricks(const std::vector<BrickCoord>& active) {
+    std::vector<unsigned char> keep(brickCoords.size(), 0);
+    std::vector<BrickCoord> added;
+    for (const BrickCoord& brick : active) {
+        const int slot = brickSlot(brick.x, brick.y, brick.z);
+        if (slot >= 0) {
+            keep[slot] = 1;
+        } else {
+            added.push_back(brick);
+        }
+    }
+
+    // Walking down from the last slot, the brick moved into a freed slot has always been visited already
+    // and is one that stays.
+    for (int slot = brickCount() - 1; slot >= 0; slot--) {
+        if (keep[slot]) {
+            continue;
+        }
+        setBrickSlot(brickCoords[slot], -1);
+        const int last = brickCount() - 1;
+        if (slot != last) {
+            std::memcpy(brick(slot), brick(last), brickCells * sizeof(float));
+            brickCoords[slot] = brickCoords[last];
+            setBrickSlot(brickCoords[slot], slot);
+        }
+        brickCoords.pop_back();
+    }
+
+    // Shrinking keeps the capacity, so the released bricks are reused before the pool grows.
+    const int firstAdded = brickCount();
+    values.resize(brickCoords.size() * brickCells);
+    for (const BrickCoord& brick : added) {
+        setBrickSlot(brick, brickCount());
+        brickCoords.push_back(brick);
+    }
+    values.resize(brickCoords.size() * brickCells, 0.0f);
+    return firstAdded;
+}
+
+void loadApron(const BrickGrid& grid, int slot, float* apron, ApronBorder border) {
+    constexpr int n = BrickGrid::brickSize;
+    const BrickCoord& coord = grid.brickCoords[slot];
+    const float* self = grid.brick(slot);
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            std::memcpy(apron + apronOffset(1, y + 1, z + 1), self + brickOffset(0, y, z), n * sizeof(float));
+        }
+    }
+
+    // Each border layer is the facing layer of the neighbor brick, or null for zeros if that brick is
+    // inactive. Past the domain it is the brick's own outer layer, or null.
+    const bool replicate = border == ApronBorder::Replicate;
+    auto layer = [&](bool inside, int bx, int by, int bz, int neighborOffset, int ownOffset) -> const float* {
+        if (inside) {
+            const int neighbor = grid.brickSlot(bx, by, bz);
+            return neighbor < 0 ? nullptr : grid.brick(neighbor) + neighborOffset;
+        }
+        return replicate ? self + ownOffset : nullptr;
+    };
+    const float* lowX = layer(coord.x > 0, coord.x - 1, coord.y, coord.z, brickOffset(n - 1, 0, 0), 0);
+    const float* highX = layer(coord.x + 1 < grid.bricksX, coord.x + 1, coord.y, coord.z, 0, brickOffset(n - 1, 0, 0));
+    const float* lowY = layer(coord.y > 0, coord.x, coord.y - 1, coord.z, brickOffset(0, n - 1, 0), 0);
+    const float* highY = layer(coord.y + 1 < grid.bricksY, coord.x, coord.y + 1, coord.z, 0, brickOffset(0, n - 1, 0));
+    const float* lowZ = layer(coord.z > 0, coord.x, coord.y, coord.z - 1, brickOffset(0, 0, n - 1), 0);
+    const float* highZ = layer(coord.z + 1 < grid.bricksZ, coord.x, coord.y, coord.z + 1, 0, brickOffset(0, 0, n - 1));
+
+    // The y and z layers are rows of x, copied whole; the x layers are a strided column per row.
+    auto copyRow = [](float* target, const float* source) {
+        if (source) {
+            std::memcpy(target, source, n * sizeof(float));
+        } else {
+            std::memset(target, 0, n * sizeof(float));
+        }
+    };
+    for (int z = 0; z < n; z++) {
+        copyRow(apron + apronOffset(1, 0, z + 1), lowY ? lowY + brickOffset(0, 0, z) : nullptr);
+        copyRow(apron + apronOffset(1, n + 1, z + 1), highY ? highY + brickOffset(0, 0, z) : nullptr);
+    }
+    for (int y = 0; y < n; y++) {
+        copyRow(apron + apronOffset(1, y + 1, 0), lowZ ? lowZ + brickOffset(0, y, 0) : nullptr);
+        copyRow(apron + apronOffset(1, y + 1, n + 1), highZ ? highZ + brickOffset(0, y, 0) : nullptr);
+    }
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            apron[apronOffset(0, y + 1, z + 1)] = lowX ? lowX[brickOffset(0, y, z)] : 0.0f;
+            apron[apronOffset(n + 1, y + 1, z + 1)] = highX ? highX[brickOffset(0, y, z)] : 0.0f;
+        }
+    }
+}
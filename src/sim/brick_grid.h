@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "grid.h"
+#include "thread_pool.h"
+
+struct BrickCoord {
+    int x = 0;
+    int y = 0;
+    int z = 0;
+};
+
+/*
+ * Field over a width x height x depth cell grid stored in cubic bricks of 8^3 cells. Each brick is one
+ * contiguous 2 KB block with x fastest, then y, then z, so the six neighbors of a cell inside a brick are at
+ * most 64 floats away; in a flat x-major array the z neighbors are a whole slice away, usually on another
+ * page, and a stencil sweep keeps three slices per field in flight. Bricks are placed along a Z-order curve
+ * and looked up through a brick index, so neighboring bricks mostly share pages too. Sizes are rounded up
+ * to whole bricks, and grids of the same size share one layout, so kernels address several fields with the
+ * same brick slot and offset. Coordinates are 0-based with no ghost cells; stencils read across brick and
+ * domain borders through an apron (see loadApron).
+ *
+ * A sparse grid stores only its active bricks, so the domain can be far larger than memory and a sweep
+ * over the slots costs what the active region costs. Inactive bricks read as zero, the background value.
+ * The brick index is two levels, like the top of a VDB tree: a dense root table over tiles of 8^3 bricks
+ * (64^3 cells), and a table of slots for each tile that has held an active brick. Active bricks sit in
+ * slots 0 to brickCount() - 1 of one pooled allocation; deactivating a brick moves the last one into its
+ * slot, so a change in the active set costs a copy per deactivated brick, not a repack of the grid.
+ */
+struct BrickGrid {
+    static constexpr int brickShift = 3;
+    static constexpr int brickSize = 1 << brickShift;
+    static constexpr int brickMask = brickSize - 1;
+    static constexpr int brickCells = brickSize * brickSize * brickSize;
+
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    int bricksX = 0;
+    int bricksY = 0;
+    int bricksZ = 0;
+    // Brick index: rootTiles[tx + (ty + tz * tilesY) * tilesX] is -1 or the offset in tileSlots of the slots
+    // of tile (tx, ty, tz), which are -1 for inactive bricks. brickCoords holds the brick coordinates of
+    // each slot in memory order.
+    static constexpr int tileShift = 3;
+    static constexpr int tileMask = (1 << tileShift) - 1;
+    static constexpr int tileBricks = 1 << (3 * tileShift);
+    int tilesX = 0;
+    int tilesY = 0;
+    int tilesZ = 0;
+    std::vector<int> rootTiles;
+    std::vector<int> tileSlots;
+    std::vector<BrickCoord> brickCoords;
+    std::vector<float, AlignedAllocator<float>> values;
+
+    BrickGrid() = default;
+    BrickGrid(int width, int height, int depth) { resize(width, height, depth); }
+
+    // Rounds each dimension up to a multiple of brickSize, activates every brick and clears the field.
+    void resize(int newWidth, int newHeight, int newDepth);
+    // Like resize, but with no active bricks.
+    void resizeSparse(int newWidth, int newHeight, int newDepth);
+    // Makes the distinct bricks in active the active set. Bricks that stay keep their values, bricks that
+    // leave are released, and new bricks take slots from the returned one up, cleared. Grids of the same
+    // size given the same calls keep the same layout.
+    int setActiveBricks(const std::vector<BrickCoord>& active);
+    void fill(float value) { values.assign(values.size(), value); }
+
+    int brickCount() const { return static_cast<int>(brickCoords.size()); }
+    int totalBricks() const { return bricksX * bricksY * bricksZ; }
+    // Slot of brick (bx, by, bz), or -1 if it is inactive.
+    int brickSlot(int bx, int by, int bz) const {
+        const int tile = rootTiles[(bx >> tileShift) + ((by >> tileShift) + (bz >> tileShift) * tilesY) * tilesX];
+        if (tile < 0) {
+            return -1;
+        }
+        return tileSlots[tile + (bx & tileMask) + ((by & tileMask) << tileShift) + ((bz & tileMask) << (2 * tileShift))];
+    }
+
+    // Index of cell (x, y, z), which must be in an active brick.
+    std::size_t index(int x, int y, int z) const {
+        const int slot = brickSlot(x >> brickShift, y >> brickShift, z >> brickShift);
+        return static_cast<std::size_t>(slot) * brickCells + (x & brickMask) + ((y & brickMask) << brickShift)
+            + ((z & brickMask) << (2 * brickShift));
+    }
+    float& operator()(int x, int y, int z) { return values[index(x, y, z)]; }
+    float operator()(int x, int y, int z) const { return values[index(x, y, z)]; }
+    // Cell (x, y, z) of any brick in the domain, zero if the brick is inactive.
+    float read(int x, int y, int z) const {
+        const int slot = brickSlot(x >> brickShift, y >> brickShift, z >> brickShift);
+        return slot < 0 ? 0.0f : values[static_cast<std::size_t>(slot) * brickCells + (x & brickMask) + ((y & brickMask) << brickShift)
+                                        + ((z & brickMask) << (2 * brickShift))];
+    }
+
+    float* brick(int slot) { return values.data() + static_cast<std::size_t>(slot) * brickCells; }
+    const float* brick(int slot) const { return values.data() + static_cast<std::size_t>(slot) * brickCells; }
+
+    float* data() { return values.data(); }
+    const float* data() const { return values.data(); }
+    std::size_t size() const { return values.size(); }
+
+private:
+    void resizeIndex(int newWidth, int newHeight, int newDepth);
+    // Points the index entry of brick at slot, allocating the table of its tile on first use. Tile tables
+    // are kept once allocated; at 2 KB per 64^3 cells they are not worth tracking.
+    void setBrickSlot(const BrickCoord& brick, int slot);
+};
+
+// Offset of local cell (x, y, z) within a brick.
+constexpr int brickOffset(int x, int y, int z) {
+    return x + (y << BrickGrid::brickShift) + (z << (2 * BrickGrid::brickShift));
+}
+
+// A brick with a one cell border on each face, (brickSize + 2)^3 cells with x fastest. Only the six face
+// layers of the border are filled, which is all a 7-point stencil reads.
+constexpr int apronSize = BrickGrid::brickSize + 2;
+constexpr int apronCells = apronSize * apronSize * apronSize;
+
+constexpr int apronOffset(int x, int y, int z) {
+    return x + (y + z * apronSize) * apronSize;
+}
+
+// What the apron holds past the domain: a copy of the cell inside (zero normal gradient, the pressure
+// walls) or zero (the velocity faces on the walls).
+enum class ApronBorder {
+    Replicate,
+    Zero
+};
+
+// Copies brick slot of grid and the facing layers of its six neighbors into apron, where local cell
+// (x, y, z) of the brick lands at apronOffset(x + 1, y + 1, z + 1). Inactive neighbors give zeros.
+void loadApron(const BrickGrid& grid, int slot, float* apron, ApronBorder border);
+
+template <typename Body>
+void parallelForBricks(ThreadPool& pool, const BrickGrid& grid, Body&& body) {
+    pool.parallelFor(grid.brickCount(), [&](int slot) { body(slot); });
+}
+
+// Maps every brick to a partial result and folds the partials in slot order, so results do not depend on scheduling.
+template <typename T, typename Map, typename Combine>
+T parallelReduceBricks(ThreadPool& pool, const BrickGrid& grid, T identity, Map&& map, Combine&& combine) {
+    std::vector<T> partials(grid.brickCount(), identity);
+    pool.parallelFor(grid.brickCount(), [&](int slot) { partials[slot] = map(slot); });
+    T result = identity;
+    for (const T& partial : partials) {
+        result = combine(result, partial);
+    }
+    return result;
+}
@@ -0,0 +1,146 @@
+#include "field_io.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// Slots of the bricks holding any value above cutoff, in slot order.
+std::vector<int> occupiedBricks(const BrickGrid& grid, float cutoff) {
+    std::vector<int> slots;
+    for (int slot = 0; slot < grid.brickCount(); slot++) {
+        const float* values = grid.brick(slot);
+        if (std::any_of(values, values + BrickGrid::brickCells, [&](float value) { return value > cutoff; })) {
+            slots.push_back(slot);
+        }
+    }
+    return slots;
+}
+
+// Smallest box of bricks around slots, as its first brick and extent. Zero extents when slots is empty.
+void brickBox(const BrickGrid& grid, const std::vector<int>& slots, int begin[3], int extent[3]) {
+    int low[3] = { grid.bricksX, grid.bricksY, grid.bricksZ };
+    int high[3] = { -1, -1, -1 };
+    for (int slot : slots) {
+        const BrickCoord& coord = grid.brickCoords[slot];
+        const int brick[3] = { coord.x, coord.y, coord.z };
+        for (int axis = 0; axis < 3; axis++) {
+            low[axis] = std::min(low[axis], brick[axis]);
+            high[axis] = std::max(high[axis], brick[axis]);
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        begin[axis] = slots.empty() ? 0 : low[axis];
+        extent[axis] = slots.empty() ? 0 : high[axis] - low[axis] + 1;
+    }
+}
+
+}
+
+bool writePfm(const std::string& path, const Grid2D& grid) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    // A negative scale marks the data as little-endian. Rows are stored bottom to top, matching the grid.
+    file << "Pf\n" << grid.width << " " << grid.height << "\n-1.0\n";
+    for (int y = 1; y <= grid.height; y++) {
+        file.write(reinterpret_cast<const char*>(grid.row(y) + 1), grid.width * sizeof(float));
+    }
+    return static_cast<bool>(file);
+}
+
+bool writeVol(const std::string& path, const BrickGrid& grid, float cutoff) {
+    constexpr int n = BrickGrid::brickSize;
+    const std::vector<int> slots = occupiedBricks(grid, cutoff);
+    int boxBegin[3];
+    int boxBricks[3];
+    brickBox(grid, slots, boxBegin, boxBricks);
+    // An empty field still needs a voxel for readers to accept the file.
+    const bool empty = slots.empty();
+    const int size[3] = { grid.width, grid.height, grid.depth };
+    int begin[3];
+    int resolution[3];
+    for (int axis = 0; axis < 3; axis++) {
+        begin[axis] = boxBegin[axis] * n;
+        resolution[axis] = empty ? 1 : std::min(size[axis], (boxBegin[axis] + boxBricks[axis]) * n) - begin[axis];
+    }
+
+    std::vector<float> data(static_cast<std::size_t>(resolution[0]) * resolution[1] * resolution[2], 0.0f);
+    for (int slot = 0; !empty && slot < grid.brickCount(); slot++) {
+        const BrickCoord& coord = grid.brickCoords[slot];
+        if (coord.x < boxBegin[0] || coord.x >= boxBegin[0] + boxBricks[0] || coord.y < boxBegin[1] || coord.y >= boxBegin[1] + boxBricks[1]
+            || coord.z < boxBegin[2] || coord.z >= boxBegin[2] + boxBricks[2]) {
+            continue;
+        }
+        const float* values = grid.brick(slot);
+        const int x0 = coord.x * n - begin[0];
+        const int rowLength = std::min(n, resolution[0] - x0);
+        for (int z = 0; z < n && coord.z * n - begin[2] + z < resolution[2]; z++) {
+            for (int y = 0; y < n && coord.y * n - begin[1] + y < resolution[1]; y++) {
+                const std::size_t row = (static_cast<std::size_t>(coord.z * n - begin[2] + z) * resolution[1] + (coord.y * n - begin[1] + y))
+                    * resolution[0];
+                std::copy_n(values + brickOffset(0, y, z), rowLength, data.data() + row + x0);
+            }
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    // Header: "VOL", version 3, encoding 1 (float32), the resolution, one channel, then the bounding box.
+    const float scale = 1.0f / std::max({ grid.width, grid.height, grid.depth });
+    const char magic[4] = { 'V', 'O', 'L', 3 };
+    const std::int32_t header[5] = { 1, resolution[0], resolution[1], resolution[2], 1 };
+    const float bounds[6] = { begin[0] * scale, begin[1] * scale, begin[2] * scale, (begin[0] + resolution[0]) * scale,
+                              (begin[1] + resolution[1]) * scale, (begin[2] + resolution[2]) * scale };
+    file.write(magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size() * sizeof(float)));
+    return static_cast<bool>(file);
+}
+
+bool writeBrickVolume(const std::string& path, const BrickGrid& grid, std::uint64_t step, float cutoff) {
+    const std::vector<int> slots = occupiedBricks(grid, cutoff);
+    BrickVolumeHeader header {};
+    std::copy_n(brickVolumeMagic, sizeof(brickVolumeMagic), header.magic);
+    header.version = brickVolumeVersion;
+    header.brickSize = BrickGrid::brickSize;
+    header.size[0] = grid.width;
+    header.size[1] = grid.height;
+    header.size[2] = grid.depth;
+    brickBox(grid, slots, header.boxBegin, header.boxBricks);
+    header.brickCount = static_cast<std::uint32_t>(slots.size());
+    header.step = step;
+
+    // Mark the occupied bricks in the index, then number them in index order and gather their payloads.
+    std::vector<std::int32_t> index(static_cast<std::size_t>(header.boxBricks[0]) * header.boxBricks[1] * header.boxBricks[2], -1);
+    auto entry = [&](const BrickCoord& coord) {
+        return (static_cast<std::size_t>(coord.z - header.boxBegin[2]) * header.boxBricks[1] + (coord.y - header.boxBegin[1])) * header.boxBricks[0]
+            + (coord.x - header.boxBegin[0]);
+    };
+    for (int slot : slots) {
+        index[entry(grid.brickCoords[slot])] = slot;
+    }
+    std::vector<float> payloads(slots.size() * BrickGrid::brickCells);
+    std::int32_t count = 0;
+    for (std::int32_t& value : index) {
+        if (value >= 0) {
+            std::copy_n(grid.brick(value), BrickGrid::brickCells, payloads.data() + static_cast<std::size_t>(count) * BrickGrid::brickCells);
+            value = count++;
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(std::int32_t)));
+    file.write(reinterpret_cast<const char*>(payloads.data()), static_cast<std::streamsize>(payloads.size() * sizeof(float)));
+    return static_cast<bool>(file);
+}
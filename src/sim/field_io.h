@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "brick_grid.h"
+#include "grid.h"
+
+// Writes the interior of a field as a little-endian grayscale PFM image. Returns false if the file cannot be written.
+bool writePfm(const std::string& path, const Grid2D& grid);
+
+// Writes the bricks of a 3D field holding any value above cutoff as a Mitsuba grid volume (.vol): one float
+// channel over the smallest brick-aligned box around them, with x fastest, and a bounding box placing it in
+// a domain whose longest side spans 0 to 1. Only active bricks are read, so a sparse grid costs what it
+// stores, but the file itself is dense over that box: smoke in two far corners fills the whole box between
+// them. writeBrickVolume writes the same bricks without the empty space. Returns false if the file cannot
+// be written.
+bool writeVol(const std::string& path, const BrickGrid& grid, float cutoff = 0.0f);
+
+/*
+ * Sparse brick volume file (.bricks) layout, little-endian, with nothing between the parts:
+ *   BrickVolumeHeader
+ *   index: one int32 per brick of the box, x fastest, then y, then z: the number of the brick's payload,
+ *          or -1 for a brick holding nothing above the cutoff, which reads as zero
+ *   payloads: brickCount blocks of brickSize^3 float32 cells, x fastest, then y, then z
+ * Payloads are numbered in index order, so a reader walking the index meets them in file order, and cell
+ * (x, y, z) lies in payload index[(bz * boxBricks[1] + by) * boxBricks[0] + bx] with b = cell / brickSize
+ * - boxBegin. Cells of the last bricks past the domain size are padding.
+ */
+struct BrickVolumeHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t brickSize;
+    // Domain size in cells.
+    std::int32_t size[3];
+    // First brick of the box the index covers, and its extent in bricks; zero extents for an empty field.
+    std::int32_t boxBegin[3];
+    std::int32_t boxBricks[3];
+    std::uint32_t brickCount;
+    // Steps completed when the volume was written.
+    std::uint64_t step;
+};
+static_assert(sizeof(BrickVolumeHeader) == 64, "the brick volume header is 64 bytes on disk");
+
+inline constexpr char brickVolumeMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'B', 'R', 'K' };
+inline constexpr std::uint32_t brickVolumeVersion = 1;
+
+// Writes the bricks of a 3D field holding any value above cutoff as a sparse brick volume, which costs 4
+// bytes per brick of the box plus 2 KB per brick stored. Returns false if the file cannot be written.
+bool writeBrickVolume(const std::string& path, const BrickGrid& grid, std::uint64_t step, float cutoff = 0.0f);
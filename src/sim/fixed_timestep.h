@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * Converts variable frame times into a whole number of fixed-size simulation steps. Leftover time is
+ * carried to the next frame and exposed as an interpolation factor between the last two simulated
+ * states. When a frame would need more than maxSubsteps steps the excess time is dropped, so a slow
+ * frame slows the simulation down instead of making every following frame more expensive.
+ */
+class FixedTimestep {
+public:
+    explicit FixedTimestep(double stepHz = 60.0, int maxSubsteps = 4) : stepHz(stepHz), maxSubsteps(maxSubsteps) {}
+
+    // Accumulates elapsed wall time and returns how many fixed steps should run this frame.
+    int advance(double elapsedSeconds) {
+        double step = stepSeconds();
+        accumulator += elapsedSeconds;
+        int steps = static_cast<int>(accumulator / step);
+        if (steps > maxSubsteps) {
+            double dropped = accumulator - maxSubsteps * step;
+            // Keep the fractional remainder so interpolation stays continuous after a hitch.
+            double remainder = dropped - static_cast<int>(dropped / step) * step;
+            droppedSeconds += dropped - remainder;
+            accumulator = maxSubsteps * step + remainder;
+            steps = maxSubsteps;
+        }
+        accumulator -= steps * step;
+        lastSteps = steps;
+        return steps;
+    }
+
+    double stepSeconds() const { return 1.0 / stepHz; }
+
+    // Position of the current frame between the previous and latest simulated state, in [0, 1).
+    float alpha() const { return static_cast<float>(accumulator * stepHz); }
+
+    int getLastSteps() const { return lastSteps; }
+    double getDroppedSeconds() const { return droppedSeconds; }
+
+    void reset() {
+        accumulator = 0.0;
+        droppedSeconds = 0.0;
+        lastSteps = 0;
+    }
+
+    double stepHz;
+    int maxSubsteps;
+
+private:
+    double accumulator = 0.0;
+    double droppedSeconds = 0.0;
+    int lastSteps = 0;
+};
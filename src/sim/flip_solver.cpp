@@ -0,0 +1,436 @@
+#include "flip_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "float_mode.h"
+#include "particle_kernels.h"
+#include "trace.h"
+
+namespace {
+
+// Rows of particle bins per splat band. A particle in bin row r writes face rows r to r + 3, so two bands
+// of one color, a whole band apart, never touch the same row.
+constexpr int bandRows = 4;
+
+// Quadratic B-spline weights of the three grid nodes around a particle. Node k sits k - offset cells from
+// the particle, where offset is in [0.5, 1.5).
+struct SplineWeights {
+    float offset;
+    float w[3];
+};
+
+SplineWeights splineWeights(float offset) {
+    return { offset, { 0.5f * (1.5f - offset) * (1.5f - offset), 0.75f - (offset - 1.0f) * (offset - 1.0f), 0.5f * (offset - 0.5f) * (offset - 0.5f) } };
+}
+
+// The 3x3 faces a particle touches: the index of the first one and the weights along each axis.
+struct Stencil {
+    int index;
+    SplineWeights x;
+    SplineWeights y;
+};
+
+// Face (i, j) of a face grid sits (i - shiftX, j - shiftY) cells from the domain origin. The particle
+// position (fx, fy) is in cells.
+Stencil faceStencil(float fx, float fy, float shiftX, float shiftY, int stride) {
+    const float gx = fx + shiftX;
+    const float gy = fy + shiftY;
+    const int bx = static_cast<int>(gx - 0.5f);
+    const int by = static_cast<int>(gy - 0.5f);
+    return { bx + by * stride, splineWeights(gx - bx), splineWeights(gy - by) };
+}
+
+// velocityX(i, j) is on the left edge of cell (i, j), whose center is (i - 0.5, j - 0.5) cells from the
+// origin; velocityY(i, j) is on its bottom edge.
+constexpr float faceXShiftX = 1.0f;
+constexpr float faceXShiftY = 0.5f;
+constexpr float faceYShiftX = 0.5f;
+constexpr float faceYShiftY = 1.0f;
+
+// Particles per cell at rest, as seeded: cells are two particle spacings wide.
+constexpr int restParticlesPerCell = 4;
+
+// Layers of faces next to the fluid that get extrapolated velocities. A particle reads faces up to two
+// cells past its own, so two layers cover every face a surface particle touches.
+constexpr int extrapolationLayers = 2;
+
+// Fills faces without a velocity of their own from the average of their valid neighbors, one layer per
+// pass. valid holds 0 for faces to fill and 1 for faces to keep; a face filled in pass n is marked n + 1
+// and only read from the next pass on, so a pass reads nothing it writes.
+void extrapolate(ThreadPool& pool, Grid2D& velocity, Grid2D& valid) {
+    const int stride = velocity.stride;
+    for (int layer = 1; layer <= extrapolationLayers; layer++) {
+        const float marker = static_cast<float>(layer);
+        parallelForTiles(pool, velocity.width, velocity.height, [&](const Tile& tile) {
+            for (int y = tile.yBegin; y < tile.yEnd; y++) {
+                float* u = velocity.row(y);
+                float* m = valid.row(y);
+                for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                    if (m[x] != 0.0f) {
+                        continue;
+                    }
+                    float sum = 0.0f;
+                    int count = 0;
+                    for (int offset : { -1, 1, -stride, stride }) {
+                        if (m[x + offset] > 0.0f && m[x + offset] <= marker) {
+                            sum += u[x + offset];
+                            count++;
+                        }
+                    }
+                    if (count > 0) {
+                        u[x] = sum / count;
+                        m[x] = marker + 1.0f;
+                    }
+                }
+            }
+        });
+    }
+}
+
+float maxOf(float a, float b) {
+    return std::max(a, b);
+}
+
+}
+
+FlipSolver::FlipSolver(const FlipSettings& settings, ThreadPool& pool) : settings(settings), pool(pool), pcgSolver(pool) {
+    reset();
+}
+
+void FlipSolver::reset() {
+    const int count = std::max(1, settings.particleCount);
+    spacing = placeDamBreak(particles, count, settings.damWidth * settings.domainWidth, settings.damHeight * settings.domainHeight);
+    // Cells two particle spacings wide hold four particles at rest; the domain is rounded to whole cells.
+    const int width = std::max(1, static_cast<int>(std::lround(settings.domainWidth / (2.0f * spacing))));
+    cell = settings.domainWidth / width;
+    const int height = std::max(1, static_cast<int>(std::lround(settings.domainHeight / cell)));
+    for (Grid2D* grid : { &velocityX, &velocityY, &weightX, &weightY, &previousVelocityX, &previousVelocityY }) {
+        grid->resize(width + 1, height + 1);
+    }
+    pressure.resize(width, height);
+    divergence.resize(width, height);
+    cells.resize(width, height);
+    cells.fill(solidCell);
+    for (ParticleArray* array : { &affineXX, &affineXY, &affineYX, &affineYY }) {
+        array->assign(count, 0.0f);
+    }
+    stats = {};
+    pressureStats = {};
+    stepsSinceReorder = 0;
+}
+
+void FlipSolver::saveState(SnapshotWriter& snapshot) const {
+    snapshot.add("positionX", particles.positionX);
+    snapshot.add("positionY", particles.positionY);
+    snapshot.add("velocityX", particles.velocityX);
+    snapshot.add("velocityY", particles.velocityY);
+    snapshot.add("affineXX", affineXX);
+    snapshot.add("affineXY", affineXY);
+    snapshot.add("affineYX", affineYX);
+    snapshot.add("affineYY", affineYY);
+    snapshot.add("pressure", pressure);
+    snapshot.add("stepsSinceReorder", SnapshotType::Int32, &stepsSinceReorder, sizeof(stepsSinceReorder), 1);
+}
+
+bool FlipSolver::loadState(const Snapshot& snapshot) {
+    return snapshot.read("positionX", particles.positionX) && snapshot.read("positionY", particles.positionY)
+        && snapshot.read("velocityX", particles.velocityX) && snapshot.read("velocityY", particles.velocityY)
+        && snapshot.read("affineXX", affineXX) && snapshot.read("affineXY", affineXY) && snapshot.read("affineYX", affineYX)
+        && snapshot.read("affineYY", affineYY) && snapshot.read("pressure", pressure)
+        && snapshot.read("stepsSinceReorder", SnapshotType::Int32, &stepsSinceReorder, 1);
+}
+
+void FlipSolver::addArchiveFields(ArchiveFrame& frame) const {
+    frame.add("positionX", particles.positionX);
+    frame.add("positionY", particles.positionY);
+    frame.add("velocityX", particles.velocityX);
+    frame.add("velocityY", particles.velocityY);
+}
+
+void FlipSolver::step(float dt) {
+    TRACE_ZONE("flipStep");
+    if (dt <= 0.0f || particles.size() == 0) {
+        return;
+    }
+    ScopedFlushDenormals flushDenormals;
+    reorder();
+    const float speed = maxSpeed();
+    const float substepLimit = speed > 0.0f ? settings.cflNumber * cell / speed : dt;
+    int substeps = std::clamp(static_cast<int>(std::ceil(dt / substepLimit)), 1, std::max(1, settings.maxSubsteps));
+    float substep = std::min(dt / substeps, substepLimit);
+
+    for (int i = 0; i < substeps; i++) {
+        bins.build(pool, particles.positionX, particles.positionY, cell, pressure.width * cell, pressure.height * cell);
+        transferToGrid();
+        addGravity(substep);
+        project(substep);
+        transferToParticles();
+        advectParticles(substep);
+    }
+    stats.substeps = substeps;
+    stats.substepSeconds = substep;
+    stats.simulatedSeconds = substep * substeps;
+    stats.maxSpeed = maxSpeed();
+    stats.gatherCacheLines = bins.gatherCacheLines;
+}
+
+// The affine matrices are carried across steps, so they move with the particles.
+void FlipSolver::reorder() {
+    if (settings.reorderInterval <= 0 || ++stepsSinceReorder < settings.reorderInterval) {
+        return;
+    }
+    stepsSinceReorder = 0;
+    sorter.sort(pool, particles, cell, pressure.width * cell, pressure.height * cell, { &affineXX, &affineXY, &affineYX, &affineYY });
+}
+
+void FlipSolver::transferToGrid() {
+    TRACE_ZONE("transferToGrid");
+    const float inverseCell = 1.0f / cell;
+    const bool affine = settings.transfer == FlipTransfer::Apic;
+    const int stride = velocityX.stride;
+    for (Grid2D* grid : { &velocityX, &velocityY, &weightX, &weightY }) {
+        grid->fill(0.0f);
+    }
+    for (int y = 1; y <= cells.height; y++) {
+        std::fill(cells.row(y) + 1, cells.row(y) + cells.width + 1, airCell);
+    }
+
+    // Each band scatters its particles in cell order, so the faces it accumulates into stay in cache.
+    const int bands = (bins.cellsY + bandRows - 1) / bandRows;
+    for (int color = 0; color < 2; color++) {
+        pool.parallelFor((bands - color + 1) / 2, [&](int index) {
+            const int band = 2 * index + color;
+            const int begin = bins.cellStart[band * bandRows * bins.cellsX];
+            const int end = bins.cellStart[std::min((band + 1) * bandRows, bins.cellsY) * bins.cellsX];
+            for (int k = begin; k < end; k++) {
+                const int i = bins.order[k];
+                const float fx = bins.sortedX[k] * inverseCell;
+                const float fy = bins.sortedY[k] * inverseCell;
+                const float u = particles.velocityX[i] * inverseCell;
+                const float v = particles.velocityY[i] * inverseCell;
+                const float cxx = affine ? affineXX[i] : 0.0f;
+                const float cxy = affine ? affineXY[i] : 0.0f;
+                const float cyx = affine ? affineYX[i] : 0.0f;
+                const float cyy = affine ? affineYY[i] : 0.0f;
+                const Stencil sx = faceStencil(fx, fy, faceXShiftX, faceXShiftY, stride);
+                const Stencil sy = faceStencil(fx, fy, faceYShiftX, faceYShiftY, stride);
+                for (int b = 0; b < 3; b++) {
+                    for (int a = 0; a < 3; a++) {
+                        const int node = a + b * stride;
+                        const float wx = sx.x.w[a] * sx.y.w[b];
+                        weightX.values[sx.index + node] += wx;
+                        velocityX.values[sx.index + node] += wx * (u + cxx * (a - sx.x.offset) + cxy * (b - sx.y.offset));
+                        const float wy = sy.x.w[a] * sy.y.w[b];
+                        weightY.values[sy.index + node] += wy;
+                        velocityY.values[sy.index + node] += wy * (v + cyx * (a - sy.x.offset) + cyy * (b - sy.y.offset));
+                    }
+                }
+                cells(static_cast<int>(fx) + 1, static_cast<int>(fy) + 1) = 0;
+            }
+        });
+    }
+
+    parallelForTiles(pool, velocityX.width, velocityX.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* wx = weightX.row(y);
+            const float* wy = weightY.row(y);
+            float* u = velocityX.row(y);
+            float* v = velocityY.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                u[x] *= wx[x] > 0.0f ? 1.0f / wx[x] : 0.0f;
+                v[x] *= wy[x] > 0.0f ? 1.0f / wy[x] : 0.0f;
+            }
+        }
+    });
+    enforceWalls();
+    previousVelocityX.values = velocityX.values;
+    previousVelocityY.values = velocityY.values;
+    cellsRevision++;
+}
+
+void FlipSolver::addGravity(float dt) {
+    TRACE_ZONE("addGravity");
+    const float impulse = settings.gravity * dt / cell;
+    parallelForTiles(pool, velocityY.width, velocityY.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* w = weightY.row(y);
+            float* v = velocityY.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                v[x] += w[x] > 0.0f ? impulse : 0.0f;
+            }
+        }
+    });
+    enforceWalls();
+}
+
+void FlipSolver::enforceWalls() {
+    const int width = pressure.width;
+    const int height = pressure.height;
+    // Faces outside the walls are mirrored: the normal component flips sign across the wall and the
+    // tangential one is copied, so the walls are free slip for particles reading through them.
+    for (int y = 0; y <= height + 2; y++) {
+        velocityX(1, y) = 0.0f;
+        velocityX(width + 1, y) = 0.0f;
+        velocityX(0, y) = -velocityX(2, y);
+        velocityX(width + 2, y) = -velocityX(width, y);
+    }
+    for (int x = 0; x <= width + 2; x++) {
+        velocityX(x, 0) = velocityX(x, 1);
+        velocityX(x, height + 1) = velocityX(x, height);
+        velocityY(x, 1) = 0.0f;
+        velocityY(x, height + 1) = 0.0f;
+        velocityY(x, 0) = -velocityY(x, 2);
+        velocityY(x, height + 2) = -velocityY(x, height);
+    }
+    for (int y = 0; y <= height + 2; y++) {
+        velocityY(0, y) = velocityY(1, y);
+        velocityY(width + 1, y) = velocityY(width, y);
+    }
+}
+
+// Solves the same pressure equation as FluidSolver's PCG path, with air cells held at zero pressure. On
+// face velocities the five point stencil is exactly the divergence of the pressure gradient.
+void FlipSolver::project(float dt) {
+    TRACE_ZONE("project");
+    const float correction = settings.densityCorrection / (restParticlesPerCell * dt);
+    parallelForTiles(pool, divergence.width, divergence.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* u = velocityX.row(y);
+            const float* vDown = velocityY.row(y);
+            const float* vUp = velocityY.row(y + 1);
+            const int* start = bins.cellStart.data() + (y - 1) * bins.cellsX - 1;
+            float* div = divergence.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                const int excess = std::max(0, start[x + 1] - start[x] - restParticlesPerCell);
+                div[x] = -(u[x + 1] - u[x] + vUp[x] - vDown[x]) + correction * excess;
+            }
+        }
+    });
+    pressureStats = pcgSolver.solve(pressure, divergence, cells, cellsRevision, settings.pcg);
+
+    // Only faces with fluid on one side are projected; the splat weights are done with, so they now mark
+    // those faces for the extrapolation. Faces on a solid cell stay at zero.
+    weightX.fill(0.0f);
+    weightY.fill(0.0f);
+    auto projected = [](unsigned char a, unsigned char b) {
+        return ((a | b) & solidCell) == 0 && (a & b) != airCell;
+    };
+    parallelForTiles(pool, pressure.width, pressure.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* p = pressure.row(y);
+            const float* pDown = pressure.row(y - 1);
+            const unsigned char* mask = cells.row(y);
+            const unsigned char* maskDown = cells.row(y - 1);
+            float* u = velocityX.row(y);
+            float* v = velocityY.row(y);
+            float* wx = weightX.row(y);
+            float* wy = weightY.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                if (projected(mask[x - 1], mask[x])) {
+                    u[x] -= p[x] - p[x - 1];
+                    wx[x] = 1.0f;
+                }
+                if (projected(maskDown[x], mask[x])) {
+                    v[x] -= p[x] - pDown[x];
+                    wy[x] = 1.0f;
+                }
+            }
+        }
+    });
+    // Air faces still hold splatted velocities that never felt the pressure, mostly just gravity. Particles
+    // near the surface reading them would sink into the fluid below, so they get the projected velocities
+    // of the fluid instead.
+    extrapolate(pool, velocityX, weightX);
+    extrapolate(pool, velocityY, weightY);
+    enforceWalls();
+}
+
+void FlipSolver::transferToParticles() {
+    TRACE_ZONE("transferToParticles");
+    const float inverseCell = 1.0f / cell;
+    const FlipTransfer transfer = settings.transfer;
+    const float flipRatio = transfer == FlipTransfer::Flip ? std::clamp(settings.flipRatio, 0.0f, 1.0f) : 0.0f;
+    const int stride = velocityX.stride;
+    parallelForParticles(pool, particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const float fx = particles.positionX[i] * inverseCell;
+            const float fy = particles.positionY[i] * inverseCell;
+            const Stencil sx = faceStencil(fx, fy, faceXShiftX, faceXShiftY, stride);
+            const Stencil sy = faceStencil(fx, fy, faceYShiftX, faceYShiftY, stride);
+            float picU = 0.0f;
+            float picV = 0.0f;
+            float deltaU = 0.0f;
+            float deltaV = 0.0f;
+            float cxx = 0.0f;
+            float cxy = 0.0f;
+            float cyx = 0.0f;
+            float cyy = 0.0f;
+            for (int b = 0; b < 3; b++) {
+                for (int a = 0; a < 3; a++) {
+                    const int node = a + b * stride;
+                    const float wx = sx.x.w[a] * sx.y.w[b];
+                    const float u = velocityX.values[sx.index + node];
+                    picU += wx * u;
+                    deltaU += wx * (u - previousVelocityX.values[sx.index + node]);
+                    cxx += wx * u * (a - sx.x.offset);
+                    cxy += wx * u * (b - sx.y.offset);
+                    const float wy = sy.x.w[a] * sy.y.w[b];
+                    const float v = velocityY.values[sy.index + node];
+                    picV += wy * v;
+                    deltaV += wy * (v - previousVelocityY.values[sy.index + node]);
+                    cyx += wy * v * (a - sy.x.offset);
+                    cyy += wy * v * (b - sy.y.offset);
+                }
+            }
+            // Velocities are stored in m/s and the grid works in cells/s.
+            const float u = particles.velocityX[i] * inverseCell;
+            const float v = particles.velocityY[i] * inverseCell;
+            particles.velocityX[i] = (flipRatio * (u + deltaU) + (1.0f - flipRatio) * picU) * cell;
+            particles.velocityY[i] = (flipRatio * (v + deltaV) + (1.0f - flipRatio) * picV) * cell;
+            if (transfer == FlipTransfer::Apic) {
+                // 4 / dx^2 inverts the quadratic B-spline inertia tensor, with dx one cell.
+                affineXX[i] = 4.0f * cxx;
+                affineXY[i] = 4.0f * cxy;
+                affineYX[i] = 4.0f * cyx;
+                affineYY[i] = 4.0f * cyy;
+            }
+        }
+    });
+}
+
+void FlipSolver::advectParticles(float dt) {
+    TRACE_ZONE("advectParticles");
+    // Keep particles inside the walls, short of the last cell edge so their splat stays on the grid.
+    const float maxX = pressure.width * cell * (1.0f - 1e-5f);
+    const float maxY = pressure.height * cell * (1.0f - 1e-5f);
+    parallelForParticles(pool, particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            float x = particles.positionX[i] + particles.velocityX[i] * dt;
+            float y = particles.positionY[i] + particles.velocityY[i] * dt;
+            if (x < 0.0f || x > maxX) {
+                x = std::clamp(x, 0.0f, maxX);
+                particles.velocityX[i] = 0.0f;
+            }
+            if (y < 0.0f || y > maxY) {
+                y = std::clamp(y, 0.0f, maxY);
+                particles.velocityY[i] = 0.0f;
+            }
+            particles.positionX[i] = x;
+            particles.positionY[i] = y;
+        }
+    });
+}
+
+float FlipSolver::maxSpeed() {
+    float maxSpeedSquared = parallelReduceParticles(pool, particles.size(), 0.0f, [&](int begin, int end) {
+        float result = 0.0f;
+        for (int i = begin; i < end; i++) {
+            float vx = particles.velocityX[i];
+            float vy = particles.velocityY[i];
+            result = std::max(result, vx * vx + vy * vy);
+        }
+        return result;
+    }, maxOf);
+    return std::sqrt(maxSpeedSquared);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <pmmintrin.h>
+#include <xmmintrin.h>
+#define FLUIDS_HAS_MXCSR 1
+#endif
+
+/*
+ * Flushes denormal floats to zero on the calling thread for the lifetime of the object. Pressure and
+ * velocity fields decay towards zero far from sources, and denormal arithmetic there is several times
+ * slower than normal floats, so every solver entry point and worker thread runs inside one of these.
+ */
+class ScopedFlushDenormals {
+public:
+    ScopedFlushDenormals() {
+#ifdef FLUIDS_HAS_MXCSR
+        previousMode = _mm_getcsr();
+        _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+        _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+#endif
+    }
+
+    ~ScopedFlushDenormals() {
+#ifdef FLUIDS_HAS_MXCSR
+        _mm_setcsr(previousMode);
+#endif
+    }
+
+    ScopedFlushDenormals(const ScopedFlushDenormals&) = delete;
+    ScopedFlushDenormals& operator=(const ScopedFlushDenormals&) = delete;
+
+private:
+#ifdef FLUIDS_HAS_MXCSR
+    unsigned int previousMode = 0;
+#endif
+};
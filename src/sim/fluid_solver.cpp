@@ -0,0 +1,365 @@
+#include "fluid_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "float_mode.h"
+#include "trace.h"
+
+namespace {
+
+// Returns the seconds since start and moves start to now, for timing consecutive phases. The phase
+// is also recorded as a trace zone when tracing is on.
+double lap(std::int64_t& start, const char* zoneName) {
+    std::int64_t now = traceNanoseconds();
+    if (tracingEnabled()) {
+        recordTraceZone(zoneName, start, now);
+    }
+    double seconds = (now - start) * 1e-9;
+    start = now;
+    return seconds;
+}
+
+float maxOf(float a, float b) {
+    return std::max(a, b);
+}
+
+}
+
+SubstepStats planSubsteps(float dt, float maxSpeed, float cflNumber, int maxSubsteps) {
+    SubstepStats plan;
+    plan.maxSpeed = maxSpeed;
+    const float substepLimit = cflNumber > 0.0f && maxSpeed > 0.0f ? cflNumber / maxSpeed : dt;
+    plan.substeps = std::clamp(static_cast<int>(std::ceil(dt / substepLimit)), 1, std::max(1, maxSubsteps));
+    plan.substepSeconds = std::min(dt / plan.substeps, substepLimit);
+    plan.simulatedSeconds = plan.substepSeconds * plan.substeps;
+    return plan;
+}
+
+void advect(ThreadPool& pool, Grid2D& out, const Grid2D& in, const Grid2D& velocityX, const Grid2D& velocityY, float dt, float decay, BoundaryType boundary, SimdLevel simd) {
+    TRACE_ZONE("advect");
+    AdvectKernelArgs args;
+    args.out = out.data();
+    args.in = in.data();
+    args.velocityX = velocityX.data();
+    args.velocityY = velocityY.data();
+    args.stride = in.stride;
+    args.dt = dt;
+    args.decay = decay;
+    args.maxX = in.width + 0.5f;
+    args.maxY = in.height + 0.5f;
+
+    const AdvectTileKernel kernel = selectAdvectKernel(simd);
+    parallelForTiles(pool, in.width, in.height, [&](const Tile& tile) {
+        kernel(args, tile);
+    });
+    setBoundary(out, boundary);
+}
+
+void advectCorrected(ThreadPool& pool, Grid2D& out, Grid2D& scratch, const Grid2D& in, const Grid2D& velocityX, const Grid2D& velocityY,
+                     float dt, float decay, BoundaryType boundary, AdvectionScheme scheme, SimdLevel simd) {
+    if (scheme == AdvectionScheme::SemiLagrangian) {
+        advect(pool, out, in, velocityX, velocityY, dt, decay, boundary, simd);
+        return;
+    }
+    TRACE_ZONE("advectCorrected");
+    // Decay is applied once, by the limiter.
+    advect(pool, out, in, velocityX, velocityY, dt, 1.0f, boundary, simd);
+    advect(pool, scratch, out, velocityX, velocityY, -dt, 1.0f, boundary, simd);
+
+    AdvectKernelArgs args;
+    args.out = out.data();
+    args.in = in.data();
+    args.velocityX = velocityX.data();
+    args.velocityY = velocityY.data();
+    args.stride = in.stride;
+    args.dt = dt;
+    args.decay = decay;
+    args.maxX = in.width + 0.5f;
+    args.maxY = in.height + 0.5f;
+    if (scheme == AdvectionScheme::MacCormack) {
+        args.error = scratch.data();
+        args.errorWeight = 0.5f;
+    } else {
+        parallelForTiles(pool, in.width, in.height, [&](const Tile& tile) {
+            for (int y = tile.yBegin; y < tile.yEnd; y++) {
+                const float* original = in.row(y);
+                float* corrected = scratch.row(y);
+                for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                    corrected[x] = original[x] + 0.5f * (original[x] - corrected[x]);
+                }
+            }
+        });
+        setBoundary(scratch, boundary);
+        advect(pool, out, scratch, velocityX, velocityY, dt, 1.0f, boundary, simd);
+    }
+
+    const AdvectTileKernel kernel = selectLimitKernel(simd);
+    parallelForTiles(pool, in.width, in.height, [&](const Tile& tile) {
+        kernel(args, tile);
+    });
+    setBoundary(out, boundary);
+}
+
+void computeDivergence(ThreadPool& pool, Grid2D& out, const Grid2D& velocityX, const Grid2D& velocityY) {
+    TRACE_ZONE("computeDivergence");
+    parallelForTiles(pool, out.width, out.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* u = velocityX.row(y);
+            const float* vDown = velocityY.row(y - 1);
+            const float* vUp = velocityY.row(y + 1);
+            float* div = out.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                div[x] = -0.5f * (u[x + 1] - u[x - 1] + vUp[x] - vDown[x]);
+            }
+        }
+    });
+    setBoundary(out, BoundaryType::Scalar);
+}
+
+FluidSolver::FluidSolver(const FluidSettings& settings, ThreadPool& pool)
+    : settings(settings), pool(pool), multigridSolver(pool), pcgSolver(pool) {
+    reset();
+    clearObstacles();
+}
+
+void FluidSolver::reset() {
+    for (Grid2D* grid : { &velocityX, &velocityY, &density, &pressure, &divergence, &previousDensity,
+                          &velocityXScratch, &velocityYScratch, &densityScratch, &advectionScratch, &pressureScratch }) {
+        grid->resize(settings.width, settings.height);
+    }
+}
+
+void FluidSolver::saveState(SnapshotWriter& snapshot) const {
+    snapshot.add("velocityX", velocityX);
+    snapshot.add("velocityY", velocityY);
+    snapshot.add("density", density);
+    // The previous pressure is the next solve's initial guess.
+    snapshot.add("pressure", pressure);
+}
+
+bool FluidSolver::loadState(const Snapshot& snapshot) {
+    return snapshot.read("velocityX", velocityX) && snapshot.read("velocityY", velocityY) && snapshot.read("density", density)
+        && snapshot.read("pressure", pressure);
+}
+
+void FluidSolver::addArchiveFields(ArchiveFrame& frame) const {
+    frame.addInterior("density", density);
+    frame.addInterior("velocityX", velocityX);
+    frame.addInterior("velocityY", velocityY);
+}
+
+void FluidSolver::step(float dt) {
+    TRACE_ZONE("step");
+    if (dt <= 0.0f) {
+        return;
+    }
+    ScopedFlushDenormals flushDenormals;
+    substepStats = planSubsteps(dt, maxSpeed(), settings.cflNumber, settings.maxSubsteps);
+    phaseTimes = {};
+    for (int i = 0; i < substepStats.substeps; i++) {
+        substep(substepStats.substepSeconds);
+    }
+}
+
+void FluidSolver::substep(float dt) {
+    std::int64_t start = traceNanoseconds();
+    advectFields(dt);
+    phaseTimes.advect += lap(start, "advectFields");
+    addForces(dt);
+    phaseTimes.forces += lap(start, "forces");
+    project();
+}
+
+float FluidSolver::maxSpeed() const {
+    TRACE_ZONE("maxSpeed");
+    float maxSpeedSquared = parallelReduceTiles(pool, settings.width, settings.height, 0.0f, [&](const Tile& tile) {
+        float result = 0.0f;
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* u = velocityX.row(y);
+            const float* v = velocityY.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                result = std::max(result, u[x] * u[x] + v[x] * v[x]);
+            }
+        }
+        return result;
+    }, maxOf);
+    return std::sqrt(maxSpeedSquared);
+}
+
+void FluidSolver::splat(float cx, float cy, float radius, float amount, float impulseX, float impulseY) {
+    int xBegin = std::max(1, static_cast<int>(cx - radius));
+    int xEnd = std::min(settings.width, static_cast<int>(cx + radius) + 1);
+    int yBegin = std::max(1, static_cast<int>(cy - radius));
+    int yEnd = std::min(settings.height, static_cast<int>(cy + radius) + 1);
+    float inverseRadiusSquared = 1.0f / (radius * radius);
+
+    for (int y = yBegin; y <= yEnd; y++) {
+        float* d = density.row(y);
+        float* u = velocityX.row(y);
+        float* v = velocityY.row(y);
+        float dy = y - cy;
+        for (int x = xBegin; x <= xEnd; x++) {
+            float dx = x - cx;
+            float falloff = 1.0f - (dx * dx + dy * dy) * inverseRadiusSquared;
+            if (falloff <= 0.0f) {
+                continue;
+            }
+            d[x] += amount * falloff;
+            u[x] += impulseX * falloff;
+            v[x] += impulseY * falloff;
+        }
+    }
+}
+
+void FluidSolver::addObstacle(float cx, float cy, float radius) {
+    int xBegin = std::max(1, static_cast<int>(cx - radius));
+    int xEnd = std::min(settings.width, static_cast<int>(cx + radius) + 1);
+    int yBegin = std::max(1, static_cast<int>(cy - radius));
+    int yEnd = std::min(settings.height, static_cast<int>(cy + radius) + 1);
+    for (int y = yBegin; y <= yEnd; y++) {
+        unsigned char* mask = solid.row(y);
+        float dy = y - cy;
+        for (int x = xBegin; x <= xEnd; x++) {
+            float dx = x - cx;
+            if (dx * dx + dy * dy <= radius * radius) {
+                mask[x] = 1;
+            }
+        }
+    }
+    hasObstacles = true;
+    solidRevision++;
+}
+
+void FluidSolver::clearObstacles() {
+    solid.resize(settings.width, settings.height);
+    for (int x = 0; x < solid.stride; x++) {
+        solid(x, 0) = 1;
+        solid(x, settings.height + 1) = 1;
+    }
+    for (int y = 1; y <= settings.height; y++) {
+        solid(0, y) = 1;
+        solid(settings.width + 1, y) = 1;
+    }
+    hasObstacles = false;
+    solidRevision++;
+}
+
+void FluidSolver::applyObstacles() {
+    TRACE_ZONE("applyObstacles");
+    if (!hasObstacles) {
+        return;
+    }
+    for (int y = 1; y <= settings.height; y++) {
+        const unsigned char* mask = solid.row(y);
+        float* u = velocityX.row(y);
+        float* v = velocityY.row(y);
+        float* d = density.row(y);
+        for (int x = 1; x <= settings.width; x++) {
+            if (mask[x]) {
+                u[x] = 0.0f;
+                v[x] = 0.0f;
+                d[x] = 0.0f;
+            }
+        }
+    }
+}
+
+void FluidSolver::savePreviousState() {
+    previousDensity.values = density.values;
+}
+
+void FluidSolver::advectFields(float dt) {
+    float velocityDecay = std::exp(-settings.velocityDissipation * dt);
+    float densityDecay = std::exp(-settings.densityDissipation * dt);
+    advectCorrected(pool, velocityXScratch, advectionScratch, velocityX, velocityX, velocityY, dt, velocityDecay, BoundaryType::VelocityX,
+                    settings.advection, settings.simd);
+    advectCorrected(pool, velocityYScratch, advectionScratch, velocityY, velocityX, velocityY, dt, velocityDecay, BoundaryType::VelocityY,
+                    settings.advection, settings.simd);
+    advectCorrected(pool, densityScratch, advectionScratch, density, velocityX, velocityY, dt, densityDecay, BoundaryType::Scalar,
+                    settings.advection, settings.simd);
+    std::swap(velocityX, velocityXScratch);
+    std::swap(velocityY, velocityYScratch);
+    std::swap(density, densityScratch);
+}
+
+void FluidSolver::addForces(float dt) {
+    for (const FluidSource& source : sources) {
+        splat(source.x, source.y, source.radius, source.densityRate * dt, source.forceX * dt, source.forceY * dt);
+    }
+    applyObstacles();
+    setBoundary(velocityX, BoundaryType::VelocityX);
+    setBoundary(velocityY, BoundaryType::VelocityY);
+    setBoundary(density, BoundaryType::Scalar);
+}
+
+void FluidSolver::project() {
+    const int stride = velocityX.stride;
+    std::int64_t start = traceNanoseconds();
+
+    computeDivergence(pool, divergence, velocityX, velocityY);
+    phaseTimes.divergence += lap(start, "divergence");
+
+    solvePressure();
+    phaseTimes.pressure += lap(start, "pressure");
+
+    parallelForTiles(pool, settings.width, settings.height, [&](const Tile& tile) {
+        if (!hasObstacles) {
+            for (int y = tile.yBegin; y < tile.yEnd; y++) {
+                const float* p = pressure.row(y);
+                float* u = velocityX.row(y);
+                float* v = velocityY.row(y);
+                for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                    u[x] -= 0.5f * (p[x + 1] - p[x - 1]);
+                    v[x] -= 0.5f * (p[x + stride] - p[x - stride]);
+                }
+            }
+            return;
+        }
+        // Solid neighbors take the cell's own pressure, giving a zero pressure gradient into obstacles.
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* p = pressure.row(y);
+            const unsigned char* mask = solid.row(y);
+            float* u = velocityX.row(y);
+            float* v = velocityY.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                float left = mask[x - 1] ? p[x] : p[x - 1];
+                float right = mask[x + 1] ? p[x] : p[x + 1];
+                float down = mask[x - stride] ? p[x] : p[x - stride];
+                float up = mask[x + stride] ? p[x] : p[x + stride];
+                u[x] -= 0.5f * (right - left);
+                v[x] -= 0.5f * (up - down);
+            }
+        }
+    });
+    applyObstacles();
+    setBoundary(velocityX, BoundaryType::VelocityX);
+    setBoundary(velocityY, BoundaryType::VelocityY);
+    phaseTimes.gradient += lap(start, "gradient");
+}
+
+void FluidSolver::solvePressure() {
+    switch (settings.pressureSolver) {
+    case PressureSolverType::Jacobi: {
+        // Jacobi sweeps warm started from the previous step's pressure. Residuals cost one extra pass each.
+        float rhsNorm = maxAbs(pool, divergence);
+        float scale = rhsNorm > 0.0f ? 1.0f / rhsNorm : 0.0f;
+        pressureStats = {};
+        pressureStats.initialResidual = computeResidual(pool, pressure, divergence, nullptr) * scale;
+        for (int iteration = 0; iteration < settings.jacobiIterations; iteration++) {
+            jacobiSweep(pool, pressureScratch, pressure, divergence);
+            std::swap(pressure, pressureScratch);
+        }
+        pressureStats.iterations = settings.jacobiIterations;
+        pressureStats.residual = computeResidual(pool, pressure, divergence, nullptr) * scale;
+        break;
+    }
+    case PressureSolverType::Multigrid:
+        pressureStats = multigridSolver.solve(pressure, divergence, settings.multigrid);
+        break;
+    case PressureSolverType::ConjugateGradient:
+        pressureStats = pcgSolver.solve(pressure, divergence, solid, solidRevision, settings.pcg);
+        break;
+    }
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vector>
+
+#include "advect_kernels.h"
+#include "frame_archive.h"
+#include "grid.h"
+#include "multigrid.h"
+#include "pcg.h"
+#include "poisson.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+
+// Circular emitter that injects density and momentum into the grid every step. Positions are in cells.
+struct FluidSource {
+    float x = 0.0f;
+    float y = 0.0f;
+    float radius = 8.0f;
+    float densityRate = 1.0f;
+    float forceX = 0.0f;
+    float forceY = 0.0f;
+};
+
+enum class AdvectionScheme {
+    // First order: one bilinear backtrace, which smooths features a little every step.
+    SemiLagrangian,
+    // Corrects the forward pass by half the error a backward pass finds in it.
+    MacCormack,
+    // Back and forth error compensation: corrects the input by half that error and advects it again.
+    Bfecc
+};
+
+// Display names indexed by AdvectionScheme.
+inline constexpr const char* advectionSchemeNames[] = { "Semi-Lagrangian", "MacCormack", "BFECC" };
+
+struct FluidSettings {
+    int width = 512;
+    int height = 512;
+    // Fraction of density and velocity lost per second, applied during advection.
+    float densityDissipation = 0.1f;
+    float velocityDissipation = 0.0f;
+    // Cells the fastest flow may cross per substep. Advection stays stable at any step, but a backtrace
+    // that skips over several cells loses the detail between them. 0 takes every step whole.
+    float cflNumber = 4.0f;
+    // Substeps per step. When the CFL limit needs more, simulated time runs slower than requested.
+    int maxSubsteps = 8;
+    AdvectionScheme advection = AdvectionScheme::SemiLagrangian;
+    // Instruction set for advection, clamped to what the CPU supports. Scalar is the reference path.
+    SimdLevel simd = detectSimdLevel();
+
+    PressureSolverType pressureSolver = PressureSolverType::Multigrid;
+    int jacobiIterations = 40;
+    MultigridSettings multigrid;
+    PcgSettings pcg;
+};
+
+// How the latest step was split into substeps to hold the CFL number.
+struct SubstepStats {
+    int substeps = 0;
+    float substepSeconds = 0.0f;
+    // Short of the step's dt when the substeps were capped.
+    float simulatedSeconds = 0.0f;
+    // Fastest flow at the start of the step, in cells per second.
+    float maxSpeed = 0.0f;
+};
+
+// Splits dt into the fewest equal substeps, at most maxSubsteps, that each move a flow of maxSpeed cells per
+// second by at most cflNumber cells. Capped substeps stay at the CFL limit and cover less than dt.
+SubstepStats planSubsteps(float dt, float maxSpeed, float cflNumber, int maxSubsteps);
+
+// Wall time in seconds spent in each phase of the latest step, summed over its substeps.
+struct SolverPhaseTimes {
+    double advect = 0.0;
+    double forces = 0.0;
+    double divergence = 0.0;
+    double pressure = 0.0;
+    double gradient = 0.0;
+};
+
+/*
+ * Eulerian stable-fluids solver on a collocated grid. Each field is a separate flat buffer (structure of
+ * arrays) with a ghost-cell border, so every kernel walks rows with unit stride and no boundary branches.
+ * Kernels run over tiles of the grid on the given thread pool. Velocities are measured in cells per second.
+ * A step is split into as many substeps as keep the fastest flow within settings.cflNumber cells each, so
+ * calm flows take one pass per step and fast ones are not left to the accuracy of a single long backtrace.
+ */
+class FluidSolver {
+public:
+    FluidSolver(const FluidSettings& settings, ThreadPool& pool);
+
+    void step(float dt);
+    void reset();
+    // Adds what a restart needs to snapshot. loadState restores it into a solver reset with the same
+    // settings, and returns false, with snapshot.error set, if the snapshot's fields do not match.
+    void saveState(SnapshotWriter& snapshot) const;
+    bool loadState(const Snapshot& snapshot);
+    // Adds the fields archived for offline analysis to frame.
+    void addArchiveFields(ArchiveFrame& frame) const;
+
+    // Adds a radial impulse of density and velocity centered on (x, y), e.g. from mouse input.
+    void splat(float x, float y, float radius, float amount, float impulseX, float impulseY);
+
+    // Snapshots the displayed state so frames between two fixed steps can be interpolated.
+    void savePreviousState();
+
+    // Marks a disk of cells as static solid. Only the PCG pressure solver accounts for obstacles in the
+    // pressure equation; Jacobi and multigrid treat them as fluid and only zero the velocity inside.
+    void addObstacle(float x, float y, float radius);
+    void clearObstacles();
+
+    int width() const { return settings.width; }
+    int height() const { return settings.height; }
+
+    FluidSettings settings;
+    std::vector<FluidSource> sources;
+
+    Grid2D velocityX;
+    Grid2D velocityY;
+    Grid2D density;
+    Grid2D pressure;
+    Grid2D divergence;
+    Grid2D previousDensity;
+
+    // 1 for obstacle cells and for the ghost ring (the domain walls), 0 for fluid.
+    Mask2D solid;
+    bool hasObstacles = false;
+    // Incremented whenever the mask changes, so cached preconditioners know to rebuild.
+    int solidRevision = 0;
+
+    PressureSolveStats pressureStats;
+    SolverPhaseTimes phaseTimes;
+    SubstepStats substepStats;
+
+    ThreadPool& pool;
+
+private:
+    void substep(float dt);
+    // Fastest cell velocity in cells per second.
+    float maxSpeed() const;
+    void advectFields(float dt);
+    void addForces(float dt);
+    void project();
+    void solvePressure();
+    void applyObstacles();
+
+    Grid2D velocityXScratch;
+    Grid2D velocityYScratch;
+    Grid2D densityScratch;
+    // Backward pass of the second-order schemes, shared by every advected field.
+    Grid2D advectionScratch;
+    Grid2D pressureScratch;
+    MultigridSolver multigridSolver;
+    PcgSolver pcgSolver;
+};
+
+// Semi-Lagrangian advection of a scalar field with a bilinear backtrace, scaling the result by decay.
+// Every SIMD level produces the same result as the scalar kernel bit for bit.
+void advect(ThreadPool& pool, Grid2D& out, const Grid2D& in, const Grid2D& velocityX, const Grid2D& velocityY, float dt, float decay, BoundaryType boundary, SimdLevel simd);
+
+// Second-order advection: a backward semi-Lagrangian pass over the forward result measures the error of the
+// first pass, which MacCormack takes half of from the forward result and BFECC from in before advecting again.
+// The corrected value is clamped to the four values of in the forward backtrace samples, so the correction
+// never creates new extrema. scratch holds the backward pass. Like advect, bit for bit equal at every SIMD
+// level; with AdvectionScheme::SemiLagrangian it is advect and leaves scratch untouched.
+void advectCorrected(ThreadPool& pool, Grid2D& out, Grid2D& scratch, const Grid2D& in, const Grid2D& velocityX, const Grid2D& velocityY,
+                     float dt, float decay, BoundaryType boundary, AdvectionScheme scheme, SimdLevel simd);
+
+// Negated central-difference divergence of the velocity field, the right-hand side of the pressure equation.
+void computeDivergence(ThreadPool& pool, Grid2D& out, const Grid2D& velocityX, const Grid2D& velocityY);
@@ -0,0 +1,821 @@
+#include "fluid_solver_3d.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "float_mode.h"
+#include "trace.h"
+
+namespace {
+
+constexpr int brickSize = BrickGrid::brickSize;
+constexpr int brickMask = BrickGrid::brickMask;
+
+// Returns the seconds since start and moves start to now, for timing consecutive phases. The phase
+// is also recorded as a trace zone when tracing is on.
+double lap(std::int64_t& start, const char* zoneName) {
+    std::int64_t now = traceNanoseconds();
+    if (tracingEnabled()) {
+        recordTraceZone(zoneName, start, now);
+    }
+    double seconds = (now - start) * 1e-9;
+    start = now;
+    return seconds;
+}
+
+// The eight samples of grid around (x, y, z) in its own index space, clamped to the domain, and the weights
+// between them; c[i] is at offset (i & 1, (i >> 1) & 1, i >> 2). Inactive bricks read as zero.
+struct TrilinearCorners {
+    float c[8];
+    float fx;
+    float fy;
+    float fz;
+};
+
+TrilinearCorners trilinearCorners(const BrickGrid& grid, float x, float y, float z) {
+    x = std::clamp(x, 0.0f, grid.width - 1.0f);
+    y = std::clamp(y, 0.0f, grid.height - 1.0f);
+    z = std::clamp(z, 0.0f, grid.depth - 1.0f);
+    const int ix = std::min(static_cast<int>(x), grid.width - 2);
+    const int iy = std::min(static_cast<int>(y), grid.height - 2);
+    const int iz = std::min(static_cast<int>(z), grid.depth - 2);
+    TrilinearCorners result;
+    result.fx = x - ix;
+    result.fy = y - iy;
+    result.fz = z - iz;
+
+    if ((ix & brickMask) != brickMask && (iy & brickMask) != brickMask && (iz & brickMask) != brickMask) {
+        // All eight samples in one brick, at fixed offsets from the first: the common case.
+        const int slot = grid.brickSlot(ix >> BrickGrid::brickShift, iy >> BrickGrid::brickShift, iz >> BrickGrid::brickShift);
+        if (slot < 0) {
+            std::fill_n(result.c, 8, 0.0f);
+            return result;
+        }
+        const float* p = grid.brick(slot) + brickOffset(ix & brickMask, iy & brickMask, iz & brickMask);
+        result.c[0] = p[0];
+        result.c[1] = p[brickOffset(1, 0, 0)];
+        result.c[2] = p[brickOffset(0, 1, 0)];
+        result.c[3] = p[brickOffset(1, 1, 0)];
+        result.c[4] = p[brickOffset(0, 0, 1)];
+        result.c[5] = p[brickOffset(1, 0, 1)];
+        result.c[6] = p[brickOffset(0, 1, 1)];
+        result.c[7] = p[brickOffset(1, 1, 1)];
+    } else {
+        result.c[0] = grid.read(ix, iy, iz);
+        result.c[1] = grid.read(ix + 1, iy, iz);
+        result.c[2] = grid.read(ix, iy + 1, iz);
+        result.c[3] = grid.read(ix + 1, iy + 1, iz);
+        result.c[4] = grid.read(ix, iy, iz + 1);
+        result.c[5] = grid.read(ix + 1, iy, iz + 1);
+        result.c[6] = grid.read(ix, iy + 1, iz + 1);
+        result.c[7] = grid.read(ix + 1, iy + 1, iz + 1);
+    }
+    return result;
+}
+
+float sampleTrilinear(const BrickGrid& grid, float x, float y, float z) {
+    const TrilinearCorners s = trilinearCorners(grid, x, y, z);
+    const float c00 = s.c[0] + s.fx * (s.c[1] - s.c[0]);
+    const float c10 = s.c[2] + s.fx * (s.c[3] - s.c[2]);
+    const float c01 = s.c[4] + s.fx * (s.c[5] - s.c[4]);
+    const float c11 = s.c[6] + s.fx * (s.c[7] - s.c[6]);
+    const float c0 = c00 + s.fy * (c10 - c00);
+    const float c1 = c01 + s.fy * (c11 - c01);
+    return c0 + s.fz * (c1 - c0);
+}
+
+// Calls body(slot, offset, px, py, pz) for every sample of out with the point (px, py, pz) its backtrace
+// lands on, for a field whose samples sit at cell centers (axis < 0) or on the low faces along axis. The
+// backtrace velocity is the cell-centered one, averaged onto the faces for face fields.
+template <typename Body>
+void forEachBacktrace3D(ThreadPool& pool, const BrickGrid& out, const BrickGrid* cellVelocity, int axis, float dt, Body&& body) {
+    int neighbor = 0;
+    if (axis >= 0) {
+        neighbor = axis == 0 ? 1 : axis == 1 ? apronSize : apronSize * apronSize;
+    }
+    parallelForBricks(pool, out, [&](int slot) {
+        float apron[3][apronCells];
+        for (int c = 0; c < 3; c++) {
+            loadApron(cellVelocity[c], slot, apron[c], ApronBorder::Replicate);
+        }
+        const BrickCoord& coord = out.brickCoords[slot];
+        for (int z = 0; z < brickSize; z++) {
+            for (int y = 0; y < brickSize; y++) {
+                for (int x = 0; x < brickSize; x++) {
+                    const int center = apronOffset(x + 1, y + 1, z + 1);
+                    float velocity[3];
+                    for (int c = 0; c < 3; c++) {
+                        velocity[c] = 0.5f * (apron[c][center] + apron[c][center - neighbor]);
+                    }
+                    const float px = coord.x * brickSize + x - dt * velocity[0];
+                    const float py = coord.y * brickSize + y - dt * velocity[1];
+                    const float pz = coord.z * brickSize + z - dt * velocity[2];
+                    body(slot, brickOffset(x, y, z), px, py, pz);
+                }
+            }
+        }
+    });
+}
+
+// Semi-Lagrangian advection, scaling the result by decay. Each sample costs one trilinear read of the
+// advected field.
+void advect3D(ThreadPool& pool, BrickGrid& out, const BrickGrid& in, const BrickGrid* cellVelocity, int axis, float dt, float decay) {
+    TRACE_ZONE("advect3D");
+    forEachBacktrace3D(pool, out, cellVelocity, axis, dt, [&](int slot, int offset, float px, float py, float pz) {
+        out.brick(slot)[offset] = decay * sampleTrilinear(in, px, py, pz);
+    });
+}
+
+// Second-order advection as in the 2D advectCorrected: out is clamped to the eight values of in that the
+// forward backtrace interpolates. scratch holds the backward pass.
+void advectCorrected3D(ThreadPool& pool, BrickGrid& out, BrickGrid& scratch, const BrickGrid& in, const BrickGrid* cellVelocity, int axis,
+                       float dt, float decay, AdvectionScheme scheme) {
+    if (scheme == AdvectionScheme::SemiLagrangian) {
+        advect3D(pool, out, in, cellVelocity, axis, dt, decay);
+        return;
+    }
+    TRACE_ZONE("advectCorrected3D");
+    advect3D(pool, out, in, cellVelocity, axis, dt, 1.0f);
+    advect3D(pool, scratch, out, cellVelocity, axis, -dt, 1.0f);
+    const float errorWeight = scheme == AdvectionScheme::MacCormack ? 0.5f : 0.0f;
+    if (scheme == AdvectionScheme::Bfecc) {
+        parallelForBricks(pool, scratch, [&](int slot) {
+            const float* original = in.brick(slot);
+            float* corrected = scratch.brick(slot);
+            for (int i = 0; i < BrickGrid::brickCells; i++) {
+                corrected[i] = original[i] + 0.5f * (original[i] - corrected[i]);
+            }
+        });
+        advect3D(pool, out, scratch, cellVelocity, axis, dt, 1.0f);
+    }
+    forEachBacktrace3D(pool, out, cellVelocity, axis, dt, [&](int slot, int offset, float px, float py, float pz) {
+        const TrilinearCorners s = trilinearCorners(in, px, py, pz);
+        const float low = *std::min_element(s.c, s.c + 8);
+        const float high = *std::max_element(s.c, s.c + 8);
+        float& value = out.brick(slot)[offset];
+        const float corrected = value + errorWeight * (in.brick(slot)[offset] - scratch.brick(slot)[offset]);
+        value = decay * std::clamp(corrected, low, high);
+    });
+}
+
+// Partial sums are kept per x lane of a brick row, so the loops over a row vectorize without reordering any
+// float sum, and folded in a fixed order.
+double sumLanes(const float* lanes) {
+    double result = 0.0;
+    for (int x = 0; x < brickSize; x++) {
+        result += lanes[x];
+    }
+    return result;
+}
+
+float maxLanes(const float* lanes) {
+    float result = 0.0f;
+    for (int x = 0; x < brickSize; x++) {
+        result = std::max(result, lanes[x]);
+    }
+    return result;
+}
+
+// Writes A in into out, where A is the 7-point Laplacian with walls dropping out of the stencil, and returns
+// the dot product of in and out for the conjugate gradient step length.
+double applyMatrix(ThreadPool& pool, BrickGrid& out, const BrickGrid& in) {
+    TRACE_ZONE("applyMatrix3D");
+    return parallelReduceBricks(pool, in, 0.0, [&](int slot) {
+        // Replicated walls make the neighbor term cancel its share of the diagonal, which is exactly the
+        // wall dropping out.
+        float apron[apronCells];
+        loadApron(in, slot, apron, ApronBorder::Replicate);
+        float* target = out.brick(slot);
+        float lanes[brickSize] = {};
+        for (int z = 0; z < brickSize; z++) {
+            for (int y = 0; y < brickSize; y++) {
+                const float* center = apron + apronOffset(1, y + 1, z + 1);
+                // Built locally and stored whole: stores straight into the output row could alias the apron
+                // as far as the compiler knows, which keeps the row from vectorizing.
+                float result[brickSize];
+                for (int x = 0; x < brickSize; x++) {
+                    result[x] = 6.0f * center[x] - center[x - 1] - center[x + 1] - center[x - apronSize] - center[x + apronSize]
+                        - center[x - apronSize * apronSize] - center[x + apronSize * apronSize];
+                    lanes[x] += center[x] * result[x];
+                }
+                std::memcpy(target + brickOffset(0, y, z), result, sizeof(result));
+            }
+        }
+        return sumLanes(lanes);
+    }, [](double left, double right) { return left + right; });
+}
+
+}
+
+FluidSolver3D::FluidSolver3D(const FluidSettings3D& settings, ThreadPool& pool) : settings(settings), pool(pool) {
+    reset();
+}
+
+std::array<BrickGrid*, 19> FluidSolver3D::grids() {
+    return { &velocityX, &velocityY, &velocityZ, &density, &pressure, &divergence, &velocityXScratch, &velocityYScratch, &velocityZScratch,
+             &densityScratch, &advectionScratch, &cellVelocity[0], &cellVelocity[1], &cellVelocity[2], &residual, &auxiliary, &search, &product,
+             &inverseDiagonal };
+}
+
+void FluidSolver3D::reset() {
+    sparse = settings.sparse;
+    for (BrickGrid* grid : grids()) {
+        if (sparse) {
+            grid->resizeSparse(std::max(8, settings.width), std::max(8, settings.height), std::max(8, settings.depth));
+        } else {
+            grid->resize(std::max(8, settings.width), std::max(8, settings.height), std::max(8, settings.depth));
+        }
+    }
+    fixedPressure.assign(activeBricks(), 0);
+    brickMarks.assign(sparse ? density.totalBricks() : 0, 0);
+    fillInverseDiagonal(0);
+
+    const float w = static_cast<float>(width());
+    const float h = static_cast<float>(height());
+    const float d = static_cast<float>(depth());
+    // A sparse domain keeps the emitter of the default box, so the smoke rather than the domain sets the work.
+    const float radius = (sparse ? std::min(w, 64.0f) : w) * 0.08f;
+    sources.clear();
+    sources.push_back({ w * 0.5f, h * 0.1f, d * 0.5f, radius, 4.0f, 40.0f });
+    pressureStats = {};
+}
+
+void FluidSolver3D::saveState(SnapshotWriter& snapshot) const {
+    // Bricks in slot order, as stored; a sparse grid also records the brick of each slot.
+    if (sparse) {
+        snapshot.add("brickCoords", SnapshotType::Int32, density.brickCoords.data(), density.brickCoords.size() * sizeof(BrickCoord), 3,
+                     activeBricks());
+    }
+    const std::pair<const char*, const BrickGrid*> fields[] = {
+        { "velocityX", &velocityX }, { "velocityY", &velocityY }, { "velocityZ", &velocityZ }, { "density", &density }, { "pressure", &pressure }
+    };
+    for (const auto& [name, grid] : fields) {
+        snapshot.add(name, SnapshotType::Float32, grid->data(), grid->size() * sizeof(float), width(), height(), depth());
+    }
+}
+
+bool FluidSolver3D::loadState(const Snapshot& snapshot) {
+    const SnapshotField* shape = snapshot.find("density");
+    if (shape == nullptr || shape->width != static_cast<std::uint32_t>(width()) || shape->height != static_cast<std::uint32_t>(height())
+        || shape->depth != static_cast<std::uint32_t>(depth())) {
+        snapshot.error = "volume size differs from " + std::to_string(width()) + "x" + std::to_string(height()) + "x" + std::to_string(depth());
+        return false;
+    }
+    const SnapshotField* coords = snapshot.find("brickCoords");
+    if ((coords != nullptr) != sparse) {
+        snapshot.error = sparse ? "snapshot of a dense volume" : "snapshot of a sparse volume";
+        return false;
+    }
+    if (sparse) {
+        std::vector<BrickCoord> active(coords->height);
+        if (!snapshot.read("brickCoords", SnapshotType::Int32, active.data(), active.size() * 3)) {
+            return false;
+        }
+        for (const BrickCoord& brick : active) {
+            if (brick.x < 0 || brick.y < 0 || brick.z < 0 || brick.x >= density.bricksX || brick.y >= density.bricksY
+                || brick.z >= density.bricksZ) {
+                snapshot.error = "brick outside the volume";
+                return false;
+            }
+        }
+        // The grids of a reset sparse solver are empty, so the bricks land in the slots they were saved from.
+        // Which bricks hold fixed pressure is worked out again at the start of the next step.
+        for (BrickGrid* grid : grids()) {
+            grid->setActiveBricks(active);
+        }
+        fixedPressure.assign(activeBricks(), 0);
+        fillInverseDiagonal(0);
+    }
+    const std::pair<const char*, BrickGrid*> fields[] = {
+        { "velocityX", &velocityX }, { "velocityY", &velocityY }, { "velocityZ", &velocityZ }, { "density", &density }, { "pressure", &pressure }
+    };
+    for (const auto& [name, grid] : fields) {
+        if (!snapshot.read(name, SnapshotType::Float32, grid->data(), grid->size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FluidSolver3D::addArchiveFields(ArchiveFrame& frame) const {
+    // Density bricks in slot order, with the brick each slot holds, so a sparse volume costs what it stores.
+    frame.add("brickCoords", SnapshotType::Int32, density.brickCoords.data(), density.brickCoords.size() * sizeof(BrickCoord), 3,
+              activeBricks());
+    frame.add("density", SnapshotType::Float32, density.data(), density.size() * sizeof(float), width(), height(), depth());
+}
+
+void FluidSolver3D::fillInverseDiagonal(int firstSlot) {
+    // 1 / the matrix diagonal, which counts the neighbors inside the box, fixed-pressure ones included.
+    for (int slot = firstSlot; slot < activeBricks(); slot++) {
+        const BrickCoord& coord = inverseDiagonal.brickCoords[slot];
+        float* target = inverseDiagonal.brick(slot);
+        for (int z = 0; z < brickSize; z++) {
+            const int globalZ = coord.z * brickSize + z;
+            for (int y = 0; y < brickSize; y++) {
+                const int globalY = coord.y * brickSize + y;
+                for (int x = 0; x < brickSize; x++) {
+                    const int globalX = coord.x * brickSize + x;
+                    const int walls = (globalX == 0) + (globalX == width() - 1) + (globalY == 0) + (globalY == height() - 1)
+                        + (globalZ == 0) + (globalZ == depth() - 1);
+                    target[brickOffset(x, y, z)] = 1.0f / (6 - walls);
+                }
+            }
+        }
+    }
+}
+
+void FluidSolver3D::updateActiveBricks() {
+    TRACE_ZONE("updateActiveBricks");
+    std::vector<unsigned char> occupied(activeBricks(), 0);
+    parallelForBricks(pool, density, [&](int slot) {
+        const float* d = density.brick(slot);
+        float lanes[brickSize] = {};
+        for (int row = 0; row < BrickGrid::brickCells; row += brickSize) {
+            for (int x = 0; x < brickSize; x++) {
+                lanes[x] = std::max(lanes[x], d[row + x]);
+            }
+        }
+        occupied[slot] = maxLanes(lanes) > settings.activeDensity;
+    });
+    std::vector<BrickCoord> seeds;
+    for (int slot = 0; slot < activeBricks(); slot++) {
+        if (occupied[slot]) {
+            seeds.push_back(density.brickCoords[slot]);
+        }
+    }
+    // The bricks addForces splats each emitter into.
+    for (const FluidSource3D& source : sources) {
+        const int xBegin = std::max(0, static_cast<int>(source.x - source.radius)) >> BrickGrid::brickShift;
+        const int xEnd = std::min(width() - 1, static_cast<int>(source.x + source.radius) + 1) >> BrickGrid::brickShift;
+        const int yBegin = std::max(0, static_cast<int>(source.y - source.radius)) >> BrickGrid::brickShift;
+        const int yEnd = std::min(height() - 1, static_cast<int>(source.y + source.radius) + 1) >> BrickGrid::brickShift;
+        const int zBegin = std::max(0, static_cast<int>(source.z - source.radius)) >> BrickGrid::brickShift;
+        const int zEnd = std::min(depth() - 1, static_cast<int>(source.z + source.radius) + 1) >> BrickGrid::brickShift;
+        for (int z = zBegin; z <= zEnd; z++) {
+            for (int y = yBegin; y <= yEnd; y++) {
+                for (int x = xBegin; x <= xEnd; x++) {
+                    seeds.push_back({ x, y, z });
+                }
+            }
+        }
+    }
+
+    // Mark the bricks within two of a seed: 2 for the solved padding, 1 for the fixed outer layer.
+    const int bricksX = density.bricksX;
+    const int bricksY = density.bricksY;
+    const int bricksZ = density.bricksZ;
+    auto mark = [&](const BrickCoord& brick) -> unsigned char& { return brickMarks[brick.x + (brick.y + brick.z * bricksY) * bricksX]; };
+    std::vector<BrickCoord> active;
+    for (const BrickCoord& seed : seeds) {
+        for (int dz = -2; dz <= 2; dz++) {
+            for (int dy = -2; dy <= 2; dy++) {
+                for (int dx = -2; dx <= 2; dx++) {
+                    const BrickCoord brick { seed.x + dx, seed.y + dy, seed.z + dz };
+                    if (brick.x < 0 || brick.y < 0 || brick.z < 0 || brick.x >= bricksX || brick.y >= bricksY || brick.z >= bricksZ) {
+                        continue;
+                    }
+                    unsigned char& level = mark(brick);
+                    if (level == 0) {
+                        active.push_back(brick);
+                    }
+                    const unsigned char distance = static_cast<unsigned char>(std::max({ std::abs(dx), std::abs(dy), std::abs(dz) }));
+                    level = std::max(level, static_cast<unsigned char>(distance <= 1 ? 2 : 1));
+                }
+            }
+        }
+    }
+
+    int firstAdded = 0;
+    for (BrickGrid* grid : grids()) {
+        firstAdded = grid->setActiveBricks(active);
+    }
+    fixedPressure.resize(activeBricks());
+    for (int slot = 0; slot < activeBricks(); slot++) {
+        fixedPressure[slot] = mark(density.brickCoords[slot]) == 1;
+    }
+    for (const BrickCoord& brick : active) {
+        mark(brick) = 0;
+    }
+    fillInverseDiagonal(firstAdded);
+}
+
+void FluidSolver3D::step(float dt) {
+    TRACE_ZONE("step3D");
+    if (dt <= 0.0f) {
+        return;
+    }
+    ScopedFlushDenormals flushDenormals;
+    substepStats = planSubsteps(dt, maxSpeed(), settings.cflNumber, settings.maxSubsteps);
+    phaseTimes = {};
+    for (int i = 0; i < substepStats.substeps; i++) {
+        substep(substepStats.substepSeconds);
+    }
+}
+
+void FluidSolver3D::substep(float dt) {
+    std::int64_t start = traceNanoseconds();
+    if (sparse) {
+        updateActiveBricks();
+    }
+    advectFields(dt);
+    phaseTimes.advect += lap(start, "advectFields3D");
+    addForces(dt);
+    phaseTimes.forces += lap(start, "forces3D");
+    project();
+}
+
+float FluidSolver3D::maxSpeed() const {
+    TRACE_ZONE("maxSpeed3D");
+    using AxisMaxima = std::array<float, 3>;
+    const AxisMaxima maxima = parallelReduceBricks(pool, density, AxisMaxima {}, [&](int slot) {
+        const float* u = velocityX.brick(slot);
+        const float* v = velocityY.brick(slot);
+        const float* w = velocityZ.brick(slot);
+        AxisMaxima result {};
+        for (int i = 0; i < BrickGrid::brickCells; i++) {
+            result[0] = std::max(result[0], std::abs(u[i]));
+            result[1] = std::max(result[1], std::abs(v[i]));
+            result[2] = std::max(result[2], std::abs(w[i]));
+        }
+        return result;
+    }, [](const AxisMaxima& left, const AxisMaxima& right) {
+        return AxisMaxima { std::max(left[0], right[0]), std::max(left[1], right[1]), std::max(left[2], right[2]) };
+    });
+    return std::sqrt(maxima[0] * maxima[0] + maxima[1] * maxima[1] + maxima[2] * maxima[2]);
+}
+
+void FluidSolver3D::advectFields(float dt) {
+    // Cell-centered velocity from the two faces of each cell; the faces past the high walls are zero.
+    const BrickGrid* faces[3] = { &velocityX, &velocityY, &velocityZ };
+    const int next[3] = { 1, apronSize, apronSize * apronSize };
+    parallelForBricks(pool, density, [&](int slot) {
+        float apron[apronCells];
+        for (int c = 0; c < 3; c++) {
+            loadApron(*faces[c], slot, apron, ApronBorder::Zero);
+            float* target = cellVelocity[c].brick(slot);
+            for (int z = 0; z < brickSize; z++) {
+                for (int y = 0; y < brickSize; y++) {
+                    const float* row = apron + apronOffset(1, y + 1, z + 1);
+                    float* out = target + brickOffset(0, y, z);
+                    for (int x = 0; x < brickSize; x++) {
+                        out[x] = 0.5f * (row[x] + row[x + next[c]]);
+                    }
+                }
+            }
+        }
+    });
+
+    const float velocityDecay = std::exp(-settings.velocityDissipation * dt);
+    const float densityDecay = std::exp(-settings.densityDissipation * dt);
+    advectCorrected3D(pool, velocityXScratch, advectionScratch, velocityX, cellVelocity.data(), 0, dt, velocityDecay, settings.advection);
+    advectCorrected3D(pool, velocityYScratch, advectionScratch, velocityY, cellVelocity.data(), 1, dt, velocityDecay, settings.advection);
+    advectCorrected3D(pool, velocityZScratch, advectionScratch, velocityZ, cellVelocity.data(), 2, dt, velocityDecay, settings.advection);
+    advectCorrected3D(pool, densityScratch, advectionScratch, density, cellVelocity.data(), -1, dt, densityDecay, settings.advection);
+    std::swap(velocityX, velocityXScratch);
+    std::swap(velocityY, velocityYScratch);
+    std::swap(velocityZ, velocityZScratch);
+    std::swap(density, densityScratch);
+    clearWalls();
+}
+
+void FluidSolver3D::addForces(float dt) {
+    for (const FluidSource3D& source : sources) {
+        const float inverseRadiusSquared = 1.0f / (source.radius * source.radius);
+        const int xBegin = std::max(0, static_cast<int>(source.x - source.radius));
+        const int xEnd = std::min(width() - 1, static_cast<int>(source.x + source.radius) + 1);
+        const int yBegin = std::max(0, static_cast<int>(source.y - source.radius));
+        const int yEnd = std::min(height() - 1, static_cast<int>(source.y + source.radius) + 1);
+        const int zBegin = std::max(0, static_cast<int>(source.z - source.radius));
+        const int zEnd = std::min(depth() - 1, static_cast<int>(source.z + source.radius) + 1);
+        for (int z = zBegin; z <= zEnd; z++) {
+            for (int y = yBegin; y <= yEnd; y++) {
+                for (int x = xBegin; x <= xEnd; x++) {
+                    const float dx = x + 0.5f - source.x;
+                    const float dy = y + 0.5f - source.y;
+                    const float dz = z + 0.5f - source.z;
+                    const float falloff = 1.0f - (dx * dx + dy * dy + dz * dz) * inverseRadiusSquared;
+                    if (falloff <= 0.0f) {
+                        continue;
+                    }
+                    density(x, y, z) += source.densityRate * dt * falloff;
+                    velocityY(x, y, z) += source.forceY * dt * falloff;
+                }
+            }
+        }
+    }
+
+    // Buoyancy on each y face from the density of the two cells it separates.
+    const float lift = 0.5f * settings.buoyancy * dt;
+    parallelForBricks(pool, velocityY, [&](int slot) {
+        const BrickCoord& coord = velocityY.brickCoords[slot];
+        float* v = velocityY.brick(slot);
+        const float* d = density.brick(slot);
+        for (int z = 0; z < brickSize; z++) {
+            for (int y = 0; y < brickSize; y++) {
+                const int globalY = coord.y * brickSize + y;
+                if (globalY == 0) {
+                    continue;
+                }
+                for (int x = 0; x < brickSize; x++) {
+                    const int offset = brickOffset(x, y, z);
+                    const float below = y > 0 ? d[offset - brickOffset(0, 1, 0)] : density.read(coord.x * brickSize + x, globalY - 1, coord.z * brickSize + z);
+                    v[offset] += lift * (d[offset] + below);
+                }
+            }
+        }
+    });
+    clearWalls();
+}
+
+void FluidSolver3D::clearWalls() {
+    parallelForBricks(pool, density, [&](int slot) {
+        const BrickCoord& coord = density.brickCoords[slot];
+        for (int b = 0; b < brickSize; b++) {
+            for (int a = 0; a < brickSize; a++) {
+                if (coord.x == 0) {
+                    velocityX.brick(slot)[brickOffset(0, a, b)] = 0.0f;
+                }
+                if (coord.y == 0) {
+                    velocityY.brick(slot)[brickOffset(a, 0, b)] = 0.0f;
+                }
+                if (coord.z == 0) {
+                    velocityZ.brick(slot)[brickOffset(a, b, 0)] = 0.0f;
+                }
+            }
+        }
+    });
+}
+
+void FluidSolver3D::project() {
+    std::int64_t start = traceNanoseconds();
+
+    // Negated divergence, the right-hand side of the pressure equation. The faces past the high walls are
+    // zero. Fixed-pressure bricks take no part in the solve, and hold zero pressure from the start.
+    double total = parallelReduceBricks(pool, divergence, 0.0, [&](int slot) {
+        if (fixedPressure[slot]) {
+            std::fill_n(divergence.brick(slot), BrickGrid::brickCells, 0.0f);
+            std::fill_n(pressure.brick(slot), BrickGrid::brickCells, 0.0f);
+            return 0.0;
+        }
+        const BrickCoord& coord = divergence.brickCoords[slot];
+        const float* u = velocityX.brick(slot);
+        const float* v = velocityY.brick(slot);
+        const float* w = velocityZ.brick(slot);
+        float* div = divergence.brick(slot);
+        double sum = 0.0;
+        for (int z = 0; z < brickSize; z++) {
+            const int globalZ = coord.z * brickSize + z;
+            for (int y = 0; y < brickSize; y++) {
+                const int globalY = coord.y * brickSize + y;
+                for (int x = 0; x < brickSize; x++) {
+                    const int globalX = coord.x * brickSize + x;
+                    const int offset = brickOffset(x, y, z);
+                    const float uHigh = x < brickMask ? u[offset + brickOffset(1, 0, 0)]
+                        : globalX + 1 < width()       ? velocityX.read(globalX + 1, globalY, globalZ)
+                                                      : 0.0f;
+                    const float vHigh = y < brickMask ? v[offset + brickOffset(0, 1, 0)]
+                        : globalY + 1 < height()      ? velocityY.read(globalX, globalY + 1, globalZ)
+                                                      : 0.0f;
+                    const float wHigh = z < brickMask ? w[offset + brickOffset(0, 0, 1)]
+                        : globalZ + 1 < depth()       ? velocityZ.read(globalX, globalY, globalZ + 1)
+                                                      : 0.0f;
+                    div[offset] = -(uHigh - u[offset] + vHigh - v[offset] + wHigh - w[offset]);
+                    sum += div[offset];
+                }
+            }
+        }
+        return sum;
+    }, [](double left, double right) { return left + right; });
+
+    // With every brick solved the walls are closed, so the system only has a solution when the right-hand
+    // side sums to zero; remove the round-off that would stop the solver from converging. Fixed pressure
+    // anywhere makes the system nonsingular.
+    if (std::find(fixedPressure.begin(), fixedPressure.end(), 1) == fixedPressure.end()) {
+        const float mean = static_cast<float>(total / divergence.size());
+        parallelForBricks(pool, divergence, [&](int slot) {
+            float* div = divergence.brick(slot);
+            for (int i = 0; i < BrickGrid::brickCells; i++) {
+                div[i] -= mean;
+            }
+        });
+    }
+    phaseTimes.divergence += lap(start, "divergence3D");
+
+    solvePressure();
+    phaseTimes.pressure += lap(start, "pressure3D");
+
+    // Subtract the pressure gradient from every interior face; the low wall faces stay zero.
+    parallelForBricks(pool, pressure, [&](int slot) {
+        const BrickCoord& coord = pressure.brickCoords[slot];
+        const float* p = pressure.brick(slot);
+        float* u = velocityX.brick(slot);
+        float* v = velocityY.brick(slot);
+        float* w = velocityZ.brick(slot);
+        for (int z = 0; z < brickSize; z++) {
+            const int globalZ = coord.z * brickSize + z;
+            for (int y = 0; y < brickSize; y++) {
+                const int globalY = coord.y * brickSize + y;
+                for (int x = 0; x < brickSize; x++) {
+                    const int globalX = coord.x * brickSize + x;
+                    const int offset = brickOffset(x, y, z);
+                    if (globalX > 0) {
+                        u[offset] -= p[offset] - (x > 0 ? p[offset - brickOffset(1, 0, 0)] : pressure.read(globalX - 1, globalY, globalZ));
+                    }
+                    if (globalY > 0) {
+                        v[offset] -= p[offset] - (y > 0 ? p[offset - brickOffset(0, 1, 0)] : pressure.read(globalX, globalY - 1, globalZ));
+                    }
+                    if (globalZ > 0) {
+                        w[offset] -= p[offset] - (z > 0 ? p[offset - brickOffset(0, 0, 1)] : pressure.read(globalX, globalY, globalZ - 1));
+                    }
+                }
+            }
+        }
+    });
+    phaseTimes.gradient += lap(start, "gradient3D");
+}
+
+// Conjugate gradient with the inverse diagonal as preconditioner, warm started from the previous pressure.
+// Each iteration is three passes over the bricks: the matrix product with the step length's dot product,
+// the updates of pressure and residual with the next dot product and max norm, and the new search direction.
+void FluidSolver3D::solvePressure() {
+    TRACE_ZONE("solvePressure3D");
+    struct Partial {
+        double dot = 0.0;
+        float maxResidual = 0.0f;
+    };
+    auto combine = [](const Partial& left, const Partial& right) {
+        return Partial { left.dot + right.dot, std::max(left.maxResidual, right.maxResidual) };
+    };
+
+    pressureStats = {};
+    const float rhsNorm = parallelReduceBricks(pool, divergence, 0.0f, [&](int slot) {
+        const float* b = divergence.brick(slot);
+        float result = 0.0f;
+        for (int i = 0; i < BrickGrid::brickCells; i++) {
+            result = std::max(result, std::abs(b[i]));
+        }
+        return result;
+    }, [](float left, float right) { return std::max(left, right); });
+    if (rhsNorm <= 0.0f) {
+        pressure.fill(0.0f);
+        return;
+    }
+
+    // r = b - A p, z = M^-1 r, s = z. The vectors stay zero on fixed-pressure bricks, so later passes skip them.
+    applyMatrix(pool, product, pressure);
+    Partial state = parallelReduceBricks(pool, residual, Partial {}, [&](int slot) {
+        if (fixedPressure[slot]) {
+            for (BrickGrid* grid : { &residual, &auxiliary, &search }) {
+                std::fill_n(grid->brick(slot), BrickGrid::brickCells, 0.0f);
+            }
+            return Partial {};
+        }
+        const float* b = divergence.brick(slot);
+        const float* q = product.brick(slot);
+        const float* inverse = inverseDiagonal.brick(slot);
+        float* r = residual.brick(slot);
+        float* zVector = auxiliary.brick(slot);
+        float* s = search.brick(slot);
+        float dotLanes[brickSize] = {};
+        float maxResidualLanes[brickSize] = {};
+        for (int row = 0; row < BrickGrid::brickCells; row += brickSize) {
+            for (int x = 0; x < brickSize; x++) {
+                const int i = row + x;
+                r[i] = b[i] - q[i];
+                zVector[i] = r[i] * inverse[i];
+                s[i] = zVector[i];
+                dotLanes[x] += r[i] * zVector[i];
+                maxResidualLanes[x] = std::max(maxResidualLanes[x], std::abs(r[i]));
+            }
+        }
+        return Partial { sumLanes(dotLanes), maxLanes(maxResidualLanes) };
+    }, combine);
+    pressureStats.initialResidual = state.maxResidual / rhsNorm;
+    pressureStats.residual = pressureStats.initialResidual;
+
+    while (pressureStats.iterations < settings.pcg.maxIterations && pressureStats.residual > settings.pcg.tolerance) {
+        const double curvature = applyMatrix(pool, product, search);
+        if (curvature <= 0.0) {
+            break;
+        }
+        const float alpha = static_cast<float>(state.dot / curvature);
+        const Partial next = parallelReduceBricks(pool, residual, Partial {}, [&](int slot) {
+            if (fixedPressure[slot]) {
+                return Partial {};
+            }
+            const float* q = product.brick(slot);
+            const float* s = search.brick(slot);
+            const float* inverse = inverseDiagonal.brick(slot);
+            float* p = pressure.brick(slot);
+            float* r = residual.brick(slot);
+            float* zVector = auxiliary.brick(slot);
+            float dotLanes[brickSize] = {};
+            float maxResidualLanes[brickSize] = {};
+            for (int row = 0; row < BrickGrid::brickCells; row += brickSize) {
+                for (int x = 0; x < brickSize; x++) {
+                    const int i = row + x;
+                    p[i] += alpha * s[i];
+                    const float nextResidual = r[i] - alpha * q[i];
+                    const float preconditioned = nextResidual * inverse[i];
+                    r[i] = nextResidual;
+                    zVector[i] = preconditioned;
+                    dotLanes[x] += nextResidual * preconditioned;
+                    maxResidualLanes[x] = std::max(maxResidualLanes[x], std::abs(nextResidual));
+                }
+            }
+            return Partial { sumLanes(dotLanes), maxLanes(maxResidualLanes) };
+        }, combine);
+        pressureStats.iterations++;
+        pressureStats.residual = next.maxResidual / rhsNorm;
+        pressureStats.history.push_back(pressureStats.residual);
+
+        const float beta = static_cast<float>(next.dot / state.dot);
+        state = next;
+        parallelForBricks(pool, search, [&](int slot) {
+            const float* zVector = auxiliary.brick(slot);
+            float* s = search.brick(slot);
+            for (int i = 0; i < BrickGrid::brickCells; i++) {
+                s[i] = zVector[i] + beta * s[i];
+            }
+        });
+    }
+}
+
+void extractVolumeView(ThreadPool& pool, const FluidSolver3D& solver, const VolumeDisplay& display, Grid2D& density, Grid2D& velocityX,
+                       Grid2D& velocityY, Grid2D& pressure) {
+    TRACE_ZONE("extractVolumeView");
+    const int size[3] = { solver.width(), solver.height(), solver.depth() };
+    // Plane axes (screen x, screen y) and the axis looked along.
+    const int along = static_cast<int>(display.axis);
+    const int across = display.axis == ViewAxis::X ? 2 : 0;
+    const int up = display.axis == ViewAxis::Y ? 2 : 1;
+    const int planeWidth = size[across];
+    const int planeHeight = size[up];
+    for (Grid2D* grid : { &density, &velocityX, &velocityY, &pressure }) {
+        if (grid->width != planeWidth || grid->height != planeHeight) {
+            grid->resize(planeWidth, planeHeight);
+        }
+        grid->fill(0.0f);
+    }
+
+    int layerBegin = std::clamp(static_cast<int>(display.position * size[along]), 0, size[along] - 1);
+    int layerEnd = layerBegin + 1;
+    if (display.view == VolumeView::Projection) {
+        layerBegin = 0;
+        layerEnd = size[along];
+    }
+    const float scale = 1.0f / (layerEnd - layerBegin);
+
+    // Walk the active bricks that meet the layers, grouped by the row of bricks they land in on the plane,
+    // so each task owns its output rows and a sparse volume costs what its active bricks cost.
+    const BrickGrid* faces[3] = { &solver.velocityX, &solver.velocityY, &solver.velocityZ };
+    const int faceStep[3] = { brickOffset(1, 0, 0), brickOffset(0, 1, 0), brickOffset(0, 0, 1) };
+    std::vector<std::vector<int>> brickRows(planeHeight / brickSize);
+    for (int slot = 0; slot < solver.activeBricks(); slot++) {
+        const BrickCoord& coord = solver.density.brickCoords[slot];
+        const int brick[3] = { coord.x, coord.y, coord.z };
+        if (brick[along] * brickSize < layerEnd && (brick[along] + 1) * brickSize > layerBegin) {
+            brickRows[brick[up]].push_back(slot);
+        }
+    }
+    pool.parallelFor(static_cast<int>(brickRows.size()), [&](int row) {
+        for (int slot : brickRows[row]) {
+            const BrickCoord& coord = solver.density.brickCoords[slot];
+            const int base[3] = { coord.x * brickSize, coord.y * brickSize, coord.z * brickSize };
+            for (int z = 0; z < brickSize; z++) {
+                for (int y = 0; y < brickSize; y++) {
+                    for (int x = 0; x < brickSize; x++) {
+                        const int local[3] = { x, y, z };
+                        int cell[3] = { base[0] + x, base[1] + y, base[2] + z };
+                        if (cell[along] < layerBegin || cell[along] >= layerEnd) {
+                            continue;
+                        }
+                        const int offset = brickOffset(x, y, z);
+                        // Face velocity averaged to the cell center; the face past a high wall is zero.
+                        float velocity[3];
+                        for (int c = 0; c < 3; c++) {
+                            float high = 0.0f;
+                            if (local[c] < brickMask) {
+                                high = faces[c]->brick(slot)[offset + faceStep[c]];
+                            } else if (cell[c] + 1 < size[c]) {
+                                cell[c]++;
+                                high = faces[c]->read(cell[0], cell[1], cell[2]);
+                                cell[c]--;
+                            }
+                            velocity[c] = 0.5f * (faces[c]->brick(slot)[offset] + high);
+                        }
+                        const int a = cell[across] + 1;
+                        const int b = cell[up] + 1;
+                        density(a, b) += solver.density.brick(slot)[offset] * scale;
+                        velocityX(a, b) += velocity[across] * scale;
+                        velocityY(a, b) += velocity[up] * scale;
+                        pressure(a, b) += solver.pressure.brick(slot)[offset] * scale;
+                    }
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "brick_grid.h"
+#include "fluid_solver.h"
+#include "frame_archive.h"
+#include "pcg.h"
+#include "poisson.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+
+// Spherical emitter that injects density and upward momentum every step. Positions are in cells.
+struct FluidSource3D {
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+    float radius = 4.0f;
+    float densityRate = 1.0f;
+    float forceY = 0.0f;
+};
+
+struct FluidSettings3D {
+    // Grid size in cells, rounded up to whole bricks. Takes effect on the next reset.
+    int width = 64;
+    int height = 96;
+    int depth = 64;
+    // Fraction of density and velocity lost per second, applied during advection.
+    float densityDissipation = 0.1f;
+    float velocityDissipation = 0.0f;
+    // Upward acceleration per unit of density, in cells per second squared.
+    float buoyancy = 20.0f;
+    // Cells the fastest flow may cross per substep, 0 to take every step whole. Up to a brick, it also
+    // keeps a sparse grid's backtraces inside the padding around the smoke.
+    float cflNumber = 4.0f;
+    // Substeps per step. When the CFL limit needs more, simulated time runs slower than requested.
+    int maxSubsteps = 8;
+    AdvectionScheme advection = AdvectionScheme::SemiLagrangian;
+    // Conjugate gradient with a diagonal preconditioner; only the iteration cap and tolerance apply.
+    PcgSettings pcg { 100, 1e-3f };
+    // Store only the bricks near smoke, so the size above is a virtual domain and the cost of a step
+    // follows the smoke. Takes effect on the next reset.
+    bool sparse = false;
+    // Density above which a brick holds smoke, in sparse grids.
+    float activeDensity = 1e-3f;
+};
+
+/*
+ * Eulerian stable-fluids smoke solver on a 3D staggered (MAC) grid inside a closed box, with y up. Every
+ * field is a BrickGrid, and every kernel runs brick by brick on the pool, so a cell's stencil reads stay
+ * within a few cache lines of its brick and the bricks it borders. The pressure solve is a matrix-free
+ * conjugate gradient whose matrix product reads each brick through an apron. Velocities are in cells per
+ * second.
+ *
+ * A sparse solver re-activates bricks before each step: every brick with smoke or an emitter, padded by
+ * two bricks. Pressure is solved on the first brick of padding and held at zero on the second, the open
+ * air around the smoke, whose faces take the flow out of the solved region; bricks beyond read as still
+ * air. Padding of a whole brick keeps a substep's backtraces inside the active region as long as the CFL
+ * number stays below the brick size. Like the 2D solver, a step is split into substeps that hold the CFL
+ * number, and a sparse grid's active set is rebuilt before each.
+ */
+class FluidSolver3D {
+public:
+    FluidSolver3D(const FluidSettings3D& settings, ThreadPool& pool);
+
+    void step(float dt);
+    // Resizes and clears every field and puts the default emitter back near the floor.
+    void reset();
+    // Adds what a restart needs to snapshot. loadState restores it into a solver reset with the same
+    // settings, and returns false, with snapshot.error set, if the snapshot's fields do not match.
+    void saveState(SnapshotWriter& snapshot) const;
+    bool loadState(const Snapshot& snapshot);
+    // Adds the fields archived for offline analysis to frame.
+    void addArchiveFields(ArchiveFrame& frame) const;
+
+    int width() const { return density.width; }
+    int height() const { return density.height; }
+    int depth() const { return density.depth; }
+    int activeBricks() const { return density.brickCount(); }
+
+    FluidSettings3D settings;
+    std::vector<FluidSource3D> sources;
+
+    // Face velocities: velocityX(x, y, z) is the face between cells x - 1 and x, and likewise for y and z.
+    // Faces on the low walls are stored and kept at zero; faces on the high walls are zero and not stored.
+    BrickGrid velocityX;
+    BrickGrid velocityY;
+    BrickGrid velocityZ;
+    BrickGrid density;
+    BrickGrid pressure;
+    BrickGrid divergence;
+
+    PressureSolveStats pressureStats;
+    SolverPhaseTimes phaseTimes;
+    SubstepStats substepStats;
+
+    ThreadPool& pool;
+
+private:
+    void substep(float dt);
+    // Length of the largest face velocity on each axis, a bound on every cell's speed in cells per second.
+    float maxSpeed() const;
+    void advectFields(float dt);
+    void addForces(float dt);
+    void project();
+    void solvePressure();
+    void clearWalls();
+    // Every field and scratch grid, which all share one layout.
+    std::array<BrickGrid*, 19> grids();
+    void updateActiveBricks();
+    // Fills the preconditioner from slot firstSlot on.
+    void fillInverseDiagonal(int firstSlot);
+
+    BrickGrid velocityXScratch;
+    BrickGrid velocityYScratch;
+    BrickGrid velocityZScratch;
+    BrickGrid densityScratch;
+    // Backward pass of the second-order schemes, shared by every advected field.
+    BrickGrid advectionScratch;
+    // Velocity averaged to cell centers, the backtrace velocity of every advected field.
+    std::array<BrickGrid, 3> cellVelocity;
+    // Conjugate gradient vectors and the Jacobi preconditioner.
+    BrickGrid residual;
+    BrickGrid auxiliary;
+    BrickGrid search;
+    BrickGrid product;
+    BrickGrid inverseDiagonal;
+    // Per slot, 1 for the outer padding bricks, whose pressure is fixed at zero. All zero in dense grids.
+    std::vector<unsigned char> fixedPressure;
+    // Whether the last reset laid the grids out sparse; settings.sparse can change before the next one.
+    bool sparse = false;
+    // Per brick of the domain, scratch for building the active set of a sparse grid; zero between steps.
+    std::vector<unsigned char> brickMarks;
+};
+
+// How a volume is flattened for the 2D field renderer.
+enum class VolumeView {
+    // One plane of cells.
+    Slice,
+    // Average along the axis, which shows the whole plume like an x-ray.
+    Projection
+};
+
+// Display names indexed by VolumeView.
+inline constexpr const char* volumeViewNames[] = { "Slice", "Projection" };
+
+// Axis the view looks along: X shows the z-y plane, Y the x-z plane from above, Z the x-y plane.
+enum class ViewAxis {
+    X,
+    Y,
+    Z
+};
+
+// Display names indexed by ViewAxis.
+inline constexpr const char* viewAxisNames[] = { "X (side)", "Y (top)", "Z (front)" };
+
+struct VolumeDisplay {
+    VolumeView view = VolumeView::Slice;
+    ViewAxis axis = ViewAxis::Z;
+    // Slice position along the axis, 0 to 1.
+    float position = 0.5f;
+};
+
+// Writes the view of the solver's cell-centered density, in-plane velocity and pressure into 2D grids,
+// resizing them to the plane.
+void extractVolumeView(ThreadPool& pool, const FluidSolver3D& solver, const VolumeDisplay& display, Grid2D& density, Grid2D& velocityX,
+                       Grid2D& velocityY, Grid2D& pressure);
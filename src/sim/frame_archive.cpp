@@ -0,0 +1,518 @@
+#include "frame_archive.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+constexpr char archiveMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'A', 'R', 'C' };
+constexpr char indexMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'I', 'D', 'X' };
+constexpr std::uint32_t archiveVersion = 1;
+
+// LZ4 block format limits: matches are at least 4 bytes and at most 64 KB back, the last match starts 12
+// or more bytes before the end, and the last 5 bytes are always literals.
+constexpr std::size_t minMatch = 4;
+constexpr std::size_t maxOffset = 65535;
+constexpr std::size_t matchLimit = 12;
+constexpr std::size_t lastLiterals = 5;
+constexpr int hashBits = 14;
+// After 2^skipShift misses in a row the search starts stepping over more bytes, so data that does not
+// compress costs little.
+constexpr int skipShift = 6;
+
+// Marks thread as a CPU-bound background thread, so waking it never preempts the simulation: a submit
+// returns at once, and the workers run on cores the solver leaves free or between its time slices.
+void setBackgroundPriority(std::thread& thread) {
+#ifdef __linux__
+    sched_param parameters {};
+    pthread_setschedparam(thread.native_handle(), SCHED_BATCH, &parameters);
+#else
+    (void)thread;
+#endif
+}
+
+std::uint32_t read32(const unsigned char* bytes) {
+    std::uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+std::uint64_t read64(const unsigned char* bytes) {
+    std::uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+std::uint32_t hashSequence(std::uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - hashBits);
+}
+
+// Extends a match from end, comparing against reference, eight bytes at a time while it can.
+std::size_t extendMatch(const unsigned char* input, std::size_t end, std::size_t reference, std::size_t limit) {
+    while (end + 8 <= limit) {
+        const std::uint64_t difference = read64(input + end) ^ read64(input + reference);
+        if (difference != 0) {
+            return end + std::countr_zero(difference) / 8;
+        }
+        end += 8;
+        reference += 8;
+    }
+    while (end < limit && input[end] == input[reference]) {
+        end++;
+        reference++;
+    }
+    return end;
+}
+
+// Writes the bytes of a length past the 15 its token nibble holds.
+unsigned char* writeLength(unsigned char* out, std::size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<unsigned char>(length);
+    return out;
+}
+
+unsigned char* writeLiterals(unsigned char* out, unsigned char* token, const unsigned char* literals, std::size_t length) {
+    *token = static_cast<unsigned char>(std::min<std::size_t>(length, 15) << 4);
+    if (length >= 15) {
+        out = writeLength(out, length - 15);
+    }
+    std::memcpy(out, literals, length);
+    return out + length;
+}
+
+bool readLength(const unsigned char* input, std::size_t size, std::size_t& position, std::size_t& length) {
+    unsigned char byte;
+    do {
+        if (position >= size) {
+            return false;
+        }
+        byte = input[position++];
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+std::size_t elementSize(SnapshotType type) {
+    switch (type) {
+    case SnapshotType::Float32:
+    case SnapshotType::Int32:
+        return 4;
+    case SnapshotType::UInt8:
+        return 1;
+    case SnapshotType::UInt64:
+        return 8;
+    }
+    return 1;
+}
+
+}
+
+void compressLz4(const unsigned char* input, std::size_t size, std::vector<unsigned char>& output) {
+    // Room for the worst case, all literals.
+    output.resize(size + size / 255 + 16);
+    unsigned char* out = output.data();
+    std::size_t anchor = 0;
+    if (size > matchLimit) {
+        // Position + 1 of the latest occurrence of each hashed 4-byte sequence, 0 for none.
+        thread_local std::vector<std::size_t> table;
+        table.assign(std::size_t(1) << hashBits, 0);
+        const std::size_t searchEnd = size - matchLimit;
+        const std::size_t matchEnd = size - lastLiterals;
+        std::size_t position = 0;
+        std::size_t misses = 0;
+        while (position < searchEnd) {
+            const std::uint32_t sequence = read32(input + position);
+            std::size_t& entry = table[hashSequence(sequence)];
+            const std::size_t candidate = entry;
+            entry = position + 1;
+            if (candidate == 0 || position + 1 - candidate > maxOffset || read32(input + candidate - 1) != sequence) {
+                position += 1 + (misses++ >> skipShift);
+                continue;
+            }
+            misses = 0;
+            std::size_t start = position;
+            std::size_t match = candidate - 1;
+            while (start > anchor && match > 0 && input[start - 1] == input[match - 1]) {
+                start--;
+                match--;
+            }
+            const std::size_t end = extendMatch(input, position + minMatch, match + (position + minMatch - start), matchEnd);
+
+            unsigned char* token = out++;
+            out = writeLiterals(out, token, input + anchor, start - anchor);
+            const std::size_t offset = start - match;
+            *out++ = static_cast<unsigned char>(offset & 0xff);
+            *out++ = static_cast<unsigned char>(offset >> 8);
+            const std::size_t matchCode = end - start - minMatch;
+            *token |= static_cast<unsigned char>(std::min<std::size_t>(matchCode, 15));
+            if (matchCode >= 15) {
+                out = writeLength(out, matchCode - 15);
+            }
+            anchor = position = end;
+        }
+    }
+    unsigned char* token = out++;
+    out = writeLiterals(out, token, input + anchor, size - anchor);
+    output.resize(static_cast<std::size_t>(out - output.data()));
+}
+
+bool decompressLz4(const unsigned char* input, std::size_t size, unsigned char* output, std::size_t outputSize) {
+    std::size_t in = 0;
+    std::size_t out = 0;
+    while (in < size) {
+        const unsigned char token = input[in++];
+        std::size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(input, size, in, literalLength)) {
+            return false;
+        }
+        if (literalLength > size - in || literalLength > outputSize - out) {
+            return false;
+        }
+        std::memcpy(output + out, input + in, literalLength);
+        in += literalLength;
+        out += literalLength;
+        // The last sequence has literals only.
+        if (in == size) {
+            break;
+        }
+        if (size - in < 2) {
+            return false;
+        }
+        const std::size_t offset = input[in] | (static_cast<std::size_t>(input[in + 1]) << 8);
+        in += 2;
+        std::size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(input, size, in, matchLength)) {
+            return false;
+        }
+        matchLength += minMatch;
+        if (offset == 0 || offset > out || matchLength > outputSize - out) {
+            return false;
+        }
+        // A match closer than its length repeats bytes it is producing, so it is copied byte by byte.
+        const unsigned char* source = output + out - offset;
+        if (offset >= matchLength) {
+            std::memcpy(output + out, source, matchLength);
+        } else {
+            for (std::size_t i = 0; i < matchLength; i++) {
+                output[out + i] = source[i];
+            }
+        }
+        out += matchLength;
+    }
+    return out == outputSize;
+}
+
+void shuffleBytes(const unsigned char* input, std::size_t size, std::size_t elementSize, unsigned char* output) {
+    const std::size_t count = size / elementSize;
+    for (std::size_t i = 0; i < count; i++) {
+        for (std::size_t byte = 0; byte < elementSize; byte++) {
+            output[byte * count + i] = input[i * elementSize + byte];
+        }
+    }
+    std::memcpy(output + count * elementSize, input + count * elementSize, size - count * elementSize);
+}
+
+void unshuffleBytes(const unsigned char* input, std::size_t size, std::size_t elementSize, unsigned char* output) {
+    const std::size_t count = size / elementSize;
+    for (std::size_t i = 0; i < count; i++) {
+        for (std::size_t byte = 0; byte < elementSize; byte++) {
+            output[i * elementSize + byte] = input[byte * count + i];
+        }
+    }
+    std::memcpy(output + count * elementSize, input + count * elementSize, size - count * elementSize);
+}
+
+std::vector<unsigned char>& ArchiveFrame::addField(const char* name, SnapshotType type, std::size_t bytes, int width, int height, int depth) {
+    ArchiveFieldEntry field {};
+    std::strncpy(field.name, name, sizeof(field.name) - 1);
+    field.type = type;
+    field.width = static_cast<std::uint32_t>(width);
+    field.height = static_cast<std::uint32_t>(height);
+    field.depth = static_cast<std::uint32_t>(depth);
+    field.rawBytes = bytes;
+    if (raw.size() <= fields.size()) {
+        raw.emplace_back();
+    }
+    std::vector<unsigned char>& target = raw[fields.size()];
+    target.resize(bytes);
+    fields.push_back(field);
+    return target;
+}
+
+void ArchiveFrame::add(const char* name, SnapshotType type, const void* values, std::size_t bytes, int width, int height, int depth) {
+    std::memcpy(addField(name, type, bytes, width, height, depth).data(), values, bytes);
+}
+
+void ArchiveFrame::add(const char* name, const std::vector<float, AlignedAllocator<float>>& values) {
+    add(name, SnapshotType::Float32, values.data(), values.size() * sizeof(float), static_cast<int>(values.size()));
+}
+
+void ArchiveFrame::addInterior(const char* name, const Grid2D& grid) {
+    const std::size_t rowBytes = static_cast<std::size_t>(grid.width) * sizeof(float);
+    std::vector<unsigned char>& target = addField(name, SnapshotType::Float32, rowBytes * grid.height, grid.width, grid.height, 1);
+    for (int y = 1; y <= grid.height; y++) {
+        std::memcpy(target.data() + (y - 1) * rowBytes, grid.row(y) + 1, rowBytes);
+    }
+}
+
+FrameArchiveWriter::FrameArchiveWriter(int workerCount, int bufferedFrames) {
+    for (int i = 0; i < std::max(1, bufferedFrames); i++) {
+        frames.push_back(std::make_unique<ArchiveFrame>());
+        freeFrames.push_back(frames.back().get());
+    }
+    counters.bufferCount = static_cast<int>(frames.size());
+    if (workerCount <= 0) {
+        workerCount = static_cast<int>(std::thread::hardware_concurrency() / 4);
+    }
+    for (int i = 0; i < std::max(1, workerCount); i++) {
+        workers.emplace_back(&FrameArchiveWriter::run, this);
+        setBackgroundPriority(workers.back());
+    }
+}
+
+FrameArchiveWriter::~FrameArchiveWriter() {
+    close();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+bool FrameArchiveWriter::open(const std::string& path) {
+    close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        file.close();
+        return false;
+    }
+    ArchiveFileHeader header {};
+    std::memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+    header.version = archiveVersion;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fileOffset = sizeof(header);
+    index.clear();
+    std::unique_lock<std::mutex> lock(mutex);
+    counters = {};
+    counters.bufferCount = static_cast<int>(frames.size());
+    nextSequence = 0;
+    appendSequence = 0;
+    return static_cast<bool>(file);
+}
+
+bool FrameArchiveWriter::close() {
+    if (!file.is_open()) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return freeFrames.size() == frames.size(); });
+    ArchiveFooter footer {};
+    footer.indexOffset = fileOffset;
+    footer.frameCount = index.size();
+    std::memcpy(footer.magic, indexMagic, sizeof(indexMagic));
+    file.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(ArchiveIndexEntry)));
+    file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    counters.failed |= !file.flush();
+    file.close();
+    return !counters.failed;
+}
+
+ArchiveFrame* FrameArchiveWriter::beginFrame(std::uint64_t step, bool wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (freeFrames.empty()) {
+        if (!wait) {
+            counters.framesDropped++;
+            return nullptr;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        condition.wait(lock, [&] { return !freeFrames.empty(); });
+        counters.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    ArchiveFrame* frame = freeFrames.back();
+    freeFrames.pop_back();
+    frame->step = step;
+    frame->fields.clear();
+    return frame;
+}
+
+void FrameArchiveWriter::submit(ArchiveFrame* frame) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        frame->sequence = nextSequence++;
+        queue.push_back(frame);
+    }
+    condition.notify_all();
+}
+
+FrameArchiveStats FrameArchiveWriter::stats() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    FrameArchiveStats result = counters;
+    result.buffersInUse = static_cast<int>(frames.size() - freeFrames.size());
+    return result;
+}
+
+void FrameArchiveWriter::compress(ArchiveFrame& frame) {
+    if (frame.stored.size() < frame.fields.size()) {
+        frame.stored.resize(frame.fields.size());
+    }
+    for (std::size_t i = 0; i < frame.fields.size(); i++) {
+        ArchiveFieldEntry& field = frame.fields[i];
+        const std::vector<unsigned char>& raw = frame.raw[i];
+        const std::size_t size = elementSize(field.type);
+        const unsigned char* source = raw.data();
+        if (size > 1) {
+            frame.shuffled.resize(raw.size());
+            shuffleBytes(raw.data(), raw.size(), size, frame.shuffled.data());
+            source = frame.shuffled.data();
+        }
+        compressLz4(source, raw.size(), frame.stored[i]);
+        if (frame.stored[i].size() >= raw.size()) {
+            field.filter = ArchiveFilter::None;
+            field.storedBytes = raw.size();
+        } else {
+            field.filter = size > 1 ? ArchiveFilter::ShuffleLz4 : ArchiveFilter::Lz4;
+            field.storedBytes = frame.stored[i].size();
+        }
+    }
+}
+
+bool FrameArchiveWriter::append(const ArchiveFrame& frame) {
+    index.push_back({ frame.step, fileOffset });
+    ArchiveFrameHeader header {};
+    header.step = frame.step;
+    header.fieldCount = static_cast<std::uint32_t>(frame.fields.size());
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(frame.fields.data()), static_cast<std::streamsize>(frame.fields.size() * sizeof(ArchiveFieldEntry)));
+    fileOffset += sizeof(header) + frame.fields.size() * sizeof(ArchiveFieldEntry);
+    for (std::size_t i = 0; i < frame.fields.size(); i++) {
+        const std::vector<unsigned char>& bytes = frame.fields[i].filter == ArchiveFilter::None ? frame.raw[i] : frame.stored[i];
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(frame.fields[i].storedBytes));
+        fileOffset += frame.fields[i].storedBytes;
+    }
+    return static_cast<bool>(file);
+}
+
+void FrameArchiveWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [&] { return !queue.empty() || stopping; });
+        if (queue.empty()) {
+            return;
+        }
+        ArchiveFrame* frame = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        const auto start = std::chrono::steady_clock::now();
+        compress(*frame);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Frames compress in parallel but reach the file in the order they were submitted.
+        lock.lock();
+        counters.compressSeconds += seconds;
+        condition.wait(lock, [&] { return appendSequence == frame->sequence; });
+        lock.unlock();
+        const bool appended = append(*frame);
+        lock.lock();
+        counters.failed |= !appended;
+        counters.framesWritten++;
+        for (const ArchiveFieldEntry& field : frame->fields) {
+            counters.rawBytes += field.rawBytes;
+            counters.storedBytes += field.storedBytes;
+        }
+        appendSequence++;
+        freeFrames.push_back(frame);
+        condition.notify_all();
+    }
+}
+
+bool FrameArchiveReader::open(const std::string& path) {
+    index.clear();
+    file.close();
+    file.clear();
+    file.open(path, std::ios::binary);
+    ArchiveFileHeader header {};
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) != 0) {
+        error = path + " is not a frame archive";
+        return false;
+    }
+    if (header.version != archiveVersion) {
+        error = path + " is archive version " + std::to_string(header.version) + ", expected " + std::to_string(archiveVersion);
+        return false;
+    }
+    ArchiveFooter footer {};
+    file.seekg(-static_cast<std::streamoff>(sizeof(footer)), std::ios::end);
+    if (!file.read(reinterpret_cast<char*>(&footer), sizeof(footer)) || std::memcmp(footer.magic, indexMagic, sizeof(indexMagic)) != 0) {
+        error = path + " has no index; it was not closed";
+        return false;
+    }
+    index.resize(footer.frameCount);
+    file.seekg(static_cast<std::streamoff>(footer.indexOffset));
+    if (!file.read(reinterpret_cast<char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(ArchiveIndexEntry)))) {
+        error = path + " has a truncated index";
+        index.clear();
+        return false;
+    }
+    return true;
+}
+
+std::vector<ArchiveFieldEntry> FrameArchiveReader::fields(std::size_t frame) {
+    ArchiveFrameHeader header {};
+    file.seekg(static_cast<std::streamoff>(index[frame].offset));
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    std::vector<ArchiveFieldEntry> entries(file ? header.fieldCount : 0);
+    file.read(reinterpret_cast<char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(ArchiveFieldEntry)));
+    if (!file) {
+        file.clear();
+        entries.clear();
+    }
+    return entries;
+}
+
+bool FrameArchiveReader::read(std::size_t frame, const char* name, std::vector<unsigned char>& values) {
+    const std::vector<ArchiveFieldEntry> entries = fields(frame);
+    std::uint64_t offset = index[frame].offset + sizeof(ArchiveFrameHeader) + entries.size() * sizeof(ArchiveFieldEntry);
+    for (const ArchiveFieldEntry& field : entries) {
+        if (std::strncmp(field.name, name, sizeof(field.name)) != 0) {
+            offset += field.storedBytes;
+            continue;
+        }
+        std::vector<unsigned char> stored(field.storedBytes);
+        file.seekg(static_cast<std::streamoff>(offset));
+        if (!file.read(reinterpret_cast<char*>(stored.data()), static_cast<std::streamsize>(stored.size()))) {
+            file.clear();
+            error = std::string("field ") + name + " is truncated";
+            return false;
+        }
+        if (field.filter == ArchiveFilter::None) {
+            values = std::move(stored);
+            return true;
+        }
+        std::vector<unsigned char> decoded(field.rawBytes);
+        if (!decompressLz4(stored.data(), stored.size(), decoded.data(), decoded.size())) {
+            error = std::string("field ") + name + " is corrupt";
+            return false;
+        }
+        if (field.filter == ArchiveFilter::ShuffleLz4) {
+            values.resize(decoded.size());
+            unshuffleBytes(decoded.data(), decoded.size(), elementSize(field.type), values.data());
+        } else {
+            values = std::move(decoded);
+        }
+        return true;
+    }
+    error = std::string("no field ") + name;
+    return false;
+}
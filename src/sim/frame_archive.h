@@ -0,0 +1,190 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "grid.h"
+#include "snapshot.h"
+
+// Compresses input into output in the LZ4 block format. output is resized to the compressed length.
+void compressLz4(const unsigned char* input, std::size_t size, std::vector<unsigned char>& output);
+// Decompresses an LZ4 block that must expand to exactly outputSize bytes. Returns false if it is malformed.
+bool decompressLz4(const unsigned char* input, std::size_t size, unsigned char* output, std::size_t outputSize);
+// Splits elements of elementSize bytes into byte planes: all first bytes, then all second bytes, and so on.
+// Neighboring floats of a smooth field share their sign, exponent and high mantissa bytes, so the planes
+// hold long runs a byte-oriented compressor finds, where the interleaved values hold almost none. Trailing
+// bytes short of a whole element are copied as they are.
+void shuffleBytes(const unsigned char* input, std::size_t size, std::size_t elementSize, unsigned char* output);
+void unshuffleBytes(const unsigned char* input, std::size_t size, std::size_t elementSize, unsigned char* output);
+
+enum class ArchiveFilter : std::uint32_t {
+    // Stored as is, when compression would not shrink it.
+    None,
+    Lz4,
+    ShuffleLz4
+};
+
+/*
+ * Frame archive file layout, little-endian:
+ *   ArchiveFileHeader
+ *   per frame: ArchiveFrameHeader, fieldCount ArchiveFieldEntry, then each field's stored bytes in order
+ *   index: one ArchiveIndexEntry per frame, then ArchiveFooter
+ * The index is written on close. A file cut short by a crash has none, but its frames can still be found by
+ * walking the records from the start.
+ */
+struct ArchiveFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved[5];
+};
+static_assert(sizeof(ArchiveFileHeader) == 32, "the archive header is 32 bytes on disk");
+
+struct ArchiveFrameHeader {
+    std::uint64_t step;
+    std::uint32_t fieldCount;
+    std::uint32_t reserved;
+};
+static_assert(sizeof(ArchiveFrameHeader) == 16, "archive frame headers are 16 bytes on disk");
+
+struct ArchiveFieldEntry {
+    char name[32];
+    SnapshotType type;
+    ArchiveFilter filter;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t depth;
+    std::uint32_t reserved;
+    std::uint64_t rawBytes;
+    std::uint64_t storedBytes;
+};
+static_assert(sizeof(ArchiveFieldEntry) == 72, "archive field entries are 72 bytes on disk");
+
+struct ArchiveIndexEntry {
+    std::uint64_t step;
+    // Offset of the frame's ArchiveFrameHeader from the start of the file.
+    std::uint64_t offset;
+};
+
+struct ArchiveFooter {
+    std::uint64_t indexOffset;
+    std::uint64_t frameCount;
+    char magic[8];
+};
+static_assert(sizeof(ArchiveFooter) == 24, "the archive footer is 24 bytes on disk");
+
+// Fields of one archived step, held in buffers that are reused from frame to frame.
+class ArchiveFrame {
+public:
+    void add(const char* name, SnapshotType type, const void* values, std::size_t bytes, int width, int height = 1, int depth = 1);
+    void add(const char* name, const std::vector<float, AlignedAllocator<float>>& values);
+    // The interior cells only, without the ghost ring.
+    void addInterior(const char* name, const Grid2D& grid);
+
+private:
+    friend class FrameArchiveWriter;
+
+    // Appends an entry for a field of bytes bytes and returns the buffer to copy it into.
+    std::vector<unsigned char>& addField(const char* name, SnapshotType type, std::size_t bytes, int width, int height, int depth);
+
+    std::uint64_t step = 0;
+    std::uint64_t sequence = 0;
+    std::vector<ArchiveFieldEntry> fields;
+    // Raw copy and stored bytes of each field; entries past fields.size() are spare.
+    std::vector<std::vector<unsigned char>> raw;
+    std::vector<std::vector<unsigned char>> stored;
+    std::vector<unsigned char> shuffled;
+};
+
+struct FrameArchiveStats {
+    std::uint64_t framesWritten = 0;
+    // Frames skipped because every buffer was still being compressed or written.
+    std::uint64_t framesDropped = 0;
+    int buffersInUse = 0;
+    int bufferCount = 0;
+    // Time callers spent waiting in beginFrame for a free buffer.
+    double stallSeconds = 0.0;
+    std::uint64_t rawBytes = 0;
+    std::uint64_t storedBytes = 0;
+    // Worker time spent filtering and compressing.
+    double compressSeconds = 0.0;
+    bool failed = false;
+};
+
+/*
+ * Appends frames to an archive without stalling the simulation on compression or disk. The caller copies a
+ * step's fields into one of a fixed pool of frame buffers and submits it; worker threads compress frames
+ * in parallel and append them in submission order. When every buffer is in flight the archive cannot keep
+ * up, and beginFrame either waits for one (counted as stall time) or drops the frame, as the caller
+ * chooses, so the pool size bounds the memory held by frames in flight.
+ */
+class FrameArchiveWriter {
+public:
+    // workers 0 takes a quarter of the hardware threads, at least one, leaving the rest to the solver.
+    explicit FrameArchiveWriter(int workers = 0, int bufferedFrames = 4);
+    // Closes the archive.
+    ~FrameArchiveWriter();
+
+    FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+    FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+
+    // Starts a new archive at path, closing the current one. Returns false if the file cannot be created.
+    bool open(const std::string& path);
+    // Waits for the frames in flight, then writes the index. Returns false if any write failed.
+    bool close();
+    bool isOpen() const { return file.is_open(); }
+
+    // A cleared frame for step, or null if wait is false and no buffer is free.
+    ArchiveFrame* beginFrame(std::uint64_t step, bool wait);
+    void submit(ArchiveFrame* frame);
+
+    FrameArchiveStats stats() const;
+
+private:
+    void run();
+    void compress(ArchiveFrame& frame);
+    // Appends frame to the file. Only the worker whose frame is next in sequence calls it.
+    bool append(const ArchiveFrame& frame);
+
+    std::vector<std::unique_ptr<ArchiveFrame>> frames;
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<ArchiveFrame*> freeFrames;
+    std::deque<ArchiveFrame*> queue;
+    std::uint64_t nextSequence = 0;
+    std::uint64_t appendSequence = 0;
+    bool stopping = false;
+    FrameArchiveStats counters;
+
+    std::ofstream file;
+    std::uint64_t fileOffset = 0;
+    std::vector<ArchiveIndexEntry> index;
+    std::vector<std::thread> workers;
+};
+
+// Reads a closed archive through its index.
+class FrameArchiveReader {
+public:
+    // Returns false, with error set, if the file is missing or has no index.
+    bool open(const std::string& path);
+
+    std::size_t frameCount() const { return index.size(); }
+    std::uint64_t step(std::size_t frame) const { return index[frame].step; }
+    // Fields of frame, in the order they were added.
+    std::vector<ArchiveFieldEntry> fields(std::size_t frame);
+    // Decompresses field name of frame into values. Returns false, with error set, if it is missing or corrupt.
+    bool read(std::size_t frame, const char* name, std::vector<unsigned char>& values);
+
+    std::string error;
+
+private:
+    std::ifstream file;
+    std::vector<ArchiveIndexEntry> index;
+};
@@ -0,0 +1,42 @@
+#include "grid.h"
+
+void setBoundary(Grid2D& grid, BoundaryType type) {
+    const int w = grid.width;
+    const int h = grid.height;
+    const float xSign = type == BoundaryType::VelocityX ? -1.0f : 1.0f;
+    const float ySign = type == BoundaryType::VelocityY ? -1.0f : 1.0f;
+
+    // Bottom and top rows are contiguous, so copy them as whole rows.
+    float* bottom = grid.row(0);
+    float* top = grid.row(h + 1);
+    const float* firstRow = grid.row(1);
+    const float* lastRow = grid.row(h);
+    for (int x = 1; x <= w; x++) {
+        bottom[x] = ySign * firstRow[x];
+        top[x] = ySign * lastRow[x];
+    }
+
+    for (int y = 1; y <= h; y++) {
+        float* row = grid.row(y);
+        row[0] = xSign * row[1];
+        row[w + 1] = xSign * row[w];
+    }
+
+    grid(0, 0) = 0.5f * (grid(1, 0) + grid(0, 1));
+    grid(w + 1, 0) = 0.5f * (grid(w, 0) + grid(w + 1, 1));
+    grid(0, h + 1) = 0.5f * (grid(1, h + 1) + grid(0, h));
+    grid(w + 1, h + 1) = 0.5f * (grid(w, h + 1) + grid(w + 1, h));
+}
+
+void interpolateGrid(Grid2D& out, const Grid2D& from, const Grid2D& to, float alpha) {
+    if (out.width != to.width || out.height != to.height) {
+        out.resize(to.width, to.height);
+    }
+    const float* previous = from.data();
+    const float* current = to.data();
+    float* target = out.data();
+    const std::size_t count = to.size();
+    for (std::size_t i = 0; i < count; i++) {
+        target[i] = previous[i] + alpha * (current[i] - previous[i]);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Allocator that aligns the start of a buffer to a cache line. Only the start: padded rows of stride
+// width + 2 begin wherever they fall, so kernels use unaligned loads.
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t count) {
+        std::size_t bytes = (count * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void* pointer = std::aligned_alloc(Alignment, bytes);
+        if (!pointer) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(pointer);
+    }
+
+    void deallocate(T* pointer, std::size_t) {
+        std::free(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+/*
+ * Field over a width x height cell grid, surrounded by a single ring of ghost cells. Values are stored
+ * row-major in one flat buffer, so cell (x, y) lives at x + y * stride and interior cells span x in
+ * [1, width] and y in [1, height]. Ghost cells let stencils read neighbors without branching.
+ */
+template <typename T>
+struct PaddedGrid {
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    std::vector<T, AlignedAllocator<T>> values;
+
+    PaddedGrid() = default;
+    PaddedGrid(int width, int height) { resize(width, height); }
+
+    void resize(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+        stride = newWidth + 2;
+        values.assign(static_cast<std::size_t>(stride) * (newHeight + 2), T());
+    }
+
+    void fill(T value) { values.assign(values.size(), value); }
+
+    int index(int x, int y) const { return x + y * stride; }
+    T& operator()(int x, int y) { return values[index(x, y)]; }
+    T operator()(int x, int y) const { return values[index(x, y)]; }
+
+    T* row(int y) { return values.data() + y * stride; }
+    const T* row(int y) const { return values.data() + y * stride; }
+
+    T* data() { return values.data(); }
+    const T* data() const { return values.data(); }
+    std::size_t size() const { return values.size(); }
+};
+
+using Grid2D = PaddedGrid<float>;
+// Per-cell flags, e.g. 1 for solid cells and 0 for fluid.
+using Mask2D = PaddedGrid<unsigned char>;
+
+// How ghost cells mirror the interior: scalars are copied, and the velocity component normal to a wall is negated.
+enum class BoundaryType {
+    Scalar,
+    VelocityX,
+    VelocityY
+};
+
+void setBoundary(Grid2D& grid, BoundaryType type);
+
+// Writes from + alpha * (to - from) into out, resizing out to match.
+void interpolateGrid(Grid2D& out, const Grid2D& from, const Grid2D& to, float alpha);
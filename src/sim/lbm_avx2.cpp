@@ -0,0 +1,8 @@
+#include "lbm_kernels.h"
+
+#include "lbm_stream_collide.h"
+
+// Compiled with AVX2 enabled; only reached through selectStreamCollideKernel once CPUID reports support.
+void streamCollideTileAvx2(const StreamCollideArgs& args, const Tile& tile) {
+    streamCollideTile(args, tile);
+}
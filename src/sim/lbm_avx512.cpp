@@ -0,0 +1,8 @@
+#include "lbm_kernels.h"
+
+#include "lbm_stream_collide.h"
+
+// Compiled with AVX-512F enabled; only reached through selectStreamCollideKernel once CPUID reports support.
+void streamCollideTileAvx512(const StreamCollideArgs& args, const Tile& tile) {
+    streamCollideTile(args, tile);
+}
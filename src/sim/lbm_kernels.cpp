@@ -0,0 +1,25 @@
+#include "lbm_kernels.h"
+
+#include "lbm_stream_collide.h"
+
+void streamCollideTileScalar(const StreamCollideArgs& args, const Tile& tile) {
+    streamCollideTile(args, tile);
+}
+
+// SSE2 is the x86-64 baseline, so the portable build already runs it at that width.
+StreamCollideTileKernel selectStreamCollideKernel(SimdLevel level) {
+#ifdef FLUIDS_X86_KERNELS
+    switch (supportedSimdLevel(level)) {
+    case SimdLevel::Avx512:
+        return streamCollideTileAvx512;
+    case SimdLevel::Avx2:
+        return streamCollideTileAvx2;
+    case SimdLevel::Sse2:
+    case SimdLevel::Scalar:
+        break;
+    }
+#else
+    (void)level;
+#endif
+    return streamCollideTileScalar;
+}
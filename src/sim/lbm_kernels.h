@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+
+#include "advect_kernels.h"
+#include "thread_pool.h"
+
+// D2Q9 lattice: the rest population, the four axis neighbors and the four diagonals.
+inline constexpr int lbmDirections = 9;
+inline constexpr int lbmVelocityX[lbmDirections] = { 0, 1, 0, -1, 0, 1, -1, -1, 1 };
+inline constexpr int lbmVelocityY[lbmDirections] = { 0, 0, 1, 0, -1, 1, 1, -1, -1 };
+inline constexpr int lbmOpposite[lbmDirections] = { 0, 3, 4, 1, 2, 7, 8, 5, 6 };
+inline constexpr float lbmWeights[lbmDirections] = { 4.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f,
+                                                     1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f };
+
+enum class LbmCollision {
+    // Single relaxation time towards equilibrium.
+    Bgk,
+    // Multiple relaxation times: the ghost moments relax at their own fixed rates, which damps the
+    // oscillations that make BGK blow up at low viscosity.
+    Mrt
+};
+
+// Display names indexed by LbmCollision.
+inline constexpr const char* lbmCollisionNames[] = { "BGK", "MRT" };
+
+// One distribution grid per direction, all padded grids sharing one stride.
+struct StreamCollideArgs {
+    std::array<float*, lbmDirections> f {};
+    // Nonzero for obstacle cells, which the kernel leaves untouched.
+    const unsigned char* solid = nullptr;
+    int stride = 0;
+    // Odd steps stream in and out of the neighbors, even steps only collide in place; see LbmSolver.
+    bool odd = false;
+    LbmCollision collision = LbmCollision::Bgk;
+    // Relaxation rate of the shear moments, 1 / tau.
+    float omega = 1.0f;
+};
+
+using StreamCollideTileKernel = void (*)(const StreamCollideArgs& args, const Tile& tile);
+
+// Portable path, vectorized by the compiler for the baseline instruction set (SSE2 on x86-64).
+void streamCollideTileScalar(const StreamCollideArgs& args, const Tile& tile);
+#ifdef FLUIDS_X86_KERNELS
+// The same kernel compiled for wider vectors in its own translation unit; only call after dispatch.
+void streamCollideTileAvx2(const StreamCollideArgs& args, const Tile& tile);
+void streamCollideTileAvx512(const StreamCollideArgs& args, const Tile& tile);
+#endif
+
+StreamCollideTileKernel selectStreamCollideKernel(SimdLevel level);
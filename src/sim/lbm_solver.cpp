@@ -0,0 +1,223 @@
+#include "lbm_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "float_mode.h"
+#include "trace.h"
+
+namespace {
+
+// Snapshot field names of the distributions.
+constexpr const char* distributionNames[lbmDirections] = { "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8" };
+
+float equilibrium(int direction, float density, float ux, float uy) {
+    const float cu = 3.0f * (lbmVelocityX[direction] * ux + lbmVelocityY[direction] * uy);
+    return lbmWeights[direction] * density * (1.0f + cu + 0.5f * cu * cu - 1.5f * (ux * ux + uy * uy));
+}
+
+}
+
+LbmSolver::LbmSolver(const LbmSettings& settings, ThreadPool& pool) : settings(settings), pool(pool) {
+    reset();
+}
+
+void LbmSolver::reset() {
+    const int width = std::max(8, settings.width);
+    const int height = std::max(8, settings.height);
+    for (Grid2D* grid : { &density, &velocityX, &velocityY, &pressure }) {
+        grid->resize(width, height);
+    }
+    solid.resize(width, height);
+
+    // The cylinder sits a little off the centerline so shedding starts without waiting for round-off.
+    const float radius = settings.obstacleRadius * height;
+    const float centerX = 0.2f * width;
+    const float centerY = 0.5f * height + 1.0f;
+    for (int y = 1; y <= height; y++) {
+        for (int x = 1; x <= width; x++) {
+            const float dx = x - 0.5f - centerX;
+            const float dy = y - 0.5f - centerY;
+            solid(x, y) = dx * dx + dy * dy < radius * radius ? 1 : 0;
+        }
+    }
+
+    for (int i = 0; i < lbmDirections; i++) {
+        inflow[i] = equilibrium(i, 1.0f, settings.inflowVelocity, 0.0f);
+        distributions[i].resize(width, height);
+        distributions[i].fill(inflow[i]);
+    }
+
+    // Rows outside the channel are walls, corners included; columns outside it are the inlet and outlet.
+    links.clear();
+    for (int y = 1; y <= height; y++) {
+        for (int x = 1; x <= width; x++) {
+            if (solid(x, y)) {
+                continue;
+            }
+            for (int i = 1; i < lbmDirections; i++) {
+                const int sourceX = x - lbmVelocityX[i];
+                const int sourceY = y - lbmVelocityY[i];
+                LinkType type;
+                if (sourceY < 1 || sourceY > height) {
+                    type = LinkType::Wall;
+                } else if (sourceX < 1) {
+                    type = LinkType::Inflow;
+                } else if (sourceX > width) {
+                    type = LinkType::Outflow;
+                } else if (solid(sourceX, sourceY)) {
+                    type = LinkType::Wall;
+                } else {
+                    continue;
+                }
+                links.push_back({ solid.index(x, y), static_cast<unsigned char>(i), type });
+            }
+        }
+    }
+
+    stats = {};
+    stats.tau = relaxationTime();
+    updateMacroscopic();
+}
+
+float LbmSolver::relaxationTime() const {
+    const float length = settings.obstacleRadius > 0.0f ? 2.0f * settings.obstacleRadius * density.height : static_cast<float>(density.height);
+    const float viscosity = settings.inflowVelocity * length / std::max(settings.reynolds, 1.0f);
+    return 3.0f * viscosity + 0.5f;
+}
+
+void LbmSolver::saveState(SnapshotWriter& snapshot) const {
+    for (int i = 0; i < lbmDirections; i++) {
+        snapshot.add(distributionNames[i], distributions[i]);
+    }
+    // The parity of the step count says which slots the AA pattern left each population in.
+    snapshot.add("totalSteps", SnapshotType::UInt64, &stats.totalSteps, sizeof(stats.totalSteps), 1);
+}
+
+bool LbmSolver::loadState(const Snapshot& snapshot) {
+    for (int i = 0; i < lbmDirections; i++) {
+        if (!snapshot.read(distributionNames[i], distributions[i])) {
+            return false;
+        }
+    }
+    if (!snapshot.read("totalSteps", SnapshotType::UInt64, &stats.totalSteps, 1)) {
+        return false;
+    }
+    updateMacroscopic();
+    return true;
+}
+
+void LbmSolver::addArchiveFields(ArchiveFrame& frame) const {
+    frame.addInterior("density", density);
+    frame.addInterior("velocityX", velocityX);
+    frame.addInterior("velocityY", velocityY);
+}
+
+void LbmSolver::step() {
+    TRACE_ZONE("lbmStep");
+    ScopedFlushDenormals flushDenormals;
+    const StreamCollideTileKernel kernel = selectStreamCollideKernel(settings.simd);
+    StreamCollideArgs args;
+    for (int i = 0; i < lbmDirections; i++) {
+        args.f[i] = distributions[i].data();
+    }
+    args.solid = solid.data();
+    args.stride = solid.stride;
+    args.collision = settings.collision;
+    stats.tau = relaxationTime();
+    args.omega = 1.0f / stats.tau;
+
+    const int steps = std::max(1, settings.stepsPerUpdate);
+    const std::int64_t start = traceNanoseconds();
+    for (int s = 0; s < steps; s++) {
+        args.odd = stats.totalSteps % 2 == 1;
+        applyBoundaries(args.odd);
+        parallelForTiles(pool, solid.width, solid.height, [&](const Tile& tile) { kernel(args, tile); });
+        stats.totalSteps++;
+    }
+    const double seconds = (traceNanoseconds() - start) * 1e-9;
+    stats.steps = steps;
+    stats.mlups = seconds > 0.0 ? static_cast<double>(solid.width) * solid.height * steps / seconds * 1e-6 : 0.0;
+    updateMacroscopic();
+}
+
+// Before an even step a node reads its own slots, so the arriving population goes straight into the node.
+// Before an odd step it reads the opposite slot of the neighbor it arrives from, which is outside the fluid,
+// so the population is left there. Walls bounce back what the node sent the other way on the previous
+// step, the inlet feeds the free stream equilibrium and the outlet copies the column upstream of it.
+void LbmSolver::applyBoundaries(bool odd) {
+    const int stride = solid.stride;
+    for (const Link& link : links) {
+        const int i = link.direction;
+        const int opposite = lbmOpposite[i];
+        const int source = link.index - lbmVelocityX[i] - lbmVelocityY[i] * stride;
+        float* arriving = distributions[i].data();
+        float* leaving = distributions[opposite].data();
+        if (!odd) {
+            switch (link.type) {
+            case LinkType::Wall:
+                arriving[link.index] = leaving[source];
+                break;
+            case LinkType::Inflow:
+                arriving[link.index] = inflow[i];
+                break;
+            case LinkType::Outflow:
+                arriving[link.index] = arriving[link.index - 1];
+                break;
+            }
+        } else {
+            switch (link.type) {
+            case LinkType::Wall:
+                leaving[source] = arriving[link.index];
+                break;
+            case LinkType::Inflow:
+                leaving[source] = inflow[i];
+                break;
+            case LinkType::Outflow:
+                leaving[source] = leaving[source - 1];
+                break;
+            }
+        }
+    }
+}
+
+// After an even number of steps every node holds its populations in their own slots. After an odd number
+// they are still in the opposite slots, collided, which has the same density and momentum with the sign of
+// every direction flipped.
+void LbmSolver::updateMacroscopic() {
+    TRACE_ZONE("lbmMacroscopic");
+    const float sign = stats.totalSteps % 2 == 0 ? 1.0f : -1.0f;
+    float maxSpeedSquared = parallelReduceTiles(pool, solid.width, solid.height, 0.0f, [&](const Tile& tile) {
+        float result = 0.0f;
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const unsigned char* mask = solid.row(y);
+            float* rho = density.row(y);
+            float* ux = velocityX.row(y);
+            float* uy = velocityY.row(y);
+            float* p = pressure.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                float sum = 0.0f;
+                float momentumX = 0.0f;
+                float momentumY = 0.0f;
+                for (int i = 0; i < lbmDirections; i++) {
+                    const float f = distributions[i].row(y)[x];
+                    sum += f;
+                    momentumX += lbmVelocityX[i] * f;
+                    momentumY += lbmVelocityY[i] * f;
+                }
+                if (mask[x]) {
+                    sum = 1.0f;
+                    momentumX = 0.0f;
+                    momentumY = 0.0f;
+                }
+                rho[x] = sum;
+                ux[x] = sign * momentumX / sum;
+                uy[x] = sign * momentumY / sum;
+                p[x] = (sum - 1.0f) * (1.0f / 3.0f);
+                result = std::max(result, ux[x] * ux[x] + uy[x] * uy[x]);
+            }
+        }
+        return result;
+    }, [](float left, float right) { return std::max(left, right); });
+    stats.maxSpeed = std::sqrt(maxSpeedSquared);
+}
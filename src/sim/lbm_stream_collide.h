@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstring>
+
+#include "lbm_kernels.h"
+
+// Body of the fused stream-collide kernel, included by one translation unit per instruction set. It lives in
+// an anonymous namespace so every includer compiles a private copy with its own flags: a shared inline
+// definition could be folded by the linker into the AVX-512 copy and then run on any CPU.
+namespace {
+
+// Nodes per chunk. A chunk's populations are copied into local arrays, where the collision loop cannot alias
+// the distribution grids and vectorizes cleanly, and copied back once collided.
+constexpr int lbmChunk = 64;
+
+// Relaxation rates of the MRT ghost moments, the values of Lallemand and Luo (2000).
+constexpr float mrtRateEnergy = 1.64f;
+constexpr float mrtRateEnergySquared = 1.54f;
+constexpr float mrtRateHeatFlux = 1.9f;
+
+// Rows of the MRT moment matrix for the six non-conserved moments, and their squared norms. The rows are
+// orthogonal, so row / norm is the matching column of the inverse.
+constexpr float mrtEnergy[lbmDirections] = { -4, -1, -1, -1, -1, 2, 2, 2, 2 };
+constexpr float mrtEnergySquared[lbmDirections] = { 4, -2, -2, -2, -2, 1, 1, 1, 1 };
+constexpr float mrtHeatFluxX[lbmDirections] = { 0, -2, 0, 2, 0, 1, -1, -1, 1 };
+constexpr float mrtHeatFluxY[lbmDirections] = { 0, 0, -2, 0, 2, 1, 1, -1, -1 };
+constexpr float mrtStressXX[lbmDirections] = { 0, 1, -1, 1, -1, 0, 0, 0, 0 };
+constexpr float mrtStressXY[lbmDirections] = { 0, 0, 0, 0, 0, 1, -1, 1, -1 };
+
+using Chunk = float[lbmDirections][lbmChunk];
+
+// Full chunks copy with a constant size, which compiles to plain vector moves instead of a generic copy.
+void copyChunk(float* target, const float* source, int count) {
+    if (count == lbmChunk) {
+        std::memcpy(target, source, lbmChunk * sizeof(float));
+    } else {
+        std::memcpy(target, source, count * sizeof(float));
+    }
+}
+
+void collideBgk(const Chunk& in, Chunk& out, int count, float omega) {
+    for (int k = 0; k < count; k++) {
+        float density = 0.0f;
+        float momentumX = 0.0f;
+        float momentumY = 0.0f;
+        for (int i = 0; i < lbmDirections; i++) {
+            density += in[i][k];
+            momentumX += lbmVelocityX[i] * in[i][k];
+            momentumY += lbmVelocityY[i] * in[i][k];
+        }
+        const float inverseDensity = 1.0f / density;
+        const float ux = momentumX * inverseDensity;
+        const float uy = momentumY * inverseDensity;
+        const float speedTerm = 1.5f * (ux * ux + uy * uy);
+        for (int i = 0; i < lbmDirections; i++) {
+            const float cu = 3.0f * (lbmVelocityX[i] * ux + lbmVelocityY[i] * uy);
+            const float equilibrium = lbmWeights[i] * density * (1.0f + cu + 0.5f * cu * cu - speedTerm);
+            out[i][k] = in[i][k] + omega * (equilibrium - in[i][k]);
+        }
+    }
+}
+
+// Relaxes in moment space. Density and momentum are conserved, so only the six other moments move towards
+// equilibrium; the stresses at omega set the viscosity exactly as in BGK.
+void collideMrt(const Chunk& in, Chunk& out, int count, float omega) {
+    for (int k = 0; k < count; k++) {
+        float density = 0.0f;
+        float momentumX = 0.0f;
+        float momentumY = 0.0f;
+        float energy = 0.0f;
+        float energySquared = 0.0f;
+        float heatFluxX = 0.0f;
+        float heatFluxY = 0.0f;
+        float stressXX = 0.0f;
+        float stressXY = 0.0f;
+        for (int i = 0; i < lbmDirections; i++) {
+            const float f = in[i][k];
+            density += f;
+            momentumX += lbmVelocityX[i] * f;
+            momentumY += lbmVelocityY[i] * f;
+            energy += mrtEnergy[i] * f;
+            energySquared += mrtEnergySquared[i] * f;
+            heatFluxX += mrtHeatFluxX[i] * f;
+            heatFluxY += mrtHeatFluxY[i] * f;
+            stressXX += mrtStressXX[i] * f;
+            stressXY += mrtStressXY[i] * f;
+        }
+        const float inverseDensity = 1.0f / density;
+        const float momentumSquared = (momentumX * momentumX + momentumY * momentumY) * inverseDensity;
+        // Each change is divided by its row's squared norm up front, ready for the inverse transform.
+        const float dEnergy = mrtRateEnergy * (energy - (-2.0f * density + 3.0f * momentumSquared)) * (1.0f / 36.0f);
+        const float dEnergySquared = mrtRateEnergySquared * (energySquared - (density - 3.0f * momentumSquared)) * (1.0f / 36.0f);
+        const float dHeatFluxX = mrtRateHeatFlux * (heatFluxX + momentumX) * (1.0f / 12.0f);
+        const float dHeatFluxY = mrtRateHeatFlux * (heatFluxY + momentumY) * (1.0f / 12.0f);
+        const float dStressXX = omega * (stressXX - (momentumX * momentumX - momentumY * momentumY) * inverseDensity) * 0.25f;
+        const float dStressXY = omega * (stressXY - momentumX * momentumY * inverseDensity) * 0.25f;
+        for (int i = 0; i < lbmDirections; i++) {
+            out[i][k] = in[i][k] - (mrtEnergy[i] * dEnergy + mrtEnergySquared[i] * dEnergySquared + mrtHeatFluxX[i] * dHeatFluxX
+                                    + mrtHeatFluxY[i] * dHeatFluxY + mrtStressXX[i] * dStressXX + mrtStressXY[i] * dStressXY);
+        }
+    }
+}
+
+// AA pattern: an even step reads every population of a node and writes it back collided into the slot of
+// the opposite direction of the same node. An odd step gathers a node's populations from where the previous
+// step left them, at the neighbors in the opposite slots, and scatters the collided ones straight into the
+// neighbors in their own slots. Either way a node writes exactly the locations it reads, so the update runs
+// in place, one pass over memory per step, and any split into chunks or tiles is race free.
+void streamCollideTile(const StreamCollideArgs& args, const Tile& tile) {
+    alignas(64) Chunk in;
+    alignas(64) Chunk out;
+    const int stride = args.stride;
+    int offsets[lbmDirections];
+    for (int i = 0; i < lbmDirections; i++) {
+        offsets[i] = lbmVelocityX[i] + lbmVelocityY[i] * stride;
+    }
+
+    for (int y = tile.yBegin; y < tile.yEnd; y++) {
+        for (int x = tile.xBegin; x < tile.xEnd; x += lbmChunk) {
+            const int count = tile.xEnd - x < lbmChunk ? tile.xEnd - x : lbmChunk;
+            const int base = x + y * stride;
+            for (int i = 0; i < lbmDirections; i++) {
+                const float* source = args.odd ? args.f[lbmOpposite[i]] + base - offsets[i] : args.f[i] + base;
+                copyChunk(in[i], source, count);
+            }
+            if (args.collision == LbmCollision::Mrt) {
+                collideMrt(in, out, count, args.omega);
+            } else {
+                collideBgk(in, out, count, args.omega);
+            }
+            // Writing back what was read, swapped into the write pattern, leaves obstacle nodes as they were.
+            // Most chunks have none, and skipping the blend for them doubles the throughput.
+            const unsigned char* solid = args.solid + base;
+            bool anySolid = false;
+            for (int k = 0; k < count; k++) {
+                anySolid |= solid[k] != 0;
+            }
+            for (int i = 0; anySolid && i < lbmDirections; i++) {
+                for (int k = 0; k < count; k++) {
+                    out[i][k] = solid[k] ? in[lbmOpposite[i]][k] : out[i][k];
+                }
+            }
+            for (int i = 0; i < lbmDirections; i++) {
+                float* target = args.odd ? args.f[i] + base + offsets[i] : args.f[lbmOpposite[i]] + base;
+                copyChunk(target, out[i], count);
+            }
+        }
+    }
+}
+
+}
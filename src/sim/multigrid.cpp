@@ -0,0 +1,165 @@
+#include "multigrid.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+namespace {
+
+// Levels stop coarsening once either dimension would drop below this or become odd.
+constexpr int minimumLevelSize = 4;
+constexpr int maxCoarsestSweeps = 64;
+
+// Sums each 2x2 block of the fine residual into one coarse cell. The sum (rather than the average)
+// accounts for the coarse stencil's doubled cell spacing, so every level uses the same unit stencil.
+void restrictResidual(ThreadPool& pool, Grid2D& coarse, const Grid2D& fine) {
+    TRACE_ZONE("restrictResidual");
+    parallelForTiles(pool, coarse.width, coarse.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* fineBottom = fine.row(2 * y - 1);
+            const float* fineTop = fine.row(2 * y);
+            float* target = coarse.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                int fx = 2 * x - 1;
+                target[x] = fineBottom[fx] + fineBottom[fx + 1] + fineTop[fx] + fineTop[fx + 1];
+            }
+        }
+    });
+    setBoundary(coarse, BoundaryType::Scalar);
+}
+
+// Bilinear interpolation of a cell-centered coarse field onto the fine grid, added to (or replacing) the fine values.
+void prolongate(ThreadPool& pool, Grid2D& fine, const Grid2D& coarse, bool accumulate) {
+    TRACE_ZONE("prolongate");
+    parallelForTiles(pool, fine.width, fine.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            int cy = (y + 1) / 2;
+            int neighborY = (y & 1) ? cy - 1 : cy + 1;
+            const float* near = coarse.row(cy);
+            const float* far = coarse.row(neighborY);
+            float* target = fine.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                int cx = (x + 1) / 2;
+                int neighborX = (x & 1) ? cx - 1 : cx + 1;
+                float value = 0.5625f * near[cx] + 0.1875f * (near[neighborX] + far[cx]) + 0.0625f * far[neighborX];
+                target[x] = accumulate ? target[x] + value : value;
+            }
+        }
+    });
+    setBoundary(fine, BoundaryType::Scalar);
+}
+
+}
+
+void MultigridSolver::buildLevels(int width, int height) {
+    if (!levels.empty() && levels[0].residual.width == width && levels[0].residual.height == height) {
+        return;
+    }
+    levels.clear();
+    levels.emplace_back();
+    levels[0].residual.resize(width, height);
+    while (width % 2 == 0 && height % 2 == 0 && width / 2 >= minimumLevelSize && height / 2 >= minimumLevelSize) {
+        width /= 2;
+        height /= 2;
+        Level& level = levels.emplace_back();
+        level.solution.resize(width, height);
+        level.rhs.resize(width, height);
+        level.residual.resize(width, height);
+    }
+}
+
+void MultigridSolver::solveCoarsest() {
+    TRACE_ZONE("solveCoarsest");
+    Level& coarsest = levels.back();
+    Grid2D& rhs = coarsest.rhs;
+
+    // With walls on every side the operator is singular, so project out the constant mode first.
+    double sum = 0.0;
+    for (int y = 1; y <= rhs.height; y++) {
+        const float* row = rhs.row(y);
+        for (int x = 1; x <= rhs.width; x++) {
+            sum += row[x];
+        }
+    }
+    float mean = static_cast<float>(sum / (static_cast<double>(rhs.width) * rhs.height));
+    for (int y = 1; y <= rhs.height; y++) {
+        float* row = rhs.row(y);
+        for (int x = 1; x <= rhs.width; x++) {
+            row[x] -= mean;
+        }
+    }
+
+    int sweeps = std::min(maxCoarsestSweeps, 2 * std::max(rhs.width, rhs.height));
+    for (int i = 0; i < sweeps; i++) {
+        redBlackGaussSeidel(pool, coarsest.solution, rhs);
+    }
+}
+
+void MultigridSolver::vCycle(Grid2D& solution, const Grid2D& rhs, int level, int smoothingSteps) {
+    TRACE_ZONE("vCycle");
+    if (level == levelCount() - 1) {
+        if (level == 0) {
+            // Grids with odd dimensions cannot be coarsened, which degrades to plain Gauss-Seidel.
+            for (int i = 0; i < 2 * smoothingSteps; i++) {
+                redBlackGaussSeidel(pool, solution, rhs);
+            }
+        } else {
+            solveCoarsest();
+        }
+        return;
+    }
+    Level& coarse = levels[level + 1];
+
+    for (int i = 0; i < smoothingSteps; i++) {
+        redBlackGaussSeidel(pool, solution, rhs);
+    }
+    computeResidual(pool, solution, rhs, &levels[level].residual);
+    restrictResidual(pool, coarse.rhs, levels[level].residual);
+    coarse.solution.fill(0.0f);
+    vCycle(coarse.solution, coarse.rhs, level + 1, smoothingSteps);
+    prolongate(pool, solution, coarse.solution, true);
+    for (int i = 0; i < smoothingSteps; i++) {
+        redBlackGaussSeidel(pool, solution, rhs);
+    }
+}
+
+PressureSolveStats MultigridSolver::solve(Grid2D& pressure, const Grid2D& rhs, const MultigridSettings& settings) {
+    TRACE_ZONE("multigridSolve");
+    PressureSolveStats stats;
+    buildLevels(pressure.width, pressure.height);
+
+    float rhsNorm = maxAbs(pool, rhs);
+    if (rhsNorm == 0.0f) {
+        pressure.fill(0.0f);
+        return stats;
+    }
+    float scale = 1.0f / rhsNorm;
+
+    setBoundary(pressure, BoundaryType::Scalar);
+    stats.initialResidual = computeResidual(pool, pressure, rhs, &levels[0].residual) * scale;
+    stats.residual = stats.initialResidual;
+
+    if (settings.fullMultigrid && levelCount() > 1 && stats.residual > settings.tolerance) {
+        // Full multigrid on the correction: restrict the residual all the way down, solve the coarsest
+        // level, then interpolate upwards running one V-cycle per level before the fine-level cycles.
+        restrictResidual(pool, levels[1].rhs, levels[0].residual);
+        for (int level = 2; level < levelCount(); level++) {
+            restrictResidual(pool, levels[level].rhs, levels[level - 1].rhs);
+        }
+        levels.back().solution.fill(0.0f);
+        solveCoarsest();
+        for (int level = levelCount() - 2; level >= 1; level--) {
+            prolongate(pool, levels[level].solution, levels[level + 1].solution, false);
+            vCycle(levels[level].solution, levels[level].rhs, level, settings.smoothingSteps);
+        }
+        prolongate(pool, pressure, levels[1].solution, true);
+    }
+
+    while (stats.iterations < settings.maxCycles && stats.residual > settings.tolerance) {
+        vCycle(pressure, rhs, 0, settings.smoothingSteps);
+        stats.residual = computeResidual(pool, pressure, rhs, nullptr) * scale;
+        stats.history.push_back(stats.residual);
+        stats.iterations++;
+    }
+    return stats;
+}
@@ -0,0 +1,68 @@
+#include "neighbor_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "trace.h"
+
+void NeighborGrid::build(ThreadPool& pool, const ParticleArray& positionX, const ParticleArray& positionY, float newCellSize, float width, float height) {
+    TRACE_ZONE("neighborGridBuild");
+    const int count = static_cast<int>(positionX.size());
+    cellSize = newCellSize;
+    inverseCellSize = 1.0f / newCellSize;
+    cellsX = std::max(1, static_cast<int>(std::ceil(width * inverseCellSize)));
+    cellsY = std::max(1, static_cast<int>(std::ceil(height * inverseCellSize)));
+    const int cellCount = cellsX * cellsY;
+
+    particleCell.resize(count);
+    order.resize(count);
+    sortedX.resize(count);
+    sortedY.resize(count);
+    cellStart.assign(cellCount + 1, 0);
+
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            particleCell[i] = cellCoordinate(positionX[i], cellsX) + cellCoordinate(positionY[i], cellsY) * cellsX;
+        }
+    });
+
+    // Counting sort: histogram, exclusive prefix sum, then a stable scatter that leaves each cell's
+    // particles in index order. The serial passes are single streams over the particles.
+    for (int i = 0; i < count; i++) {
+        cellStart[particleCell[i] + 1]++;
+    }
+    for (int cell = 0; cell < cellCount; cell++) {
+        cellStart[cell + 1] += cellStart[cell];
+    }
+    cellCursor.assign(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < count; i++) {
+        order[cellCursor[particleCell[i]]++] = i;
+    }
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            sortedX[k] = positionX[order[k]];
+            sortedY[k] = positionY[order[k]];
+        }
+    });
+
+    constexpr int floatsPerLine = 64 / sizeof(float);
+    std::int64_t lines = parallelReduceParticles(pool, count, std::int64_t(0), [&](int begin, int end) {
+        std::int64_t partial = 0;
+        for (int k = std::max(begin, 1); k < end; k++) {
+            partial += order[k] / floatsPerLine != order[k - 1] / floatsPerLine;
+        }
+        return partial;
+    }, [](std::int64_t a, std::int64_t b) { return a + b; });
+    gatherCacheLines = count > 0 ? static_cast<float>(lines + 1) / count : 0.0f;
+}
+
+void NeighborGrid::gather(ThreadPool& pool, const ParticleArray& source, ParticleArray& sorted) const {
+    const int count = static_cast<int>(order.size());
+    sorted.resize(count);
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            sorted[k] = source[order[k]];
+        }
+    });
+}
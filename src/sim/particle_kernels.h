@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "particles.h"
+
+// 2D smoothing kernels shared by the particle solvers, all with support radius h.
+
+constexpr float kernelPi = 3.14159265f;
+
+// Poly6 density kernel W(r) = poly6Scale(h) * (h^2 - r^2)^3, evaluated from squared distance without a square root.
+inline float poly6Scale(float h) {
+    return 4.0f / (kernelPi * std::pow(h, 8.0f));
+}
+
+inline float poly6(float distanceSquared, float h) {
+    float d = std::max(0.0f, h * h - distanceSquared);
+    return poly6Scale(h) * d * d * d;
+}
+
+// Magnitude of the spiky kernel gradient, spikyGradientScale(h) * (h - r)^2, pointing from the neighbor to the particle.
+inline float spikyGradientScale(float h) {
+    return 30.0f / (kernelPi * std::pow(h, 5.0f));
+}
+
+// Poly6 sum seen by a particle inside a square lattice with the given spacing. Dividing the rest density by it
+// gives the particle mass that makes a resting lattice exactly rest density.
+inline float latticeDensitySum(float spacing, float h) {
+    const int reach = static_cast<int>(h / spacing) + 1;
+    float sum = 0.0f;
+    for (int b = -reach; b <= reach; b++) {
+        for (int a = -reach; a <= reach; a++) {
+            sum += poly6((a * a + b * b) * spacing * spacing, h);
+        }
+    }
+    return sum;
+}
+
+// Fills a damWidth x damHeight block in the lower-left corner with count particles on a square lattice at rest,
+// filling rows from the bottom. Returns the lattice spacing.
+inline float placeDamBreak(ParticleSet& particles, int count, float damWidth, float damHeight) {
+    const float spacing = std::sqrt(damWidth * damHeight / count);
+    const int columns = std::max(1, static_cast<int>(damWidth / spacing));
+    particles.resize(count);
+    for (int i = 0; i < count; i++) {
+        particles.positionX[i] = (0.5f + i % columns) * spacing;
+        particles.positionY[i] = (0.5f + i / columns) * spacing;
+    }
+    return spacing;
+}
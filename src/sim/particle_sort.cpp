@@ -0,0 +1,107 @@
+#include "particle_sort.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "trace.h"
+
+namespace {
+
+constexpr int digitBits = 8;
+constexpr int digitCount = 1 << digitBits;
+
+// Spreads the low 16 bits of value into the even bits.
+std::uint32_t spreadBits(std::uint32_t value) {
+    value &= 0xffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+}
+
+std::uint32_t mortonCode(std::uint32_t x, std::uint32_t y) {
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+void MortonSorter::sort(ThreadPool& pool, ParticleSet& particles, float cellSize, float width, float height,
+                        std::initializer_list<ParticleArray*> extraArrays) {
+    TRACE_ZONE("mortonSort");
+    const int count = particles.size();
+    const float inverseCellSize = 1.0f / cellSize;
+    const int cellsX = std::clamp(static_cast<int>(std::ceil(width * inverseCellSize)), 1, 1 << 16);
+    const int cellsY = std::clamp(static_cast<int>(std::ceil(height * inverseCellSize)), 1, 1 << 16);
+    keys.resize(count);
+    keyScratch.resize(count);
+    order.resize(count);
+    orderScratch.resize(count);
+
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int x = std::clamp(static_cast<int>(particles.positionX[i] * inverseCellSize), 0, cellsX - 1);
+            int y = std::clamp(static_cast<int>(particles.positionY[i] * inverseCellSize), 0, cellsY - 1);
+            keys[i] = mortonCode(x, y);
+            order[i] = i;
+        }
+    });
+
+    // Only sort the digits the largest code uses; a 512 x 256 cell domain needs three passes, not four.
+    const std::uint32_t maxKey = mortonCode(cellsX - 1, cellsY - 1);
+    int passes = 0;
+    while (passes < 4 && (maxKey >> (passes * digitBits)) != 0) {
+        passes++;
+    }
+
+    const int blocks = (count + particleBlockSize - 1) / particleBlockSize;
+    blockOffsets.resize(static_cast<std::size_t>(blocks) * digitCount);
+    for (int pass = 0; pass < passes; pass++) {
+        const int shift = pass * digitBits;
+        parallelForParticles(pool, count, [&](int begin, int end) {
+            int* counts = &blockOffsets[static_cast<std::size_t>(begin / particleBlockSize) * digitCount];
+            std::fill(counts, counts + digitCount, 0);
+            for (int i = begin; i < end; i++) {
+                counts[(keys[i] >> shift) & (digitCount - 1)]++;
+            }
+        });
+        // Digit-major prefix sum over blocks, so every block scatters into its own slots in index order.
+        int offset = 0;
+        for (int digit = 0; digit < digitCount; digit++) {
+            for (int block = 0; block < blocks; block++) {
+                int& slot = blockOffsets[static_cast<std::size_t>(block) * digitCount + digit];
+                int blockCount = slot;
+                slot = offset;
+                offset += blockCount;
+            }
+        }
+        parallelForParticles(pool, count, [&](int begin, int end) {
+            int* cursors = &blockOffsets[static_cast<std::size_t>(begin / particleBlockSize) * digitCount];
+            for (int i = begin; i < end; i++) {
+                int destination = cursors[(keys[i] >> shift) & (digitCount - 1)]++;
+                keyScratch[destination] = keys[i];
+                orderScratch[destination] = order[i];
+            }
+        });
+        std::swap(keys, keyScratch);
+        std::swap(order, orderScratch);
+    }
+
+    for (ParticleArray* array : { &particles.positionX, &particles.positionY, &particles.velocityX, &particles.velocityY }) {
+        permute(pool, *array);
+    }
+    for (ParticleArray* array : extraArrays) {
+        permute(pool, *array);
+    }
+}
+
+void MortonSorter::permute(ThreadPool& pool, ParticleArray& array) {
+    const int count = static_cast<int>(order.size());
+    scratch.resize(count);
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            scratch[k] = array[order[k]];
+        }
+    });
+    std::swap(array, scratch);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "particles.h"
+#include "thread_pool.h"
+
+// Interleaves the low 16 bits of x and y into a Z-order code, x in the even bits.
+std::uint32_t mortonCode(std::uint32_t x, std::uint32_t y);
+
+/*
+ * Reorders particle arrays along a Z-order (Morton) curve over square cells. The neighbor passes walk
+ * particles in memory order and read neighbors in cell order; as particles drift the two orders stop
+ * matching and every particle's neighborhood lands on cold cache lines. Sorting memory back into
+ * Morton order keeps consecutive particles spatially close. The sort is an LSD radix sort on 8-bit
+ * digits with per-block histograms, so every pass is parallel and the result is stable and deterministic.
+ */
+class MortonSorter {
+public:
+    // Sorts every array of particles, and any extra per-particle arrays, by the Morton code of its cell.
+    // Particles outside [0, width] x [0, height] go to the nearest border cell.
+    void sort(ThreadPool& pool, ParticleSet& particles, float cellSize, float width, float height,
+              std::initializer_list<ParticleArray*> extraArrays = {});
+
+private:
+    void permute(ThreadPool& pool, ParticleArray& array);
+
+    std::vector<std::uint32_t> keys;
+    std::vector<std::uint32_t> keyScratch;
+    std::vector<int> order;
+    std::vector<int> orderScratch;
+    // Per block digit counts, turned into each block's first destination per digit.
+    std::vector<int> blockOffsets;
+    ParticleArray scratch;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "grid.h"
+#include "thread_pool.h"
+
+using ParticleArray = std::vector<float, AlignedAllocator<float>>;
+
+// Particles per parallel task, large enough to amortize scheduling and small enough to balance load.
+constexpr int particleBlockSize = 2048;
+
+// Particle state stored as structure of arrays, one cache-aligned buffer per attribute.
+struct ParticleSet {
+    ParticleArray positionX;
+    ParticleArray positionY;
+    ParticleArray velocityX;
+    ParticleArray velocityY;
+
+    int size() const { return static_cast<int>(positionX.size()); }
+
+    void resize(int count) {
+        for (ParticleArray* array : { &positionX, &positionY, &velocityX, &velocityY }) {
+            array->assign(count, 0.0f);
+        }
+    }
+};
+
+// Per-step diagnostics shared by the particle solvers.
+struct ParticleStats {
+    int substeps = 0;
+    float substepSeconds = 0.0f;
+    // Simulated time covered by the latest step, less than requested when substeps ran out.
+    float simulatedSeconds = 0.0f;
+    float averageNeighbors = 0.0f;
+    float maxSpeed = 0.0f;
+    // Mean of max(0, density / restDensity - 1), the compression the solver did not remove.
+    float densityError = 0.0f;
+    // Constraint iterations per substep of the latest step, for the solvers that iterate.
+    float iterations = 0.0f;
+    // NeighborGrid::gatherCacheLines of the latest substep.
+    float gatherCacheLines = 0.0f;
+};
+
+// Calls body(begin, end) for contiguous blocks of particle indices on the pool.
+template <typename Body>
+void parallelForParticles(ThreadPool& pool, int count, Body&& body) {
+    const int blocks = (count + particleBlockSize - 1) / particleBlockSize;
+    if (blocks <= 1) {
+        body(0, count);
+        return;
+    }
+    pool.parallelFor(blocks, [&](int block) {
+        int begin = block * particleBlockSize;
+        body(begin, std::min(count, begin + particleBlockSize));
+    });
+}
+
+// Maps every block to a partial result and folds the partials in block order, so results do not depend on scheduling.
+template <typename T, typename Map, typename Combine>
+T parallelReduceParticles(ThreadPool& pool, int count, T identity, Map&& map, Combine&& combine) {
+    const int blocks = (count + particleBlockSize - 1) / particleBlockSize;
+    std::vector<T> partials(blocks, identity);
+    pool.parallelFor(blocks, [&](int block) {
+        int begin = block * particleBlockSize;
+        partials[block] = map(begin, std::min(count, begin + particleBlockSize));
+    });
+    T result = identity;
+    for (const T& partial : partials) {
+        result = combine(result, partial);
+    }
+    return result;
+}
@@ -0,0 +1,479 @@
+#include "pbf_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "float_mode.h"
+#include "particle_kernels.h"
+#include "trace.h"
+
+namespace {
+
+// Artificial pressure is measured against the kernel value at this fraction of the smoothing radius.
+constexpr float tensileDistance = 0.2f;
+// Particles are kept this fraction of the spacing away from the walls.
+constexpr float wallMargin = 0.5f;
+// Projection cells filled to less than this fraction of the rest count are air, at zero potential.
+constexpr float airFill = 0.5f;
+
+struct ConstraintSums {
+    double neighbors = 0.0;
+    double compression = 0.0;
+};
+
+ConstraintSums addSums(ConstraintSums a, ConstraintSums b) {
+    return { a.neighbors + b.neighbors, a.compression + b.compression };
+}
+
+float maxOf(float a, float b) {
+    return std::max(a, b);
+}
+
+}
+
+PbfSolver::PbfSolver(const PbfSettings& settings, ThreadPool& pool) : settings(settings), pool(pool), pcgSolver(pool) {
+    reset();
+}
+
+void PbfSolver::reset() {
+    const int count = std::max(1, settings.particleCount);
+    spacing = placeDamBreak(particles, count, settings.damWidth * settings.domainWidth, settings.damHeight * settings.domainHeight);
+    radius = 2.0f * spacing;
+    mass = settings.restDensity / latticeDensitySum(spacing, radius);
+
+    // Constraint gradient norm of a particle in the resting lattice, the scale the relaxation is relative to.
+    const float gradientScale = mass / settings.restDensity * spikyGradientScale(radius);
+    restGradientNorm = 0.0f;
+    for (int b = -2; b <= 2; b++) {
+        for (int a = -2; a <= 2; a++) {
+            float r = std::sqrt(static_cast<float>(a * a + b * b)) * spacing;
+            if (r > 0.0f && r < radius) {
+                float gradient = gradientScale * (radius - r) * (radius - r);
+                restGradientNorm += gradient * gradient;
+            }
+        }
+    }
+
+    // Projection cells no wider than the neighbor grid's, so a cell's particles are all candidates of its center.
+    const int width = std::max(1, static_cast<int>(std::ceil(settings.domainWidth / radius)));
+    cell = settings.domainWidth / width;
+    const int height = std::max(1, static_cast<int>(std::ceil(settings.domainHeight / cell)));
+    potential.resize(width, height);
+    excess.resize(width, height);
+    cells.resize(width, height);
+    cells.fill(solidCell);
+
+    for (ParticleArray* array : { &predictedX, &predictedY, &lambda, &vorticity }) {
+        array->assign(count, 0.0f);
+    }
+    stats = {};
+    pressureStats = {};
+    stepsSinceReorder = 0;
+}
+
+void PbfSolver::saveState(SnapshotWriter& snapshot) const {
+    snapshot.add("positionX", particles.positionX);
+    snapshot.add("positionY", particles.positionY);
+    snapshot.add("velocityX", particles.velocityX);
+    snapshot.add("velocityY", particles.velocityY);
+    snapshot.add("potential", potential);
+    snapshot.add("stepsSinceReorder", SnapshotType::Int32, &stepsSinceReorder, sizeof(stepsSinceReorder), 1);
+}
+
+bool PbfSolver::loadState(const Snapshot& snapshot) {
+    return snapshot.read("positionX", particles.positionX) && snapshot.read("positionY", particles.positionY)
+        && snapshot.read("velocityX", particles.velocityX) && snapshot.read("velocityY", particles.velocityY)
+        && snapshot.read("potential", potential) && snapshot.read("stepsSinceReorder", SnapshotType::Int32, &stepsSinceReorder, 1);
+}
+
+void PbfSolver::addArchiveFields(ArchiveFrame& frame) const {
+    frame.add("positionX", particles.positionX);
+    frame.add("positionY", particles.positionY);
+    frame.add("velocityX", particles.velocityX);
+    frame.add("velocityY", particles.velocityY);
+}
+
+void PbfSolver::step(float dt) {
+    TRACE_ZONE("pbfStep");
+    if (dt <= 0.0f || particles.size() == 0) {
+        return;
+    }
+    ScopedFlushDenormals flushDenormals;
+    reorder();
+    const int substeps = std::max(1, settings.substeps);
+    const float substep = dt / substeps;
+    int iterations = 0;
+    for (int i = 0; i < substeps; i++) {
+        predict(substep);
+        grid.build(pool, predictedX, predictedY, radius, settings.domainWidth, settings.domainHeight);
+        if (settings.densityProjection) {
+            projectDensity();
+        }
+        iterations += solveDensity();
+        updateVelocities(substep);
+    }
+    if (!settings.densityProjection) {
+        pressureStats = {};
+    }
+    stats.substeps = substeps;
+    stats.iterations = static_cast<float>(iterations) / substeps;
+    stats.substepSeconds = substep;
+    stats.simulatedSeconds = substep * substeps;
+    stats.maxSpeed = maxSpeed();
+    stats.gatherCacheLines = grid.gatherCacheLines;
+}
+
+// Every other per-particle array is rebuilt each substep, so only positions and velocities are carried across.
+void PbfSolver::reorder() {
+    if (settings.reorderInterval <= 0 || ++stepsSinceReorder < settings.reorderInterval) {
+        return;
+    }
+    stepsSinceReorder = 0;
+    sorter.sort(pool, particles, radius, settings.domainWidth, settings.domainHeight);
+}
+
+void PbfSolver::predict(float dt) {
+    TRACE_ZONE("pbfPredict");
+    const float minX = wallMargin * spacing;
+    const float minY = wallMargin * spacing;
+    const float maxX = settings.domainWidth - wallMargin * spacing;
+    const float maxY = settings.domainHeight - wallMargin * spacing;
+    parallelForParticles(pool, particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            particles.velocityY[i] += dt * settings.gravity;
+            predictedX[i] = std::clamp(particles.positionX[i] + dt * particles.velocityX[i], minX, maxX);
+            predictedY[i] = std::clamp(particles.positionY[i] + dt * particles.velocityY[i], minY, maxY);
+        }
+    });
+}
+
+// Splats the predicted positions onto the projection grid with tent weights, solves for the potential
+// whose gradient, taken as a displacement, brings every cell back to its rest count, and moves the
+// particles by it. Walls mirror the particles next to them, so the cells along them read full at rest.
+void PbfSolver::projectDensity() {
+    TRACE_ZONE("pbfProjectDensity");
+    const int width = potential.width;
+    const int height = potential.height;
+    const float inverseCell = 1.0f / cell;
+    const float inverseRestWeight = spacing * spacing * inverseCell * inverseCell;
+    auto tent = [&](float offset) {
+        return std::max(0.0f, 1.0f - std::abs(offset) * inverseCell);
+    };
+
+    grid.gather(pool, predictedX, sortedX);
+    grid.gather(pool, predictedY, sortedY);
+    parallelForTiles(pool, width, height, [&](const Tile& tile) {
+        const float* neighborX = sortedX.data();
+        const float* neighborY = sortedY.data();
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float centerY = (y - 0.5f) * cell;
+            float* e = excess.row(y);
+            unsigned char* mask = cells.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                const float centerX = (x - 0.5f) * cell;
+                float weight = 0.0f;
+                grid.forEachCandidateRange(centerX, centerY, [&](int rangeBegin, int rangeEnd) {
+                    for (int k = rangeBegin; k < rangeEnd; k++) {
+                        float wx = tent(centerX - neighborX[k]);
+                        wx += x == 1 ? tent(centerX + neighborX[k]) : 0.0f;
+                        wx += x == width ? tent(2.0f * settings.domainWidth - neighborX[k] - centerX) : 0.0f;
+                        float wy = tent(centerY - neighborY[k]);
+                        wy += y == 1 ? tent(centerY + neighborY[k]) : 0.0f;
+                        wy += y == height ? tent(2.0f * settings.domainHeight - neighborY[k] - centerY) : 0.0f;
+                        weight += wx * wy;
+                    }
+                });
+                const float fill = weight * inverseRestWeight;
+                e[x] = fill - 1.0f;
+                mask[x] = fill >= airFill ? 0 : airCell;
+            }
+        }
+    });
+    // Next to air a cell's tent reaches past the surface, so it only reads its excess; inside the fluid
+    // the projection also closes gaps, or noise would keep spreading the fluid out.
+    parallelForTiles(pool, width, height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const unsigned char* mask = cells.row(y);
+            const unsigned char* maskDown = cells.row(y - 1);
+            const unsigned char* maskUp = cells.row(y + 1);
+            float* e = excess.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                if (((mask[x - 1] | mask[x + 1] | maskDown[x] | maskUp[x]) & airCell) != 0) {
+                    e[x] = std::max(0.0f, e[x]);
+                }
+            }
+        }
+    });
+    cellsRevision++;
+    pressureStats = pcgSolver.solve(potential, excess, cells, cellsRevision, settings.pcg);
+
+    // The displacement is minus the potential gradient on the faces, interpolated bilinearly like a MAC
+    // velocity; faces on the walls have none.
+    const float minX = wallMargin * spacing;
+    const float minY = wallMargin * spacing;
+    const float maxX = settings.domainWidth - wallMargin * spacing;
+    const float maxY = settings.domainHeight - wallMargin * spacing;
+    auto faceX = [&](int face, int row) {
+        row = std::clamp(row, 1, height);
+        return face <= 0 || face >= width ? 0.0f : potential(face + 1, row) - potential(face, row);
+    };
+    auto faceY = [&](int column, int face) {
+        column = std::clamp(column, 1, width);
+        return face <= 0 || face >= height ? 0.0f : potential(column, face + 1) - potential(column, face);
+    };
+    parallelForParticles(pool, particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const float fx = predictedX[i] * inverseCell;
+            const float fy = predictedY[i] * inverseCell;
+            // Faces along x sit at whole cells in x and cell centers in y, and the other way around.
+            const int faceColumn = std::clamp(static_cast<int>(fx), 0, width - 1);
+            const float ax = std::clamp(fx - faceColumn, 0.0f, 1.0f);
+            const int centerRow = static_cast<int>(std::floor(fy - 0.5f));
+            const float by = std::clamp(fy - 0.5f - centerRow, 0.0f, 1.0f);
+            const float gradientX = (1.0f - by) * ((1.0f - ax) * faceX(faceColumn, centerRow + 1) + ax * faceX(faceColumn + 1, centerRow + 1))
+                + by * ((1.0f - ax) * faceX(faceColumn, centerRow + 2) + ax * faceX(faceColumn + 1, centerRow + 2));
+            const int faceRow = std::clamp(static_cast<int>(fy), 0, height - 1);
+            const float ay = std::clamp(fy - faceRow, 0.0f, 1.0f);
+            const int centerColumn = static_cast<int>(std::floor(fx - 0.5f));
+            const float bx = std::clamp(fx - 0.5f - centerColumn, 0.0f, 1.0f);
+            const float gradientY = (1.0f - bx) * ((1.0f - ay) * faceY(centerColumn + 1, faceRow) + ay * faceY(centerColumn + 1, faceRow + 1))
+                + bx * ((1.0f - ay) * faceY(centerColumn + 2, faceRow) + ay * faceY(centerColumn + 2, faceRow + 1));
+            predictedX[i] = std::clamp(predictedX[i] - gradientX * cell, minX, maxX);
+            predictedY[i] = std::clamp(predictedY[i] - gradientY * cell, minY, maxY);
+        }
+    });
+}
+
+int PbfSolver::solveDensity() {
+    TRACE_ZONE("pbfSolveDensity");
+    const int count = particles.size();
+    const float h = radius;
+    const float h2 = h * h;
+    const float densityScale = mass * poly6Scale(h) / settings.restDensity;
+    // Constraint gradient with respect to a neighbor, per unit (h - r)^2 / r and unit offset.
+    const float gradientScale = mass / settings.restDensity * spikyGradientScale(h);
+    const float relaxation = settings.relaxation * restGradientNorm;
+    const float tensileD2 = h2 - tensileDistance * tensileDistance * h2;
+    const float inverseTensileD2 = 1.0f / tensileD2;
+    // Scaled like a lambda, so the strength reads as the constraint violation the repulsion amounts to.
+    const float tensileStrength = settings.tensileStrength / restGradientNorm;
+    const float minX = wallMargin * spacing;
+    const float minY = wallMargin * spacing;
+    const float maxX = settings.domainWidth - wallMargin * spacing;
+    const float maxY = settings.domainHeight - wallMargin * spacing;
+
+    const int minIterations = std::max(0, settings.iterations);
+    const int maxIterations = std::max(minIterations, settings.maxIterations);
+    ConstraintSums sums;
+    int iteration = 0;
+    for (;; iteration++) {
+        // Neighbors are read from cell-ordered copies, so every particle sees the positions and lambdas
+        // of the previous pass and each pass only writes its own particles.
+        grid.gather(pool, predictedX, sortedX);
+        grid.gather(pool, predictedY, sortedY);
+
+        sums = parallelReduceParticles(pool, count, ConstraintSums(), [&](int begin, int end) {
+            ConstraintSums partial;
+            const float* neighborX = sortedX.data();
+            const float* neighborY = sortedY.data();
+            for (int i = begin; i < end; i++) {
+                const float x = predictedX[i];
+                const float y = predictedY[i];
+                float densitySum = 0.0f;
+                float gradientX = 0.0f;
+                float gradientY = 0.0f;
+                float gradientNorm = 0.0f;
+                int neighbors = 0;
+                grid.forEachCandidateRange(x, y, [&](int rangeBegin, int rangeEnd) {
+                    for (int k = rangeBegin; k < rangeEnd; k++) {
+                        float dx = x - neighborX[k];
+                        float dy = y - neighborY[k];
+                        float distanceSquared = dx * dx + dy * dy;
+                        if (distanceSquared >= h2) {
+                            continue;
+                        }
+                        float d = h2 - distanceSquared;
+                        densitySum += d * d * d;
+                        neighbors++;
+                        if (distanceSquared <= 0.0f) {
+                            continue;
+                        }
+                        float r = std::sqrt(distanceSquared);
+                        float gradient = gradientScale * (h - r) * (h - r) / r;
+                        gradientX += gradient * dx;
+                        gradientY += gradient * dy;
+                        gradientNorm += gradient * gradient * distanceSquared;
+                    }
+                });
+                // Only compression is corrected; the tensile term below handles the free surface.
+                float constraint = std::max(0.0f, densityScale * densitySum - 1.0f);
+                gradientNorm += gradientX * gradientX + gradientY * gradientY;
+                lambda[i] = -constraint / (gradientNorm + relaxation);
+                partial.neighbors += neighbors - 1;
+                partial.compression += constraint;
+            }
+            return partial;
+        }, addSums);
+        // The constraints were just measured at the positions the last correction left, so a converged
+        // solve stops before correcting again and reports the error it leaves.
+        if (iteration >= maxIterations || (iteration >= minIterations && sums.compression <= settings.densityTolerance * count)) {
+            break;
+        }
+
+        grid.gather(pool, lambda, sortedLambda);
+        parallelForParticles(pool, count, [&](int begin, int end) {
+            const float* neighborX = sortedX.data();
+            const float* neighborY = sortedY.data();
+            const float* neighborLambda = sortedLambda.data();
+            for (int i = begin; i < end; i++) {
+                const float x = predictedX[i];
+                const float y = predictedY[i];
+                const float ownLambda = lambda[i];
+                float deltaX = 0.0f;
+                float deltaY = 0.0f;
+                grid.forEachCandidateRange(x, y, [&](int rangeBegin, int rangeEnd) {
+                    for (int k = rangeBegin; k < rangeEnd; k++) {
+                        float dx = x - neighborX[k];
+                        float dy = y - neighborY[k];
+                        float distanceSquared = dx * dx + dy * dy;
+                        if (distanceSquared >= h2 || distanceSquared <= 0.0f) {
+                            continue;
+                        }
+                        float r = std::sqrt(distanceSquared);
+                        // Artificial pressure -k (W(r) / W(0.2h))^4 from the poly6 kernel.
+                        float tensile = (h2 - distanceSquared) * inverseTensileD2;
+                        float tensile3 = tensile * tensile * tensile;
+                        float tensile6 = tensile3 * tensile3;
+                        float correction = ownLambda + neighborLambda[k] - tensileStrength * tensile6 * tensile6;
+                        // Negative lambdas push i away from its neighbors.
+                        float push = -correction * gradientScale * (h - r) * (h - r) / r;
+                        deltaX += push * dx;
+                        deltaY += push * dy;
+                    }
+                });
+                predictedX[i] = std::clamp(x + deltaX, minX, maxX);
+                predictedY[i] = std::clamp(y + deltaY, minY, maxY);
+            }
+        });
+    }
+    stats.averageNeighbors = static_cast<float>(sums.neighbors / count);
+    stats.densityError = static_cast<float>(sums.compression / count);
+    return iteration;
+}
+
+void PbfSolver::updateVelocities(float dt) {
+    TRACE_ZONE("pbfUpdateVelocities");
+    const int count = particles.size();
+    const float inverseDt = 1.0f / dt;
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            particles.velocityX[i] = (predictedX[i] - particles.positionX[i]) * inverseDt;
+            particles.velocityY[i] = (predictedY[i] - particles.positionY[i]) * inverseDt;
+        }
+    });
+    std::swap(particles.positionX, predictedX);
+    std::swap(particles.positionY, predictedY);
+
+    grid.gather(pool, particles.positionX, sortedX);
+    grid.gather(pool, particles.positionY, sortedY);
+    grid.gather(pool, particles.velocityX, sortedVelocityX);
+    grid.gather(pool, particles.velocityY, sortedVelocityY);
+
+    const float h = radius;
+    const float h2 = h * h;
+    // Volume-weighted kernels, so neighborhood sums are averages independent of resolution.
+    const float volume = mass / settings.restDensity;
+    const float smoothingScale = settings.xsphViscosity * volume * poly6Scale(h);
+    const float gradientScale = volume * spikyGradientScale(h);
+
+    // Vorticity, from the velocities before smoothing, and XSPH smoothing in one neighbor pass.
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        const float* neighborX = sortedX.data();
+        const float* neighborY = sortedY.data();
+        for (int i = begin; i < end; i++) {
+            const float x = particles.positionX[i];
+            const float y = particles.positionY[i];
+            const float vx = particles.velocityX[i];
+            const float vy = particles.velocityY[i];
+            float curl = 0.0f;
+            float smoothX = 0.0f;
+            float smoothY = 0.0f;
+            grid.forEachCandidateRange(x, y, [&](int rangeBegin, int rangeEnd) {
+                for (int k = rangeBegin; k < rangeEnd; k++) {
+                    float dx = x - neighborX[k];
+                    float dy = y - neighborY[k];
+                    float distanceSquared = dx * dx + dy * dy;
+                    if (distanceSquared >= h2 || distanceSquared <= 0.0f) {
+                        continue;
+                    }
+                    float relativeX = sortedVelocityX[k] - vx;
+                    float relativeY = sortedVelocityY[k] - vy;
+                    float d = h2 - distanceSquared;
+                    float weight = d * d * d;
+                    smoothX += relativeX * weight;
+                    smoothY += relativeY * weight;
+                    // Relative velocity crossed with the kernel gradient with respect to the neighbor.
+                    float r = std::sqrt(distanceSquared);
+                    float gradient = (h - r) * (h - r) / r;
+                    curl += gradient * (relativeX * dy - relativeY * dx);
+                }
+            });
+            vorticity[i] = gradientScale * curl;
+            particles.velocityX[i] = vx + smoothingScale * smoothX;
+            particles.velocityY[i] = vy + smoothingScale * smoothY;
+        }
+    });
+
+    if (settings.vorticityConfinement <= 0.0f) {
+        return;
+    }
+    // Confinement pushes particles around vortex centers, along the gradient of the vorticity magnitude.
+    grid.gather(pool, vorticity, sortedVorticity);
+    const float confinement = settings.vorticityConfinement * dt;
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        const float* neighborX = sortedX.data();
+        const float* neighborY = sortedY.data();
+        for (int i = begin; i < end; i++) {
+            const float x = particles.positionX[i];
+            const float y = particles.positionY[i];
+            const float ownMagnitude = std::abs(vorticity[i]);
+            float towardX = 0.0f;
+            float towardY = 0.0f;
+            grid.forEachCandidateRange(x, y, [&](int rangeBegin, int rangeEnd) {
+                for (int k = rangeBegin; k < rangeEnd; k++) {
+                    float dx = x - neighborX[k];
+                    float dy = y - neighborY[k];
+                    float distanceSquared = dx * dx + dy * dy;
+                    if (distanceSquared >= h2 || distanceSquared <= 0.0f) {
+                        continue;
+                    }
+                    float r = std::sqrt(distanceSquared);
+                    float gradient = (h - r) * (h - r) / r;
+                    float difference = std::abs(sortedVorticity[k]) - ownMagnitude;
+                    towardX -= difference * gradient * dx;
+                    towardY -= difference * gradient * dy;
+                }
+            });
+            float length = std::sqrt(towardX * towardX + towardY * towardY);
+            if (length <= 0.0f) {
+                continue;
+            }
+            float scale = confinement * vorticity[i] / length;
+            particles.velocityX[i] += scale * towardY;
+            particles.velocityY[i] -= scale * towardX;
+        }
+    });
+}
+
+float PbfSolver::maxSpeed() {
+    float maxSpeedSquared = parallelReduceParticles(pool, particles.size(), 0.0f, [&](int begin, int end) {
+        float result = 0.0f;
+        for (int i = begin; i < end; i++) {
+            float vx = particles.velocityX[i];
+            float vy = particles.velocityY[i];
+            result = std::max(result, vx * vx + vy * vy);
+        }
+        return result;
+    }, maxOf);
+    return std::sqrt(maxSpeedSquared);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "frame_archive.h"
+#include "grid.h"
+#include "neighbor_grid.h"
+#include "particle_sort.h"
+#include "particles.h"
+#include "pcg.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+
+struct PbfSettings {
+    // The iterations needed grow with the depth of the fluid in particles, so without densityProjection the
+    // cost of a step grows about as the count to the 1.5 power, as for SPH.
+    int particleCount = 1000;
+    // Same dam break layout as SphSettings.
+    float domainWidth = 1.0f;
+    float domainHeight = 0.5f;
+    float damWidth = 0.4f;
+    float damHeight = 0.8f;
+
+    float restDensity = 1000.0f;
+    float gravity = -9.81f;
+    // Substeps per step, whatever the particle count.
+    int substeps = 4;
+    // Jacobi iterations of the density constraints per substep: at least iterations, then more until the
+    // mean compression is within densityTolerance, up to maxIterations. Each iteration only carries a
+    // correction a neighbor further, so deeper fluid in particles needs more of them.
+    int iterations = 4;
+    int maxIterations = 100;
+    float densityTolerance = 0.01f;
+    // Opt-in projection of the compression on a grid of smoothing radius cells before the iterations. One
+    // PCG solve removes it over the whole fluid depth, so the least iterations then suffice at any count,
+    // at the price of making the solver a particle and grid hybrid.
+    bool densityProjection = false;
+    PcgSettings pcg { 100, 1e-2f };
+    // Constraint force mixing, as a fraction of a resting particle's constraint gradient norm. Softens
+    // lambda where the gradient vanishes, such as for particles clamped together into a wall corner,
+    // which would otherwise be flung out at tens of meters per second.
+    float relaxation = 1.0f;
+    // Artificial pressure that keeps particles from clumping at the free surface, as the density error
+    // it would correct between two particles 0.2 smoothing radii apart.
+    float tensileStrength = 0.01f;
+    // Fraction of the neighborhood average velocity difference blended in each substep.
+    float xsphViscosity = 0.02f;
+    // Strength of the force that puts back the rotation lost to damping, in m/s.
+    float vorticityConfinement = 0.0005f;
+    // Steps between Morton reorders of the particle arrays, 0 to never reorder.
+    int reorderInterval = 5;
+};
+
+/*
+ * Position based fluids in 2D. Each substep predicts positions from gravity, bins the predictions
+ * into a NeighborGrid, then runs Jacobi iterations that each solve every density constraint for its
+ * lambda and move the particles by the resulting position corrections, until the compression left is
+ * within tolerance. Velocities come from the change in position, followed by XSPH smoothing and
+ * vorticity confinement. Because incompressibility is solved for rather than pushed by a stiff equation
+ * of state, a fixed few substeps per step suffice; what grows with the depth of the fluid in particles
+ * is the iteration count, unless densityProjection removes the deep compression on a grid first.
+ * Every pass runs over blocks of particles on the thread pool and writes only its own particles.
+ */
+class PbfSolver {
+public:
+    PbfSolver(const PbfSettings& settings, ThreadPool& pool);
+
+    void step(float dt);
+    // Rebuilds the initial dam from the current settings.
+    void reset();
+    // Adds what a restart needs to snapshot. loadState restores it into a solver reset with the same
+    // settings, and returns false, with snapshot.error set, if the snapshot's fields do not match.
+    void saveState(SnapshotWriter& snapshot) const;
+    bool loadState(const Snapshot& snapshot);
+    // Adds the fields archived for offline analysis to frame.
+    void addArchiveFields(ArchiveFrame& frame) const;
+
+    float smoothingRadius() const { return radius; }
+    float particleSpacing() const { return spacing; }
+
+    PbfSettings settings;
+    ParticleSet particles;
+    ParticleStats stats;
+    PressureSolveStats pressureStats;
+
+    ThreadPool& pool;
+
+private:
+    void reorder();
+    void predict(float dt);
+    void projectDensity();
+    // Returns the iterations run.
+    int solveDensity();
+    void updateVelocities(float dt);
+    float maxSpeed();
+
+    NeighborGrid grid;
+    MortonSorter sorter;
+    int stepsSinceReorder = 0;
+    ParticleArray predictedX;
+    ParticleArray predictedY;
+    ParticleArray lambda;
+    ParticleArray vorticity;
+    // Neighbor attributes in cell order. Positions are gathered again whenever they move, since the
+    // grid keeps its binning from the start of the substep.
+    ParticleArray sortedX;
+    ParticleArray sortedY;
+    ParticleArray sortedLambda;
+    ParticleArray sortedVelocityX;
+    ParticleArray sortedVelocityY;
+    ParticleArray sortedVorticity;
+
+    // Grid of densityProjection, on cells of at most a smoothing radius that tile the domain. The
+    // potential persists across substeps as the initial guess of the next solve.
+    float cell = 0.0f;
+    Grid2D potential;
+    Grid2D excess;
+    Mask2D cells;
+    int cellsRevision = 0;
+    PcgSolver pcgSolver;
+
+    float spacing = 0.0f;
+    float radius = 0.0f;
+    float mass = 0.0f;
+    // Sum of squared constraint gradients for a particle in a resting lattice, scaling the relaxation.
+    float restGradientNorm = 0.0f;
+};
@@ -0,0 +1,229 @@
+#include "pcg.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "trace.h"
+
+namespace {
+
+// MIC(0) blending between incomplete Cholesky (0) and fully modified (1), and the safety threshold
+// below which a pivot falls back to the plain diagonal.
+constexpr float micTuning = 0.97f;
+constexpr float micSafety = 0.25f;
+
+}
+
+double PcgSolver::dot(const Grid2D& a, const Grid2D& b) {
+    TRACE_ZONE("dot");
+    return parallelReduceTiles(pool, a.width, a.height, 0.0, [&](const Tile& tile) {
+        double result = 0.0;
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* rowA = a.row(y);
+            const float* rowB = b.row(y);
+            float rowSum = 0.0f;
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                rowSum += rowA[x] * rowB[x];
+            }
+            result += rowSum;
+        }
+        return result;
+    }, [](double left, double right) { return left + right; });
+}
+
+void PcgSolver::applyMatrix(Grid2D& out, const Grid2D& in, const Mask2D& solid) {
+    TRACE_ZONE("applyMatrix");
+    // Solid and air cells (and the ghost ring) of every vector are kept at zero, so the off-diagonal sum
+    // only needs the solid neighbor count on the diagonal to account for them.
+    const int stride = in.stride;
+    parallelForTiles(pool, in.width, in.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* s = in.row(y);
+            const unsigned char* mask = solid.row(y);
+            float* target = out.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                float fluidNeighbors = 4.0f - ((mask[x - 1] & solidCell) + (mask[x + 1] & solidCell)
+                                               + (mask[x - stride] & solidCell) + (mask[x + stride] & solidCell));
+                float value = fluidNeighbors * s[x] - (s[x - 1] + s[x + 1] + s[x - stride] + s[x + stride]);
+                target[x] = mask[x] ? 0.0f : value;
+            }
+        }
+    });
+}
+
+void PcgSolver::buildPreconditioner(const Mask2D& solid) {
+    TRACE_ZONE("buildPreconditioner");
+    const int stride = solid.stride;
+    precon.fill(0.0f);
+    for (int y = 1; y <= solid.height; y++) {
+        const unsigned char* mask = solid.row(y);
+        float* e = precon.row(y);
+        for (int x = 1; x <= solid.width; x++) {
+            if (mask[x]) {
+                continue;
+            }
+            float diagonal = 4.0f - ((mask[x - 1] & solidCell) + (mask[x + 1] & solidCell)
+                                     + (mask[x - stride] & solidCell) + (mask[x + stride] & solidCell));
+            // Off-diagonals are -1 between two fluid cells; the neighbor's precon is already zero when it is not fluid.
+            float left = e[x - 1];
+            float down = e[x - stride];
+            float leftUp = mask[x - 1 + stride] ? 0.0f : 1.0f;
+            float downRight = mask[x + 1 - stride] ? 0.0f : 1.0f;
+            float pivot = diagonal - left * left - down * down
+                - micTuning * (leftUp * left * left + downRight * down * down);
+            if (pivot < micSafety * diagonal) {
+                pivot = diagonal;
+            }
+            e[x] = 1.0f / std::sqrt(pivot);
+        }
+    }
+
+    for (int y = 1; y <= solid.height; y++) {
+        const float* e = precon.row(y);
+        float* c = forwardCoupling.row(y);
+        for (int x = 1; x <= solid.width; x++) {
+            c[x] = e[x - 1] * e[x];
+        }
+    }
+}
+
+void PcgSolver::applyPreconditioner(Grid2D& out, const Grid2D& in) {
+    TRACE_ZONE("applyPreconditioner");
+    const int stride = in.stride;
+
+    // Forward substitution with the lower triangular factor L. The terms from the previous row are
+    // gathered in a vectorizable pass first, leaving a single multiply-add in the serial x recurrence.
+    for (int y = 1; y <= in.height; y++) {
+        const float* r = in.row(y);
+        const float* e = precon.row(y);
+        const float* c = forwardCoupling.row(y);
+        float* q = out.row(y);
+        for (int x = 1; x <= in.width; x++) {
+            q[x] = (r[x] + e[x - stride] * q[x - stride]) * e[x];
+        }
+        for (int x = 1; x <= in.width; x++) {
+            q[x] += c[x] * q[x - 1];
+        }
+    }
+
+    // Backward substitution with L transposed, overwriting q with z in reverse order.
+    for (int y = in.height; y >= 1; y--) {
+        const float* e = precon.row(y);
+        float* z = out.row(y);
+        for (int x = 1; x <= in.width; x++) {
+            z[x] = (z[x] + e[x] * z[x + stride]) * e[x];
+        }
+        for (int x = in.width; x >= 1; x--) {
+            z[x] += e[x] * e[x] * z[x + 1];
+        }
+    }
+}
+
+PressureSolveStats PcgSolver::solve(Grid2D& pressure, const Grid2D& rhs, const Mask2D& solid, int solidRevision, const PcgSettings& settings) {
+    TRACE_ZONE("pcgSolve");
+    PressureSolveStats stats;
+    if (precon.width != pressure.width || precon.height != pressure.height) {
+        for (Grid2D* grid : { &residual, &auxiliary, &search, &precon, &forwardCoupling }) {
+            grid->resize(pressure.width, pressure.height);
+        }
+        preconRevision = -1;
+    }
+    if (preconRevision != solidRevision) {
+        buildPreconditioner(solid);
+        preconRevision = solidRevision;
+    }
+
+    // Keep the warm start only on fluid cells. Without air cells the all-Neumann problem is inconsistent
+    // unless the constant mode is removed from the right hand side.
+    double rhsSum = 0.0;
+    int fluidCells = 0;
+    bool hasAir = false;
+    for (std::size_t i = 0; i < pressure.size(); i++) {
+        if (solid.values[i]) {
+            pressure.values[i] = 0.0f;
+            hasAir |= (solid.values[i] & airCell) != 0;
+        } else {
+            rhsSum += rhs.values[i];
+            fluidCells++;
+        }
+    }
+    float mean = fluidCells > 0 && !hasAir ? static_cast<float>(rhsSum / fluidCells) : 0.0f;
+
+    applyMatrix(auxiliary, pressure, solid);
+    float rhsNorm = 0.0f;
+    float residualNorm = 0.0f;
+    for (int y = 1; y <= pressure.height; y++) {
+        const float* b = rhs.row(y);
+        const float* ap = auxiliary.row(y);
+        const unsigned char* mask = solid.row(y);
+        float* r = residual.row(y);
+        for (int x = 1; x <= pressure.width; x++) {
+            float value = mask[x] ? 0.0f : b[x] - mean;
+            r[x] = mask[x] ? 0.0f : value - ap[x];
+            rhsNorm = std::max(rhsNorm, std::fabs(value));
+            residualNorm = std::max(residualNorm, std::fabs(r[x]));
+        }
+    }
+    if (rhsNorm == 0.0f) {
+        pressure.fill(0.0f);
+        return stats;
+    }
+    float scale = 1.0f / rhsNorm;
+    stats.initialResidual = residualNorm * scale;
+    stats.residual = stats.initialResidual;
+
+    if (stats.residual > settings.tolerance) {
+        applyPreconditioner(auxiliary, residual);
+        search.values = auxiliary.values;
+        double sigma = dot(auxiliary, residual);
+
+        while (stats.iterations < settings.maxIterations) {
+            applyMatrix(auxiliary, search, solid);
+            double curvature = dot(auxiliary, search);
+            if (curvature <= 0.0) {
+                break;
+            }
+            float alpha = static_cast<float>(sigma / curvature);
+
+            residualNorm = parallelReduceTiles(pool, pressure.width, pressure.height, 0.0f, [&](const Tile& tile) {
+                float result = 0.0f;
+                for (int y = tile.yBegin; y < tile.yEnd; y++) {
+                    const float* s = search.row(y);
+                    const float* z = auxiliary.row(y);
+                    float* p = pressure.row(y);
+                    float* r = residual.row(y);
+                    for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                        p[x] += alpha * s[x];
+                        r[x] -= alpha * z[x];
+                        result = std::max(result, std::fabs(r[x]));
+                    }
+                }
+                return result;
+            }, [](float left, float right) { return std::max(left, right); });
+            stats.iterations++;
+            stats.residual = residualNorm * scale;
+            stats.history.push_back(stats.residual);
+            if (stats.residual <= settings.tolerance) {
+                break;
+            }
+
+            applyPreconditioner(auxiliary, residual);
+            double sigmaNext = dot(auxiliary, residual);
+            float beta = static_cast<float>(sigmaNext / sigma);
+            sigma = sigmaNext;
+            parallelForTiles(pool, pressure.width, pressure.height, [&](const Tile& tile) {
+                for (int y = tile.yBegin; y < tile.yEnd; y++) {
+                    const float* z = auxiliary.row(y);
+                    float* s = search.row(y);
+                    for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                        s[x] = z[x] + beta * s[x];
+                    }
+                }
+            });
+        }
+    }
+
+    // Restore mirrored ghost cells so the other solvers can warm start from this pressure.
+    setBoundary(pressure, BoundaryType::Scalar);
+    return stats;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "grid.h"
+#include "poisson.h"
+#include "thread_pool.h"
+
+// Cell flags of the mask PcgSolver takes; any other nonzero value is not an unknown either. Solid cells are
+// walls the fluid cannot flow into (zero pressure gradient), air cells a free surface held at zero pressure.
+constexpr unsigned char solidCell = 1;
+constexpr unsigned char airCell = 2;
+
+struct PcgSettings {
+    int maxIterations = 200;
+    float tolerance = 1e-3f;
+};
+
+/*
+ * Matrix-free conjugate gradient with a modified incomplete Cholesky (MIC(0)) preconditioner for the
+ * pressure equation restricted to fluid cells. The matrix is never stored: its coefficients follow from
+ * the cell mask, where solid neighbors (including the walls in the ghost ring) drop out of the stencil
+ * and air neighbors only keep their diagonal term, since their pressure is fixed at zero.
+ * Only the preconditioner diagonal is stored, and it is rebuilt only when the mask revision changes. All
+ * scratch vectors persist across steps. Matrix products, dot products and vector updates run on the pool;
+ * the triangular solves of the preconditioner are inherently sequential and stay on the calling thread.
+ */
+class PcgSolver {
+public:
+    explicit PcgSolver(ThreadPool& pool) : pool(pool) {}
+
+    // Improves the pressure in place from its current contents. Solid and air cells are left at zero.
+    PressureSolveStats solve(Grid2D& pressure, const Grid2D& rhs, const Mask2D& solid, int solidRevision, const PcgSettings& settings);
+
+private:
+    void buildPreconditioner(const Mask2D& solid);
+    void applyPreconditioner(Grid2D& out, const Grid2D& in);
+    void applyMatrix(Grid2D& out, const Grid2D& in, const Mask2D& solid);
+    double dot(const Grid2D& a, const Grid2D& b);
+
+    ThreadPool& pool;
+
+    Grid2D residual;
+    Grid2D auxiliary;
+    Grid2D search;
+    Grid2D precon;
+    // precon(x - 1, y) * precon(x, y), the only coefficient left in the serial part of the forward solve.
+    Grid2D forwardCoupling;
+    int preconRevision = -1;
+};
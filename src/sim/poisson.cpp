@@ -0,0 +1,83 @@
+#include "poisson.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "trace.h"
+
+namespace {
+
+float maxOf(float a, float b) {
+    return std::max(a, b);
+}
+
+}
+
+float maxAbs(ThreadPool& pool, const Grid2D& grid) {
+    TRACE_ZONE("maxAbs");
+    return parallelReduceTiles(pool, grid.width, grid.height, 0.0f, [&](const Tile& tile) {
+        float result = 0.0f;
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* row = grid.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                result = std::max(result, std::fabs(row[x]));
+            }
+        }
+        return result;
+    }, maxOf);
+}
+
+float computeResidual(ThreadPool& pool, const Grid2D& pressure, const Grid2D& rhs, Grid2D* residual) {
+    TRACE_ZONE("computeResidual");
+    const int stride = pressure.stride;
+    return parallelReduceTiles(pool, pressure.width, pressure.height, 0.0f, [&](const Tile& tile) {
+        float result = 0.0f;
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* p = pressure.row(y);
+            const float* b = rhs.row(y);
+            float* r = residual ? residual->row(y) : nullptr;
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                float value = b[x] - (4.0f * p[x] - p[x - 1] - p[x + 1] - p[x - stride] - p[x + stride]);
+                if (r) {
+                    r[x] = value;
+                }
+                result = std::max(result, std::fabs(value));
+            }
+        }
+        return result;
+    }, maxOf);
+}
+
+void jacobiSweep(ThreadPool& pool, Grid2D& next, const Grid2D& pressure, const Grid2D& rhs) {
+    TRACE_ZONE("jacobiSweep");
+    const int stride = pressure.stride;
+    parallelForTiles(pool, pressure.width, pressure.height, [&](const Tile& tile) {
+        for (int y = tile.yBegin; y < tile.yEnd; y++) {
+            const float* p = pressure.row(y);
+            const float* b = rhs.row(y);
+            float* target = next.row(y);
+            for (int x = tile.xBegin; x < tile.xEnd; x++) {
+                target[x] = 0.25f * (b[x] + p[x - 1] + p[x + 1] + p[x - stride] + p[x + stride]);
+            }
+        }
+    });
+    setBoundary(next, BoundaryType::Scalar);
+}
+
+void redBlackGaussSeidel(ThreadPool& pool, Grid2D& pressure, const Grid2D& rhs) {
+    TRACE_ZONE("redBlackGaussSeidel");
+    const int stride = pressure.stride;
+    for (int color = 0; color < 2; color++) {
+        parallelForTiles(pool, pressure.width, pressure.height, [&](const Tile& tile) {
+            for (int y = tile.yBegin; y < tile.yEnd; y++) {
+                float* p = pressure.row(y);
+                const float* b = rhs.row(y);
+                int xBegin = tile.xBegin + ((tile.xBegin + y + color) & 1);
+                for (int x = xBegin; x < tile.xEnd; x += 2) {
+                    p[x] = 0.25f * (b[x] + p[x - 1] + p[x + 1] + p[x - stride] + p[x + stride]);
+                }
+            }
+        });
+        setBoundary(pressure, BoundaryType::Scalar);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "grid.h"
+#include "thread_pool.h"
+
+/*
+ * Kernels for the pressure Poisson equation 4 p(x, y) - p(x - 1, y) - p(x + 1, y) - p(x, y - 1) - p(x, y + 1) = rhs
+ * on a padded grid with unit cell spacing and Neumann walls (ghost cells mirror their interior neighbor).
+ */
+
+enum class PressureSolverType {
+    Jacobi,
+    Multigrid,
+    ConjugateGradient
+};
+
+// Display names indexed by PressureSolverType.
+inline constexpr const char* pressureSolverNames[] = { "Jacobi", "Multigrid", "PCG (MIC(0))" };
+
+struct PressureSolveStats {
+    int iterations = 0;
+    // Max-norm residuals relative to the max-norm of the right hand side, before and after the solve.
+    float initialResidual = 0.0f;
+    float residual = 0.0f;
+    // Relative residual after each iteration, for plotting convergence.
+    std::vector<float> history;
+};
+
+float maxAbs(ThreadPool& pool, const Grid2D& grid);
+
+// Writes rhs - A p into residual (when given) and returns the max-norm of the residual.
+float computeResidual(ThreadPool& pool, const Grid2D& pressure, const Grid2D& rhs, Grid2D* residual);
+
+void jacobiSweep(ThreadPool& pool, Grid2D& next, const Grid2D& pressure, const Grid2D& rhs);
+
+// One red-black Gauss-Seidel sweep: all cells with even x + y, then all cells with odd x + y. Cells of
+// one color only read cells of the other, so each half sweep runs its tiles in parallel.
+void redBlackGaussSeidel(ThreadPool& pool, Grid2D& pressure, const Grid2D& rhs);
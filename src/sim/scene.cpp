@@ -0,0 +1,13 @@
+#include "scene.h"
+
+void setupScene(FluidSolver& solver, SceneType scene) {
+    float width = static_cast<float>(solver.width());
+    float height = static_cast<float>(solver.height());
+    solver.sources.clear();
+    solver.clearObstacles();
+    solver.sources.push_back({ width * 0.5f, height * 0.1f, width * 0.03f, 4.0f, 0.0f, 200.0f });
+
+    if (scene == SceneType::Obstacle) {
+        solver.addObstacle(width * 0.5f, height * 0.45f, width * 0.08f);
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "fluid_solver.h"
+
+enum class SceneType {
+    // Rising plume fed by a single source near the bottom of the domain.
+    Plume,
+    // The same plume deflected by a disk obstacle, which needs the PCG pressure solver to respect it.
+    Obstacle
+};
+
+// Display names indexed by SceneType.
+inline constexpr const char* sceneNames[] = { "Plume", "Obstacle" };
+
+// Replaces the solver's sources and obstacles with the given scene. Shared by the windowed and headless runners.
+void setupScene(FluidSolver& solver, SceneType scene);
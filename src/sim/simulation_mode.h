@@ -0,0 +1,20 @@
+#pragma once
+
+// Which engine the runners step.
+enum class SimulationMode {
+    // Eulerian stable fluids on a grid.
+    Grid,
+    // Weakly compressible SPH particles.
+    Sph,
+    // Position based fluid particles.
+    Pbf,
+    // FLIP/PIC/APIC particles with a pressure grid.
+    Flip,
+    // D2Q9 lattice Boltzmann wind tunnel.
+    Lbm,
+    // Eulerian stable fluids on a bricked 3D grid, shown as a slice or projection.
+    Grid3D
+};
+
+// Display names indexed by SimulationMode.
+inline constexpr const char* simulationModeNames[] = { "Stable fluids", "SPH", "PBF", "FLIP", "Lattice Boltzmann", "Stable fluids 3D" };
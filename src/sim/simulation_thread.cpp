@@ -0,0 +1,241 @@
+#include "simulation_thread.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "float_mode.h"
+#include "trace.h"
+
+double steadySeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SimulationThread::SimulationThread(const SimulationControls& controls, ThreadPool& pool, SceneType scene)
+    : solver(controls.settings, pool), sph(controls.sph, pool), pbf(controls.pbf, pool), flip(controls.flip, pool), lbm(controls.lbm, pool),
+      grid3d(controls.grid3d, pool), volumeDisplay(controls.volumeDisplay), mode(controls.mode) {
+    setupScene(solver, scene);
+    solver.savePreviousState();
+    publish(0.0);
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+SimulationThread::~SimulationThread() {
+    running.store(false);
+    thread.join();
+}
+
+void SimulationThread::setControls(const SimulationControls& controls) {
+    latestControls.writeBuffer() = controls;
+    latestControls.publish();
+}
+
+void SimulationThread::reset(SceneType scene) {
+    resetScene.store(scene, std::memory_order_relaxed);
+    resetRequests.fetch_add(1, std::memory_order_release);
+}
+
+const SimulationFrame& SimulationThread::latestFrame() {
+    frames.update();
+    return frames.readBuffer();
+}
+
+// Returns true when a reset or new controls changed what the published frame shows without a step, which
+// needs a new frame while paused.
+bool SimulationThread::applyCommands() {
+    // Read the reset counter first: seeing a request also makes the controls published before it visible,
+    // so the reset below always runs with them.
+    const std::uint64_t requestedResets = resetRequests.load(std::memory_order_acquire);
+    bool viewChanged = false;
+    if (latestControls.update()) {
+        SimulationControls latest = latestControls.readBuffer();
+        // The grid size cannot change while running.
+        latest.settings.width = solver.settings.width;
+        latest.settings.height = solver.settings.height;
+        solver.settings = latest.settings;
+        sph.settings = latest.sph;
+        pbf.settings = latest.pbf;
+        flip.settings = latest.flip;
+        lbm.settings = latest.lbm;
+        grid3d.settings = latest.grid3d;
+        // Cutting a new view of the volume is cheap, so any edit in 3D mode refreshes it.
+        viewChanged = latest.mode == SimulationMode::Grid3D || latest.mode != mode;
+        volumeDisplay = latest.volumeDisplay;
+        mode = latest.mode;
+        timestep.stepHz = latest.stepHz;
+        timestep.maxSubsteps = latest.maxSubsteps;
+        paused = latest.paused;
+        archiveEvery = std::max(1, latest.archiveEvery);
+        if (latest.recordArchive && !archive.isOpen() && !archive.open(viewerArchivePath)) {
+            std::cerr << "Failed to create archive " << viewerArchivePath << "." << std::endl;
+        } else if (!latest.recordArchive && archive.isOpen() && !archive.close()) {
+            std::cerr << "Failed to write archive " << viewerArchivePath << "." << std::endl;
+        }
+    }
+    if (requestedResets != resetsApplied) {
+        resetsApplied = requestedResets;
+        solver.reset();
+        setupScene(solver, resetScene.load(std::memory_order_relaxed));
+        solver.savePreviousState();
+        sph.reset();
+        pbf.reset();
+        flip.reset();
+        lbm.reset();
+        grid3d.reset();
+        timestep.reset();
+        stepCount = 0;
+        viewChanged = true;
+    }
+    return viewChanged;
+}
+
+void SimulationThread::publish(double solveSeconds) {
+    TRACE_ZONE("publish");
+    SimulationFrame& frame = frames.writeBuffer();
+    frame.mode = mode;
+    if (mode == SimulationMode::Grid) {
+        frame.density = solver.density;
+        frame.previousDensity = solver.previousDensity;
+        frame.velocityX = solver.velocityX;
+        frame.velocityY = solver.velocityY;
+        frame.pressure = solver.pressure;
+        frame.pressureStats = solver.pressureStats;
+        frame.phaseTimes = solver.phaseTimes;
+        frame.substepStats = solver.substepStats;
+        frame.hasObstacles = solver.hasObstacles;
+    } else if (mode == SimulationMode::Sph) {
+        frame.particleX = sph.particles.positionX;
+        frame.particleY = sph.particles.positionY;
+        frame.particleStats = sph.stats;
+        frame.domainWidth = sph.settings.domainWidth;
+        frame.domainHeight = sph.settings.domainHeight;
+        frame.particleSpacing = sph.particleSpacing();
+    } else if (mode == SimulationMode::Pbf) {
+        frame.particleX = pbf.particles.positionX;
+        frame.particleY = pbf.particles.positionY;
+        frame.particleStats = pbf.stats;
+        frame.pressureStats = pbf.pressureStats;
+        frame.domainWidth = pbf.settings.domainWidth;
+        frame.domainHeight = pbf.settings.domainHeight;
+        frame.particleSpacing = pbf.particleSpacing();
+    } else if (mode == SimulationMode::Lbm) {
+        frame.density = lbm.density;
+        frame.velocityX = lbm.velocityX;
+        frame.velocityY = lbm.velocityY;
+        frame.pressure = lbm.pressure;
+        frame.lbmStats = lbm.stats;
+    } else if (mode == SimulationMode::Grid3D) {
+        extractVolumeView(grid3d.pool, grid3d, volumeDisplay, frame.density, frame.velocityX, frame.velocityY, frame.pressure);
+        frame.pressureStats = grid3d.pressureStats;
+        frame.phaseTimes = grid3d.phaseTimes;
+        frame.substepStats = grid3d.substepStats;
+        frame.volumeWidth = grid3d.width();
+        frame.volumeHeight = grid3d.height();
+        frame.volumeDepth = grid3d.depth();
+        frame.activeBricks = grid3d.activeBricks();
+        frame.totalBricks = grid3d.density.totalBricks();
+    } else {
+        frame.particleX = flip.particles.positionX;
+        frame.particleY = flip.particles.positionY;
+        frame.particleStats = flip.stats;
+        frame.pressureStats = flip.pressureStats;
+        frame.domainWidth = flip.settings.domainWidth;
+        frame.domainHeight = flip.settings.domainHeight;
+        frame.particleSpacing = flip.particleSpacing();
+    }
+    frame.stepsLastUpdate = timestep.getLastSteps();
+    frame.stepCount = stepCount;
+    frame.stepSeconds = timestep.stepSeconds();
+    frame.solveSeconds = solveSeconds;
+    frame.droppedSeconds = timestep.getDroppedSeconds();
+    frame.archiving = archive.isOpen();
+    frame.archiveStats = archive.stats();
+    frame.publishTime = steadySeconds();
+    frames.publish();
+}
+
+// Frames the archive has no buffer for yet are dropped, so recording never holds up the simulation; the
+// panel shows how many.
+void SimulationThread::archiveFrame() {
+    TRACE_ZONE("archiveFrame");
+    ArchiveFrame* frame = archive.beginFrame(stepCount, false);
+    if (frame == nullptr) {
+        return;
+    }
+    if (mode == SimulationMode::Grid) {
+        solver.addArchiveFields(*frame);
+    } else if (mode == SimulationMode::Sph) {
+        sph.addArchiveFields(*frame);
+    } else if (mode == SimulationMode::Pbf) {
+        pbf.addArchiveFields(*frame);
+    } else if (mode == SimulationMode::Lbm) {
+        lbm.addArchiveFields(*frame);
+    } else if (mode == SimulationMode::Grid3D) {
+        grid3d.addArchiveFields(*frame);
+    } else {
+        flip.addArchiveFields(*frame);
+    }
+    archive.submit(frame);
+}
+
+void SimulationThread::run() {
+    ScopedFlushDenormals flushDenormals;
+    setTraceThreadName("simulation");
+    double previousTime = steadySeconds();
+
+    while (running.load(std::memory_order_relaxed)) {
+        if (applyCommands() && paused) {
+            publish(0.0);
+        }
+
+        double now = steadySeconds();
+        double elapsed = now - previousTime;
+        previousTime = now;
+        int steps = paused ? 0 : timestep.advance(elapsed);
+
+        if (steps == 0) {
+            // Sleep until the next step is due instead of spinning; commands are picked up on wake.
+            double wait = paused ? 0.005 : std::max(0.0, (1.0 - timestep.alpha()) * timestep.stepSeconds());
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait, 0.005)));
+            continue;
+        }
+
+        TRACE_ZONE("stepBatch");
+        double solveStart = steadySeconds();
+        const float dt = static_cast<float>(timestep.stepSeconds());
+        if (mode == SimulationMode::Lbm) {
+            // The lattice has no physical time step, so a batch advances it by one update however many steps
+            // are due; catching up on all of them would only fall further behind.
+            lbm.step();
+            steps = 1;
+        } else {
+            for (int i = 0; i < steps; i++) {
+                if (mode == SimulationMode::Sph) {
+                    sph.step(dt);
+                    continue;
+                }
+                if (mode == SimulationMode::Pbf) {
+                    pbf.step(dt);
+                    continue;
+                }
+                if (mode == SimulationMode::Flip) {
+                    flip.step(dt);
+                    continue;
+                }
+                if (mode == SimulationMode::Grid3D) {
+                    grid3d.step(dt);
+                    continue;
+                }
+                if (i == steps - 1) {
+                    solver.savePreviousState();
+                }
+                solver.step(dt);
+            }
+        }
+        stepCount += steps;
+        if (archive.isOpen() && stepCount / archiveEvery != (stepCount - steps) / archiveEvery) {
+            archiveFrame();
+        }
+        publish((steadySeconds() - solveStart) / steps);
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "fixed_timestep.h"
+#include "flip_solver.h"
+#include "fluid_solver.h"
+#include "fluid_solver_3d.h"
+#include "frame_archive.h"
+#include "lbm_solver.h"
+#include "pbf_solver.h"
+#include "scene.h"
+#include "simulation_mode.h"
+#include "sph_solver.h"
+#include "thread_pool.h"
+#include "triple_buffer.h"
+
+// Where the viewer archives frames while recording.
+inline constexpr const char* viewerArchivePath = "fluids_frames.fla";
+
+// Everything the UI can change while the simulation runs. The grid size is fixed when the thread is created.
+struct SimulationControls {
+    SimulationMode mode = SimulationMode::Grid;
+    FluidSettings settings;
+    // The particle count and domain take effect on the next reset.
+    SphSettings sph;
+    PbfSettings pbf;
+    FlipSettings flip;
+    // The lattice size and obstacle take effect on the next reset.
+    LbmSettings lbm;
+    // The volume size takes effect on the next reset.
+    FluidSettings3D grid3d;
+    VolumeDisplay volumeDisplay;
+    double stepHz = 60.0;
+    int maxSubsteps = 4;
+    bool paused = false;
+    // Appends the active solver's fields to viewerArchivePath every archiveEvery steps.
+    bool recordArchive = false;
+    int archiveEvery = 10;
+};
+
+// Snapshot of the active solver published after each batch of steps. Grid fields are only
+// refreshed in grid and lattice modes and particle fields only in particle modes. In 3D mode the
+// grid fields hold the selected view of the volume.
+struct SimulationFrame {
+    SimulationMode mode = SimulationMode::Grid;
+    Grid2D density;
+    // Density before the latest step, for interpolating between the last two states.
+    Grid2D previousDensity;
+    Grid2D velocityX;
+    Grid2D velocityY;
+    Grid2D pressure;
+    PressureSolveStats pressureStats;
+    // Phase times of the latest step.
+    SolverPhaseTimes phaseTimes;
+    // Substeps of the latest step in the grid modes.
+    SubstepStats substepStats;
+    bool hasObstacles = false;
+    ParticleArray particleX;
+    ParticleArray particleY;
+    ParticleStats particleStats;
+    // Extent of the particle domain in meters and the initial spacing between particles.
+    float domainWidth = 0.0f;
+    float domainHeight = 0.0f;
+    float particleSpacing = 0.0f;
+    LbmStats lbmStats;
+    // Cell counts of the volume in 3D mode, and its stored bricks out of all of them.
+    int volumeWidth = 0;
+    int volumeHeight = 0;
+    int volumeDepth = 0;
+    int activeBricks = 0;
+    int totalBricks = 0;
+    std::uint64_t stepCount = 0;
+    int stepsLastUpdate = 0;
+    double stepSeconds = 0.0;
+    double solveSeconds = 0.0;
+    double droppedSeconds = 0.0;
+    bool archiving = false;
+    FrameArchiveStats archiveStats;
+    // Steady clock time in seconds at which the latest state became current.
+    double publishTime = 0.0;
+};
+
+/*
+ * Runs the solver on its own thread with a fixed timestep, so a slow step never stalls event polling or
+ * buffer swaps on the render thread. Controls travel to the simulation through a lock-free triple buffer
+ * that only keeps the latest value, resets through a request counter, and splats through a bounded queue;
+ * results come back through another triple buffer, so neither thread ever waits for the other. Nothing but
+ * a splat can be lost to a slow step. All public functions are for the render thread only.
+ */
+class SimulationThread {
+public:
+    SimulationThread(const SimulationControls& controls, ThreadPool& pool, SceneType scene);
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    void setControls(const SimulationControls& controls);
+    // Resets every solver with the controls set before the call.
+    void reset(SceneType scene);
+
+    // Returns the most recent published frame. The reference stays valid until the next call.
+    const SimulationFrame& latestFrame();
+
+    int width() const { return solver.width(); }
+    int height() const { return solver.height(); }
+
+private:
+    void run();
+    bool applyCommands();
+    void publish(double solveSeconds);
+    void archiveFrame();
+
+    FluidSolver solver;
+    SphSolver sph;
+    PbfSolver pbf;
+    FlipSolver flip;
+    LbmSolver lbm;
+    FluidSolver3D grid3d;
+    VolumeDisplay volumeDisplay;
+    SimulationMode mode = SimulationMode::Grid;
+    FixedTimestep timestep;
+    bool paused = false;
+    std::uint64_t stepCount = 0;
+    FrameArchiveWriter archive;
+    int archiveEvery = 10;
+
+    TripleBuffer<SimulationControls> latestControls;
+    // Incremented by each reset(); the simulation resets once however many arrived since it last looked.
+    std::atomic<std::uint64_t> resetRequests { 0 };
+    std::atomic<SceneType> resetScene { SceneType::Plume };
+    std::uint64_t resetsApplied = 0;
+    TripleBuffer<SimulationFrame> frames;
+    std::atomic<bool> running { true };
+    std::thread thread;
+};
+
+double steadySeconds();
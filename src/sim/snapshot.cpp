@@ -0,0 +1,296 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SNAPSHOT_MMAP 1
+#endif
+
+namespace {
+
+constexpr char snapshotMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'S', 'N', 'P' };
+
+std::size_t alignUp(std::size_t value) {
+    return (value + snapshotAlignment - 1) / snapshotAlignment * snapshotAlignment;
+}
+
+std::size_t typeSize(SnapshotType type) {
+    switch (type) {
+    case SnapshotType::Float32:
+    case SnapshotType::Int32:
+        return 4;
+    case SnapshotType::UInt8:
+        return 1;
+    case SnapshotType::UInt64:
+        return 8;
+    }
+    return 1;
+}
+
+}
+
+SnapshotWriter::SnapshotWriter(SimulationMode mode, std::uint64_t step) {
+    reset(mode, step);
+}
+
+void SnapshotWriter::reset(SimulationMode mode, std::uint64_t step) {
+    header = {};
+    std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.mode = static_cast<std::uint32_t>(mode);
+    header.step = step;
+    fields.clear();
+}
+
+void SnapshotWriter::add(const char* name, SnapshotType type, const void* values, std::size_t bytes, int width, int height, int depth) {
+    SnapshotField field {};
+    std::strncpy(field.name, name, sizeof(field.name) - 1);
+    field.type = type;
+    field.width = static_cast<std::uint32_t>(width);
+    field.height = static_cast<std::uint32_t>(height);
+    field.depth = static_cast<std::uint32_t>(depth);
+    field.bytes = bytes;
+    const unsigned char* source = static_cast<const unsigned char*>(values);
+    if (arrays.size() <= fields.size()) {
+        arrays.emplace_back();
+    }
+    arrays[fields.size()].assign(source, source + bytes);
+    fields.push_back(field);
+}
+
+void SnapshotWriter::add(const char* name, const std::vector<float, AlignedAllocator<float>>& values) {
+    add(name, SnapshotType::Float32, values.data(), values.size() * sizeof(float), static_cast<int>(values.size()));
+}
+
+void SnapshotWriter::add(const char* name, const Grid2D& grid) {
+    add(name, SnapshotType::Float32, grid.data(), grid.size() * sizeof(float), grid.width, grid.height);
+}
+
+std::size_t SnapshotWriter::bytes() const {
+    std::size_t total = alignUp(sizeof(SnapshotHeader) + fields.size() * sizeof(SnapshotField));
+    for (const SnapshotField& field : fields) {
+        total += alignUp(field.bytes);
+    }
+    return total;
+}
+
+bool SnapshotWriter::write(const std::string& path) const {
+    // Arrays follow the table in order, each on the next page boundary.
+    SnapshotHeader fileHeader = header;
+    fileHeader.fieldCount = static_cast<std::uint32_t>(fields.size());
+    std::vector<SnapshotField> table = fields;
+    std::size_t offset = alignUp(sizeof(SnapshotHeader) + table.size() * sizeof(SnapshotField));
+    for (SnapshotField& field : table) {
+        field.offset = offset;
+        offset += alignUp(field.bytes);
+    }
+
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        static const char zeros[snapshotAlignment] = {};
+        std::size_t written = 0;
+        auto pad = [&](std::size_t target) {
+            file.write(zeros, static_cast<std::streamsize>(target - written));
+            written = target;
+        };
+        file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+        file.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(SnapshotField)));
+        written = sizeof(fileHeader) + table.size() * sizeof(SnapshotField);
+        for (std::size_t i = 0; i < table.size(); i++) {
+            pad(table[i].offset);
+            file.write(reinterpret_cast<const char*>(arrays[i].data()), static_cast<std::streamsize>(arrays[i].size()));
+            written += arrays[i].size();
+        }
+        pad(offset);
+        if (!file.flush()) {
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    return !error;
+}
+
+Snapshot::~Snapshot() {
+    close();
+}
+
+void Snapshot::close() {
+#ifdef SNAPSHOT_MMAP
+    if (base != nullptr && buffer.empty()) {
+        munmap(const_cast<unsigned char*>(base), length);
+    }
+#endif
+    base = nullptr;
+    length = 0;
+    buffer.clear();
+}
+
+bool Snapshot::open(const std::string& path) {
+    close();
+#ifdef SNAPSHOT_MMAP
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        void* mapping = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping != MAP_FAILED) {
+            base = static_cast<const unsigned char*>(mapping);
+            length = static_cast<std::size_t>(status.st_size);
+        }
+    }
+    ::close(descriptor);
+#endif
+    if (base == nullptr) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        base = buffer.data();
+        length = buffer.size();
+    }
+
+    if (length < sizeof(SnapshotHeader) || std::memcmp(header().magic, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+        error = path + " is not a snapshot";
+        close();
+        return false;
+    }
+    if (header().version != snapshotVersion) {
+        error = path + " is snapshot version " + std::to_string(header().version) + ", expected " + std::to_string(snapshotVersion);
+        close();
+        return false;
+    }
+    // Grid3D is the last mode; anything past it would index simulationModeNames out of bounds.
+    if (header().mode > static_cast<std::uint32_t>(SimulationMode::Grid3D)) {
+        error = path + " has unknown mode " + std::to_string(header().mode);
+        close();
+        return false;
+    }
+    const std::size_t tableEnd = sizeof(SnapshotHeader) + static_cast<std::size_t>(header().fieldCount) * sizeof(SnapshotField);
+    bool truncated = tableEnd > length;
+    for (std::uint32_t i = 0; !truncated && i < header().fieldCount; i++) {
+        const SnapshotField& field = reinterpret_cast<const SnapshotField*>(base + sizeof(SnapshotHeader))[i];
+        truncated = field.offset > length || field.bytes > length - field.offset;
+    }
+    if (truncated) {
+        error = path + " is truncated";
+        close();
+        return false;
+    }
+    return true;
+}
+
+const SnapshotField* Snapshot::find(const char* name) const {
+    const SnapshotField* table = reinterpret_cast<const SnapshotField*>(base + sizeof(SnapshotHeader));
+    for (std::uint32_t i = 0; i < header().fieldCount; i++) {
+        if (std::strncmp(table[i].name, name, sizeof(table[i].name)) == 0) {
+            return &table[i];
+        }
+    }
+    return nullptr;
+}
+
+bool Snapshot::read(const char* name, SnapshotType type, void* values, std::size_t count) const {
+    const SnapshotField* field = find(name);
+    if (field == nullptr) {
+        error = std::string("no field ") + name;
+        return false;
+    }
+    if (field->type != type || field->bytes != count * typeSize(type)) {
+        error = std::string("field ") + name + " has " + std::to_string(field->bytes / typeSize(field->type)) + " values, expected "
+            + std::to_string(count);
+        return false;
+    }
+    std::memcpy(values, base + field->offset, field->bytes);
+    return true;
+}
+
+bool Snapshot::read(const char* name, std::vector<float, AlignedAllocator<float>>& values) const {
+    return read(name, SnapshotType::Float32, values.data(), values.size());
+}
+
+bool Snapshot::read(const char* name, Grid2D& grid) const {
+    const SnapshotField* field = find(name);
+    if (field != nullptr && (field->width != static_cast<std::uint32_t>(grid.width) || field->height != static_cast<std::uint32_t>(grid.height))) {
+        error = std::string("field ") + name + " is " + std::to_string(field->width) + "x" + std::to_string(field->height) + ", expected "
+            + std::to_string(grid.width) + "x" + std::to_string(grid.height);
+        return false;
+    }
+    return read(name, SnapshotType::Float32, grid.data(), grid.size());
+}
+
+AsyncSnapshotWriter::AsyncSnapshotWriter() : thread(&AsyncSnapshotWriter::run, this) {}
+
+SnapshotWriter AsyncSnapshotWriter::take(SimulationMode mode, std::uint64_t step) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!spare) {
+        return SnapshotWriter(mode, step);
+    }
+    SnapshotWriter snapshot = std::move(*spare);
+    spare.reset();
+    snapshot.reset(mode, step);
+    return snapshot;
+}
+
+AsyncSnapshotWriter::~AsyncSnapshotWriter() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void AsyncSnapshotWriter::submit(SnapshotWriter&& snapshot, const std::string& path) {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return !pending && !writing; });
+    pending.emplace(std::move(snapshot));
+    pendingPath = path;
+    condition.notify_all();
+}
+
+bool AsyncSnapshotWriter::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return !pending && !writing; });
+    const bool succeeded = !failed;
+    failed = false;
+    return succeeded;
+}
+
+void AsyncSnapshotWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [&] { return pending || stopping; });
+        // A pending snapshot is written even when stopping, so the destructor never drops a checkpoint.
+        if (!pending) {
+            return;
+        }
+        SnapshotWriter snapshot = std::move(*pending);
+        const std::string path = pendingPath;
+        pending.reset();
+        writing = true;
+        lock.unlock();
+        const bool written = snapshot.write(path);
+        lock.lock();
+        writing = false;
+        failed |= !written;
+        spare.emplace(std::move(snapshot));
+        condition.notify_all();
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "grid.h"
+#include "simulation_mode.h"
+
+/*
+ * Binary snapshot of solver state for checkpoint and restart. The file is a 64-byte header, a table of
+ * 64-byte field entries, and the raw little-endian arrays the fields describe, each starting on a 4 KB
+ * boundary. Every array is one field in the solver's own layout (structure of arrays for particles,
+ * padded rows for grids, bricks for 3D grids), so writing is a copy per field and reading needs no parsing:
+ * the file is mapped and each field copied straight into the solver's storage, paging in as it goes.
+ * The version changes whenever the layout of the header, the table, or any solver's fields does.
+ */
+constexpr std::uint32_t snapshotVersion = 1;
+constexpr std::size_t snapshotAlignment = 4096;
+
+enum class SnapshotType : std::uint32_t {
+    Float32,
+    Int32,
+    UInt8,
+    UInt64
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t fieldCount;
+    std::uint32_t mode;
+    std::uint32_t reserved0;
+    // Steps completed when the snapshot was taken.
+    std::uint64_t step;
+    std::uint64_t reserved1[4];
+};
+static_assert(sizeof(SnapshotHeader) == 64, "the snapshot header is 64 bytes on disk");
+
+struct SnapshotField {
+    char name[32];
+    SnapshotType type;
+    // Logical shape, for checking against the solver's sizes; unused dimensions are 1.
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t depth;
+    // Byte offset of the array from the start of the file, and its length.
+    std::uint64_t offset;
+    std::uint64_t bytes;
+};
+static_assert(sizeof(SnapshotField) == 64, "snapshot field entries are 64 bytes on disk");
+
+// Collects copies of solver arrays, so the solver can step on while the snapshot is written.
+class SnapshotWriter {
+public:
+    SnapshotWriter(SimulationMode mode, std::uint64_t step);
+
+    // Starts a new snapshot, keeping the copies' buffers so a solver's next snapshot reuses mapped pages.
+    void reset(SimulationMode mode, std::uint64_t step);
+
+    void add(const char* name, SnapshotType type, const void* values, std::size_t bytes, int width, int height = 1, int depth = 1);
+    void add(const char* name, const std::vector<float, AlignedAllocator<float>>& values);
+    // The whole padded buffer, ghost cells included.
+    void add(const char* name, const Grid2D& grid);
+
+    // Writes to a temporary file and renames it over path, so a crash mid-write leaves the previous
+    // snapshot intact. Returns false if the file cannot be written.
+    bool write(const std::string& path) const;
+
+    std::size_t bytes() const;
+
+private:
+    SnapshotHeader header {};
+    std::vector<SnapshotField> fields;
+    // Copy of each field; entries past fields.size() are spare buffers left by reset.
+    std::vector<std::vector<unsigned char>> arrays;
+};
+
+// Read-only mapping of a snapshot file.
+class Snapshot {
+public:
+    Snapshot() = default;
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // Maps path and checks the header and field table. Returns false, with error set, if the file is
+    // missing, truncated, of another format version, or of an unknown mode.
+    bool open(const std::string& path);
+
+    SimulationMode mode() const { return static_cast<SimulationMode>(header().mode); }
+    std::uint64_t step() const { return header().step; }
+    std::size_t bytes() const { return length; }
+
+    // Entry of field name, or null if the snapshot has none.
+    const SnapshotField* find(const char* name) const;
+    // Copies field name into values, which hold count elements of type. Returns false, with error set,
+    // if the field is missing or of another type or length.
+    bool read(const char* name, SnapshotType type, void* values, std::size_t count) const;
+    bool read(const char* name, std::vector<float, AlignedAllocator<float>>& values) const;
+    // Also fails if the snapshot's grid has other dimensions.
+    bool read(const char* name, Grid2D& grid) const;
+
+    mutable std::string error;
+
+private:
+    const SnapshotHeader& header() const { return *reinterpret_cast<const SnapshotHeader*>(base); }
+    void close();
+
+    const unsigned char* base = nullptr;
+    std::size_t length = 0;
+    // Without mmap the file is read into memory instead.
+    std::vector<unsigned char> buffer;
+};
+
+/*
+ * Writes snapshots on a thread of its own, so a checkpoint costs the simulation only the copy into the
+ * SnapshotWriter. One snapshot is written at a time; submitting another while one is in flight waits for
+ * it, which bounds the memory held by pending snapshots to two.
+ */
+class AsyncSnapshotWriter {
+public:
+    AsyncSnapshotWriter();
+    // Finishes the pending write.
+    ~AsyncSnapshotWriter();
+
+    AsyncSnapshotWriter(const AsyncSnapshotWriter&) = delete;
+    AsyncSnapshotWriter& operator=(const AsyncSnapshotWriter&) = delete;
+
+    // An empty snapshot to fill, reusing the buffers of the last one written if it has been.
+    SnapshotWriter take(SimulationMode mode, std::uint64_t step);
+    void submit(SnapshotWriter&& snapshot, const std::string& path);
+    // Waits for the pending write. Returns false if any write failed since the last call.
+    bool finish();
+
+private:
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::optional<SnapshotWriter> pending;
+    std::optional<SnapshotWriter> spare;
+    std::string pendingPath;
+    bool writing = false;
+    bool failed = false;
+    bool stopping = false;
+    std::thread thread;
+};
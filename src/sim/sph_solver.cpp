@@ -0,0 +1,263 @@
+#include "sph_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "float_mode.h"
+#include "particle_kernels.h"
+#include "trace.h"
+
+namespace {
+
+// Tait exponent for water, expanded as ratio^7 in computeDensity.
+constexpr float taitExponent = 7.0f;
+
+struct DensitySums {
+    double neighbors = 0.0;
+    double compression = 0.0;
+};
+
+DensitySums addSums(DensitySums a, DensitySums b) {
+    return { a.neighbors + b.neighbors, a.compression + b.compression };
+}
+
+float maxOf(float a, float b) {
+    return std::max(a, b);
+}
+
+}
+
+SphSolver::SphSolver(const SphSettings& settings, ThreadPool& pool) : settings(settings), pool(pool) {
+    reset();
+}
+
+void SphSolver::reset() {
+    const int count = std::max(1, settings.particleCount);
+    const float damWidth = settings.damWidth * settings.domainWidth;
+    const float damHeight = settings.damHeight * settings.domainHeight;
+    spacing = placeDamBreak(particles, count, damWidth, damHeight);
+    radius = 2.0f * spacing;
+    mass = settings.restDensity / latticeDensitySum(spacing, radius);
+    for (ParticleArray* array : { &density, &pressure, &inverseDensity, &pressureTerm, &accelerationX, &accelerationY }) {
+        array->assign(count, 0.0f);
+    }
+    stats = {};
+    stepsSinceReorder = 0;
+}
+
+void SphSolver::saveState(SnapshotWriter& snapshot) const {
+    snapshot.add("positionX", particles.positionX);
+    snapshot.add("positionY", particles.positionY);
+    snapshot.add("velocityX", particles.velocityX);
+    snapshot.add("velocityY", particles.velocityY);
+    // Particle order depends on when the last reorder ran, so a restart keeps the same schedule.
+    snapshot.add("stepsSinceReorder", SnapshotType::Int32, &stepsSinceReorder, sizeof(stepsSinceReorder), 1);
+}
+
+bool SphSolver::loadState(const Snapshot& snapshot) {
+    return snapshot.read("positionX", particles.positionX) && snapshot.read("positionY", particles.positionY)
+        && snapshot.read("velocityX", particles.velocityX) && snapshot.read("velocityY", particles.velocityY)
+        && snapshot.read("stepsSinceReorder", SnapshotType::Int32, &stepsSinceReorder, 1);
+}
+
+void SphSolver::addArchiveFields(ArchiveFrame& frame) const {
+    frame.add("positionX", particles.positionX);
+    frame.add("positionY", particles.positionY);
+    frame.add("velocityX", particles.velocityX);
+    frame.add("velocityY", particles.velocityY);
+}
+
+void SphSolver::step(float dt) {
+    TRACE_ZONE("sphStep");
+    if (dt <= 0.0f || particles.size() == 0) {
+        return;
+    }
+    ScopedFlushDenormals flushDenormals;
+    reorder();
+    const float substepLimit = settings.cflNumber * radius / (settings.soundSpeed + maxSpeed());
+    int substeps = std::clamp(static_cast<int>(std::ceil(dt / substepLimit)), 1, std::max(1, settings.maxSubsteps));
+    float substep = std::min(dt / substeps, substepLimit);
+
+    for (int i = 0; i < substeps; i++) {
+        grid.build(pool, particles.positionX, particles.positionY, radius, settings.domainWidth, settings.domainHeight);
+        computeDensity();
+        computeAcceleration();
+        integrate(substep);
+    }
+    stats.substeps = substeps;
+    stats.substepSeconds = substep;
+    stats.simulatedSeconds = substep * substeps;
+    stats.maxSpeed = maxSpeed();
+    stats.gatherCacheLines = grid.gatherCacheLines;
+}
+
+// Every other per-particle array is rebuilt each substep, so only positions and velocities are carried across.
+void SphSolver::reorder() {
+    if (settings.reorderInterval <= 0 || ++stepsSinceReorder < settings.reorderInterval) {
+        return;
+    }
+    stepsSinceReorder = 0;
+    sorter.sort(pool, particles, radius, settings.domainWidth, settings.domainHeight);
+}
+
+void SphSolver::computeDensity() {
+    TRACE_ZONE("sphDensity");
+    const float h = radius;
+    const float h2 = h * h;
+    const float densityScale = mass * poly6Scale(h);
+    const float stiffness = settings.restDensity * settings.soundSpeed * settings.soundSpeed / taitExponent;
+    const float inverseRestDensity = 1.0f / settings.restDensity;
+
+    const int count = particles.size();
+    DensitySums sums = parallelReduceParticles(pool, count, DensitySums(), [&](int begin, int end) {
+        DensitySums partial;
+        const float* sortedX = grid.sortedX.data();
+        const float* sortedY = grid.sortedY.data();
+        for (int i = begin; i < end; i++) {
+            const float x = particles.positionX[i];
+            const float y = particles.positionY[i];
+            float sum = 0.0f;
+            int neighbors = 0;
+            grid.forEachCandidateRange(x, y, [&](int rangeBegin, int rangeEnd) {
+                // Accumulate in locals: the captured sums could alias the float arrays and stay in memory.
+                float rangeSum = 0.0f;
+                int rangeNeighbors = 0;
+                for (int k = rangeBegin; k < rangeEnd; k++) {
+                    float dx = x - sortedX[k];
+                    float dy = y - sortedY[k];
+                    float d = std::max(0.0f, h2 - (dx * dx + dy * dy));
+                    rangeSum += d * d * d;
+                    rangeNeighbors += d > 0.0f;
+                }
+                sum += rangeSum;
+                neighbors += rangeNeighbors;
+            });
+            float rho = densityScale * sum;
+            float ratio = rho * inverseRestDensity;
+            density[i] = rho;
+            // Clamping negative pressure avoids particles clumping at the free surface.
+            float ratio2 = ratio * ratio;
+            float ratio7 = ratio2 * ratio2 * ratio2 * ratio;
+            pressure[i] = std::max(0.0f, stiffness * (ratio7 - 1.0f));
+            partial.neighbors += neighbors;
+            partial.compression += std::max(0.0f, ratio - 1.0f);
+        }
+        return partial;
+    }, addSums);
+    stats.averageNeighbors = static_cast<float>(sums.neighbors / count);
+    stats.densityError = static_cast<float>(sums.compression / count);
+}
+
+void SphSolver::computeAcceleration() {
+    TRACE_ZONE("sphAcceleration");
+    const int count = particles.size();
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            inverseDensity[i] = 1.0f / density[i];
+            pressureTerm[i] = pressure[i] * inverseDensity[i] * inverseDensity[i];
+        }
+    });
+    grid.gather(pool, inverseDensity, sortedInverseDensity);
+    grid.gather(pool, pressureTerm, sortedPressureTerm);
+    grid.gather(pool, particles.velocityX, sortedVelocityX);
+    grid.gather(pool, particles.velocityY, sortedVelocityY);
+
+    const float h = radius;
+    const float h2 = h * h;
+    const float pressureScale = mass * spikyGradientScale(h);
+    const float viscosityScale = settings.viscosity * mass * 40.0f / (kernelPi * std::pow(h, 5.0f));
+    parallelForParticles(pool, count, [&](int begin, int end) {
+        const float* sortedX = grid.sortedX.data();
+        const float* sortedY = grid.sortedY.data();
+        for (int i = begin; i < end; i++) {
+            const float x = particles.positionX[i];
+            const float y = particles.positionY[i];
+            const float ownPressureTerm = pressureTerm[i];
+            const float vx = particles.velocityX[i];
+            const float vy = particles.velocityY[i];
+            float ax = 0.0f;
+            float ay = 0.0f;
+            float viscousX = 0.0f;
+            float viscousY = 0.0f;
+            grid.forEachCandidateRange(x, y, [&](int rangeBegin, int rangeEnd) {
+                float rangeAx = 0.0f;
+                float rangeAy = 0.0f;
+                float rangeViscousX = 0.0f;
+                float rangeViscousY = 0.0f;
+                for (int k = rangeBegin; k < rangeEnd; k++) {
+                    float dx = x - sortedX[k];
+                    float dy = y - sortedY[k];
+                    float distanceSquared = dx * dx + dy * dy;
+                    // Unlike the density pass this one branches: the square root and division only pay
+                    // off for the third of candidates inside the radius. The particle itself is skipped.
+                    if (distanceSquared >= h2 || distanceSquared <= 0.0f) {
+                        continue;
+                    }
+                    float r = std::sqrt(distanceSquared);
+                    float falloff = h - r;
+                    // Symmetric pressure force along the spiky kernel gradient, pushing i away from k.
+                    float push = (ownPressureTerm + sortedPressureTerm[k]) * falloff * falloff / r;
+                    rangeAx += push * dx;
+                    rangeAy += push * dy;
+                    float weight = falloff * sortedInverseDensity[k];
+                    rangeViscousX += (sortedVelocityX[k] - vx) * weight;
+                    rangeViscousY += (sortedVelocityY[k] - vy) * weight;
+                }
+                ax += rangeAx;
+                ay += rangeAy;
+                viscousX += rangeViscousX;
+                viscousY += rangeViscousY;
+            });
+            accelerationX[i] = pressureScale * ax + viscosityScale * viscousX * inverseDensity[i];
+            accelerationY[i] = pressureScale * ay + viscosityScale * viscousY * inverseDensity[i] + settings.gravity;
+        }
+    });
+}
+
+void SphSolver::integrate(float dt) {
+    TRACE_ZONE("sphIntegrate");
+    const float minX = 0.5f * spacing;
+    const float minY = 0.5f * spacing;
+    const float maxX = settings.domainWidth - 0.5f * spacing;
+    const float maxY = settings.domainHeight - 0.5f * spacing;
+    const float restitution = settings.wallRestitution;
+    parallelForParticles(pool, particles.size(), [&](int begin, int end) {
+        float* x = particles.positionX.data();
+        float* y = particles.positionY.data();
+        float* vx = particles.velocityX.data();
+        float* vy = particles.velocityY.data();
+        for (int i = begin; i < end; i++) {
+            vx[i] += dt * accelerationX[i];
+            vy[i] += dt * accelerationY[i];
+            x[i] += dt * vx[i];
+            y[i] += dt * vy[i];
+            if (x[i] < minX) {
+                x[i] = minX;
+                vx[i] = std::max(vx[i], -restitution * vx[i]);
+            } else if (x[i] > maxX) {
+                x[i] = maxX;
+                vx[i] = std::min(vx[i], -restitution * vx[i]);
+            }
+            if (y[i] < minY) {
+                y[i] = minY;
+                vy[i] = std::max(vy[i], -restitution * vy[i]);
+            } else if (y[i] > maxY) {
+                y[i] = maxY;
+                vy[i] = std::min(vy[i], -restitution * vy[i]);
+            }
+        }
+    });
+}
+
+float SphSolver::maxSpeed() {
+    float maxSpeedSquared = parallelReduceParticles(pool, particles.size(), 0.0f, [&](int begin, int end) {
+        float result = 0.0f;
+        for (int i = begin; i < end; i++) {
+            float vx = particles.velocityX[i];
+            float vy = particles.velocityY[i];
+            result = std::max(result, vx * vx + vy * vy);
+        }
+        return result;
+    }, maxOf);
+    return std::sqrt(maxSpeedSquared);
+}
@@ -0,0 +1,173 @@
+#include "thread_pool.h"
+
+#include "float_mode.h"
+#include "trace.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Iterations a worker polls for the next job before blocking on the condition variable.
+constexpr int spinIterations = 4000;
+
+thread_local bool insideParallelFor = false;
+
+std::uint64_t packRange(std::uint32_t begin, std::uint32_t end) {
+    return (static_cast<std::uint64_t>(end) << 32) | begin;
+}
+
+std::uint32_t rangeBegin(std::uint64_t bounds) {
+    return static_cast<std::uint32_t>(bounds);
+}
+
+std::uint32_t rangeEnd(std::uint64_t bounds) {
+    return static_cast<std::uint32_t>(bounds >> 32);
+}
+
+void pinToCpu(std::thread& thread, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+}
+
+ThreadPool::ThreadPool(int threadCount, bool pinThreads) {
+    if (threadCount <= 0) {
+        threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    ranges = std::make_unique<WorkRange[]>(threadCount);
+    workers.reserve(threadCount - 1);
+    for (int slot = 1; slot < threadCount; slot++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, slot);
+        if (pinThreads) {
+            pinToCpu(workers.back(), slot);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping.store(true);
+        generation.fetch_add(1);
+    }
+    wakeCondition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::claim(int slot, int& index) {
+    std::atomic<std::uint64_t>& bounds = ranges[slot].bounds;
+    std::uint64_t current = bounds.load(std::memory_order_acquire);
+    while (rangeBegin(current) < rangeEnd(current)) {
+        std::uint64_t next = packRange(rangeBegin(current) + 1, rangeEnd(current));
+        if (bounds.compare_exchange_weak(current, next, std::memory_order_acq_rel)) {
+            index = static_cast<int>(rangeBegin(current));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::steal(int slot, int& index) {
+    const int slots = threadCount();
+    for (int offset = 1; offset < slots; offset++) {
+        std::atomic<std::uint64_t>& victim = ranges[(slot + offset) % slots].bounds;
+        std::uint64_t current = victim.load(std::memory_order_acquire);
+        while (rangeBegin(current) < rangeEnd(current)) {
+            std::uint32_t begin = rangeBegin(current);
+            std::uint32_t end = rangeEnd(current);
+            std::uint32_t split = end - (end - begin + 1) / 2;
+            if (victim.compare_exchange_weak(current, packRange(begin, split), std::memory_order_acq_rel)) {
+                // Run the first stolen index now and keep the rest where other thieves can find it.
+                ranges[slot].bounds.store(packRange(split + 1, end), std::memory_order_release);
+                index = static_cast<int>(split);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runSlot(int slot) {
+    TRACE_ZONE("parallelFor");
+    const std::function<void(int)>& body = *job;
+    int index = 0;
+    while (claim(slot, index) || steal(slot, index)) {
+        body(index);
+    }
+}
+
+void ThreadPool::workerLoop(int slot) {
+    ScopedFlushDenormals flushDenormals;
+    setTraceThreadName("pool worker");
+    insideParallelFor = true;
+    std::uint64_t seenGeneration = 0;
+
+    while (true) {
+        int spins = 0;
+        while (generation.load(std::memory_order_acquire) == seenGeneration && spins < spinIterations) {
+            spins++;
+            std::this_thread::yield();
+        }
+        if (generation.load(std::memory_order_acquire) == seenGeneration) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait(lock, [&] { return generation.load() != seenGeneration; });
+        }
+        seenGeneration = generation.load(std::memory_order_acquire);
+        if (stopping.load()) {
+            return;
+        }
+
+        runSlot(slot);
+        pendingWorkers.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> jobLock(jobMutex, std::try_to_lock);
+    if (workers.empty() || count == 1 || insideParallelFor || !jobLock.owns_lock()) {
+        for (int i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    const int slots = threadCount();
+    for (int slot = 0; slot < slots; slot++) {
+        std::uint32_t begin = static_cast<std::uint32_t>(static_cast<long long>(count) * slot / slots);
+        std::uint32_t end = static_cast<std::uint32_t>(static_cast<long long>(count) * (slot + 1) / slots);
+        ranges[slot].bounds.store(packRange(begin, end), std::memory_order_relaxed);
+    }
+    job = &body;
+    pendingWorkers.store(static_cast<int>(workers.size()), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    wakeCondition.notify_all();
+
+    insideParallelFor = true;
+    runSlot(0);
+    insideParallelFor = false;
+
+    // Every worker checks in once per job, so no worker can still hold this job's body when we return.
+    while (pendingWorkers.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+    job = nullptr;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Persistent pool of worker threads for data-parallel grid kernels. A parallelFor splits its index range
+ * evenly across all threads (the calling thread included); each thread consumes its own range from the
+ * front and, once empty, steals the back half of another thread's range. Ranges are single packed atomics,
+ * so neither claiming nor stealing takes a lock. Workers spin briefly between jobs before sleeping, which
+ * keeps the many back-to-back kernels of a solver step from paying a wake-up each.
+ */
+class ThreadPool {
+public:
+    // A threadCount of 0 uses one thread per hardware thread. Pinning binds worker i to CPU i (Linux only).
+    explicit ThreadPool(int threadCount = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that execute work, including the caller of parallelFor.
+    int threadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Calls body(i) for every i in [0, count) and returns once all calls finished. Calls made from
+    // inside a running body, or while another thread owns the pool, run serially on the calling thread.
+    void parallelFor(int count, const std::function<void(int)>& body);
+
+private:
+    struct alignas(64) WorkRange {
+        std::atomic<std::uint64_t> bounds { 0 };
+    };
+
+    void workerLoop(int slot);
+    void runSlot(int slot);
+    bool claim(int slot, int& index);
+    bool steal(int slot, int& index);
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<WorkRange[]> ranges;
+
+    std::mutex jobMutex;
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<std::uint64_t> generation { 0 };
+    std::atomic<int> pendingWorkers { 0 };
+    std::atomic<bool> stopping { false };
+    const std::function<void(int)>* job = nullptr;
+};
+
+// Rectangle of interior cells, x in [xBegin, xEnd) and y in [yBegin, yEnd), using the padded grid's 1-based coordinates.
+struct Tile {
+    int index = 0;
+    int xBegin = 1;
+    int xEnd = 1;
+    int yBegin = 1;
+    int yEnd = 1;
+};
+
+/*
+ * Partition of a width x height interior into tiles. Tiles span at most 256 columns so rows stay long
+ * unit-stride runs, and are tall enough to hold a few thousand cells so small grids (coarse multigrid
+ * levels) collapse into a single tile and run without any scheduling overhead.
+ */
+struct TileGrid {
+    static constexpr int maxTileWidth = 256;
+    static constexpr int minTileHeight = 16;
+    static constexpr int minTileCells = 4096;
+
+    int width = 0;
+    int height = 0;
+    int tileWidth = 0;
+    int tileHeight = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+
+    TileGrid(int width, int height) : width(width), height(height) {
+        tileWidth = std::max(1, std::min(width, maxTileWidth));
+        tileHeight = std::max(minTileHeight, minTileCells / tileWidth);
+        tilesX = (width + tileWidth - 1) / tileWidth;
+        tilesY = (height + tileHeight - 1) / tileHeight;
+    }
+
+    int count() const { return tilesX * tilesY; }
+
+    Tile tile(int index) const {
+        int tx = index % tilesX;
+        int ty = index / tilesX;
+        Tile result;
+        result.index = index;
+        result.xBegin = 1 + tx * tileWidth;
+        result.xEnd = std::min(width + 1, result.xBegin + tileWidth);
+        result.yBegin = 1 + ty * tileHeight;
+        result.yEnd = std::min(height + 1, result.yBegin + tileHeight);
+        return result;
+    }
+};
+
+template <typename Body>
+void parallelForTiles(ThreadPool& pool, int width, int height, Body&& body) {
+    TileGrid tiles(width, height);
+    if (tiles.count() == 1) {
+        body(tiles.tile(0));
+        return;
+    }
+    pool.parallelFor(tiles.count(), [&](int index) { body(tiles.tile(index)); });
+}
+
+// Maps every tile to a partial result and folds the partials in tile order, so results do not depend on scheduling.
+template <typename T, typename Map, typename Combine>
+T parallelReduceTiles(ThreadPool& pool, int width, int height, T identity, Map&& map, Combine&& combine) {
+    TileGrid tiles(width, height);
+    if (tiles.count() == 1) {
+        return combine(identity, map(tiles.tile(0)));
+    }
+    std::vector<T> partials(tiles.count(), identity);
+    pool.parallelFor(tiles.count(), [&](int index) { partials[index] = map(tiles.tile(index)); });
+    T result = identity;
+    for (const T& partial : partials) {
+        result = combine(result, partial);
+    }
+    return result;
+}
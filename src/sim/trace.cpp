@@ -0,0 +1,163 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Zones kept per thread, roughly several seconds of every kernel at interactive rates.
+constexpr std::uint64_t ringCapacity = 1 << 16;
+
+// Fields are atomics only so a dump can read a ring while its thread keeps writing.
+struct TraceEvent {
+    std::atomic<const char*> name { nullptr };
+    std::atomic<std::int64_t> start { 0 };
+    std::atomic<std::int64_t> end { 0 };
+};
+
+struct TraceRing {
+    std::unique_ptr<TraceEvent[]> events = std::make_unique<TraceEvent[]>(ringCapacity);
+    std::atomic<std::uint64_t> written { 0 };
+    std::atomic<const char*> threadName { nullptr };
+    int threadId = 0;
+};
+
+struct CopiedEvent {
+    const char* name;
+    std::int64_t start;
+    std::int64_t end;
+};
+
+// Rings of threads that exited are kept for dumps until this many newer ones have also exited.
+constexpr std::size_t retiredRingLimit = 16;
+
+std::mutex registryMutex;
+std::vector<std::shared_ptr<TraceRing>> rings;
+std::vector<std::shared_ptr<TraceRing>> retiredRings;
+int nextThreadId = 1;
+
+// Retires the thread's ring when the thread exits. Dumps in progress hold their own references.
+struct RingOwner {
+    std::shared_ptr<TraceRing> ring;
+
+    ~RingOwner() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        rings.erase(std::find(rings.begin(), rings.end(), ring));
+        retiredRings.push_back(std::move(ring));
+        if (retiredRings.size() > retiredRingLimit) {
+            retiredRings.erase(retiredRings.begin());
+        }
+    }
+};
+
+thread_local TraceRing* localRing = nullptr;
+thread_local const char* localThreadName = nullptr;
+
+// Allocated on the thread's first recorded zone, so threads that never record while tracing cost nothing.
+TraceRing& threadRing() {
+    if (!localRing) {
+        thread_local RingOwner owner;
+        owner.ring = std::make_shared<TraceRing>();
+        owner.ring->threadName.store(localThreadName, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(registryMutex);
+        owner.ring->threadId = nextThreadId++;
+        rings.push_back(owner.ring);
+        localRing = owner.ring.get();
+    }
+    return *localRing;
+}
+
+// Copies the ring, dropping any events the owning thread may have overwritten during the copy.
+std::vector<CopiedEvent> copyRing(const TraceRing& ring) {
+    std::uint64_t written = ring.written.load(std::memory_order_acquire);
+    std::uint64_t first = written > ringCapacity ? written - ringCapacity : 0;
+    std::vector<CopiedEvent> copied;
+    copied.reserve(written - first);
+    for (std::uint64_t i = first; i < written; i++) {
+        const TraceEvent& event = ring.events[i % ringCapacity];
+        copied.push_back({ event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                           event.end.load(std::memory_order_relaxed) });
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    std::uint64_t after = ring.written.load(std::memory_order_relaxed);
+    std::uint64_t safeFirst = after + 1 > ringCapacity ? after + 1 - ringCapacity : 0;
+    if (safeFirst > first) {
+        copied.erase(copied.begin(), copied.begin() + static_cast<std::ptrdiff_t>(std::min(static_cast<std::size_t>(safeFirst - first), copied.size())));
+    }
+    return copied;
+}
+
+}
+
+std::atomic<bool> traceEnabledFlag { false };
+
+void setTracingEnabled(bool enabled) {
+    traceNanoseconds();
+    traceEnabledFlag.store(enabled);
+}
+
+std::int64_t traceNanoseconds() {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void recordTraceZone(const char* name, std::int64_t startNanoseconds, std::int64_t endNanoseconds) {
+    TraceRing& ring = threadRing();
+    std::uint64_t index = ring.written.load(std::memory_order_relaxed);
+    TraceEvent& event = ring.events[index % ringCapacity];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(startNanoseconds, std::memory_order_relaxed);
+    event.end.store(endNanoseconds, std::memory_order_relaxed);
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+void setTraceThreadName(const char* name) {
+    localThreadName = name;
+    if (localRing) {
+        localRing->threadName.store(name, std::memory_order_release);
+    }
+}
+
+bool writeChromeTrace(const std::string& path, double seconds) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    const std::int64_t cutoff = traceNanoseconds() - static_cast<std::int64_t>(seconds * 1e9);
+
+    std::vector<std::shared_ptr<TraceRing>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        snapshot = retiredRings;
+        snapshot.insert(snapshot.end(), rings.begin(), rings.end());
+    }
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    char line[256];
+    for (const std::shared_ptr<TraceRing>& ring : snapshot) {
+        const char* threadName = ring->threadName.load(std::memory_order_acquire);
+        if (threadName) {
+            std::snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                          ring->threadId, threadName);
+            file << (first ? "" : ",\n") << line;
+            first = false;
+        }
+        for (const CopiedEvent& event : copyRing(*ring)) {
+            if (event.end < cutoff || !event.name) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                          event.name, ring->threadId, event.start * 1e-3, (event.end - event.start) * 1e-3);
+            file << (first ? "" : ",\n") << line;
+            first = false;
+        }
+    }
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
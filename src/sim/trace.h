@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+ * Flight recorder for timing zones. Each thread appends finished zones to its own fixed-size ring, so
+ * recording takes no locks and old events are overwritten once the ring is full. While tracing is
+ * disabled a zone costs one relaxed atomic load, and a thread gets its ring only when it first records a
+ * zone. A ring outlives its thread until a few newer threads have exited too. The recent history can be
+ * written at any time as trace-event JSON for chrome://tracing or Perfetto.
+ */
+
+extern std::atomic<bool> traceEnabledFlag;
+
+inline bool tracingEnabled() {
+    return traceEnabledFlag.load(std::memory_order_relaxed);
+}
+
+void setTracingEnabled(bool enabled);
+
+// Nanoseconds on the steady clock since the first call in this process.
+std::int64_t traceNanoseconds();
+
+// Appends a finished zone to the calling thread's ring. The name must outlive the process, e.g. a literal.
+void recordTraceZone(const char* name, std::int64_t startNanoseconds, std::int64_t endNanoseconds);
+
+// Labels the calling thread in written traces. The name must be a literal.
+void setTraceThreadName(const char* name);
+
+// Writes every zone that ended within the last seconds, from all live threads and the latest exited ones. Returns false on I/O failure.
+bool writeChromeTrace(const std::string& path, double seconds);
+
+class TraceZone {
+public:
+    explicit TraceZone(const char* name) : name(name), start(tracingEnabled() ? traceNanoseconds() : -1) {}
+    ~TraceZone() {
+        if (start >= 0) {
+            recordTraceZone(name, start, traceNanoseconds());
+        }
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+    const char* name;
+    std::int64_t start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Records the enclosing scope as a zone with the given literal name.
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
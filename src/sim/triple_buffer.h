@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Lock-free single-producer single-consumer triple buffer. The producer fills the back buffer and
+ * publishes it by swapping it with the shared middle slot; the consumer swaps the middle slot with its
+ * front buffer whenever something new was published. Neither side ever blocks, the producer never
+ * overwrites what the consumer is reading, and the consumer always sees the most recent complete value.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer side: the buffer to fill before the next publish().
+    T& writeBuffer() { return buffers[backIndex]; }
+
+    void publish() {
+        std::uint8_t previous = middle.exchange(static_cast<std::uint8_t>(backIndex | freshBit), std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    // Consumer side: swaps in the newest published buffer, if any. Returns true when the front buffer changed.
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit)) {
+            return false;
+        }
+        std::uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & indexMask;
+        return true;
+    }
+
+    const T& readBuffer() const { return buffers[frontIndex]; }
+
+private:
+    static constexpr std::uint8_t indexMask = 0x3;
+    static constexpr std::uint8_t freshBit = 0x4;
+
+    T buffers[3];
+    alignas(64) std::uint8_t backIndex = 0;
+    alignas(64) std::atomic<std::uint8_t> middle { 1 };
+    alignas(64) std::uint8_t frontIndex = 2;
+};
@@ -0,0 +1,207 @@
+#include "field_renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "shader_program.h"
+
+namespace {
+
+// Quad corners come from gl_VertexID; scale is the fraction of the viewport the grid covers.
+constexpr const char* vertexShaderSource = R"(#version 440 core
+uniform vec2 scale;
+out vec2 uv;
+void main() {
+    uv = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    gl_Position = vec4((uv * 2.0 - 1.0) * scale, 0.0, 1.0);
+}
+)";
+
+// Colormap 0 ramps one field over range, 1 ramps the magnitude of two fields up to range.y and
+// 2 maps one field symmetrically around zero, blue for negative and red for positive.
+constexpr const char* fragmentShaderSource = R"(#version 440 core
+layout(binding = 0) uniform sampler2D first;
+layout(binding = 1) uniform sampler2D second;
+uniform vec2 range;
+uniform int colormap;
+in vec2 uv;
+out vec4 color;
+
+vec3 sequential(float t) {
+    const vec3 stops[4] = vec3[](vec3(0.0, 0.0, 0.02), vec3(0.45, 0.05, 0.5), vec3(0.95, 0.45, 0.1), vec3(1.0, 1.0, 0.75));
+    float position = clamp(t, 0.0, 1.0) * 3.0;
+    int segment = min(int(position), 2);
+    return mix(stops[segment], stops[segment + 1], position - float(segment));
+}
+
+vec3 diverging(float t) {
+    const vec3 negative = vec3(0.23, 0.3, 0.75);
+    const vec3 zero = vec3(0.87);
+    const vec3 positive = vec3(0.7, 0.02, 0.15);
+    t = clamp(t, -1.0, 1.0);
+    return t < 0.0 ? mix(zero, negative, -t) : mix(zero, positive, t);
+}
+
+void main() {
+    float value = texture(first, uv).r;
+    if (colormap == 1) {
+        value = length(vec2(value, texture(second, uv).r));
+    }
+    if (colormap == 2) {
+        color = vec4(diverging(value / max(max(-range.x, range.y), 1e-12)), 1.0);
+    } else {
+        color = vec4(sequential((value - range.x) / max(range.y - range.x, 1e-12)), 1.0);
+    }
+}
+)";
+
+}
+
+FieldRenderer::FieldRenderer() {
+    program = createShaderProgram("field", vertexShaderSource, fragmentShaderSource);
+    scaleLocation = glGetUniformLocation(program, "scale");
+    rangeLocation = glGetUniformLocation(program, "range");
+    colormapLocation = glGetUniformLocation(program, "colormap");
+    // The core profile needs a vertex array bound to draw, even one without attributes.
+    glGenVertexArrays(1, &vertexArray);
+    glGenBuffers(bufferCount, unpackBuffers.data());
+}
+
+FieldRenderer::~FieldRenderer() {
+    glDeleteTextures(static_cast<GLsizei>(textures.size()), textures.data());
+    glDeleteBuffers(bufferCount, unpackBuffers.data());
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteProgram(program);
+}
+
+void FieldRenderer::draw(DisplayField field, const Grid2D& density, const SimulationFrame& frame, int viewportWidth, int viewportHeight) {
+    const Grid2D* first = &density;
+    const Grid2D* second = nullptr;
+    int colormap = 0;
+    if (field == DisplayField::Velocity) {
+        first = &frame.velocityX;
+        second = &frame.velocityY;
+        colormap = 1;
+    } else if (field == DisplayField::Pressure) {
+        first = &frame.pressure;
+        colormap = 2;
+    }
+    if (first->width <= 0 || first->height <= 0 || viewportWidth <= 0 || viewportHeight <= 0) {
+        return;
+    }
+    // Density is interpolated between steps by the caller, so it changes every frame.
+    bool stale = field == DisplayField::Density || field != uploadedField || frame.stepCount != uploadedStep
+        || first->width != textureWidth || first->height != textureHeight;
+    if (stale) {
+        uploadedRange = upload(*first, second);
+        uploadedField = field;
+        uploadedStep = frame.stepCount;
+    }
+
+    // Fit the grid to the viewport, centered, keeping cells square.
+    const float pixelsPerCell = std::min(static_cast<float>(viewportWidth) / textureWidth, static_cast<float>(viewportHeight) / textureHeight);
+    glUseProgram(program);
+    glUniform2f(scaleLocation, textureWidth * pixelsPerCell / viewportWidth, textureHeight * pixelsPerCell / viewportHeight);
+    glUniform2f(rangeLocation, uploadedRange[0], uploadedRange[1]);
+    glUniform1i(colormapLocation, colormap);
+    for (int i = 0; i < 2; i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+std::array<float, 2> FieldRenderer::upload(const Grid2D& first, const Grid2D* second) {
+    if (first.width != textureWidth || first.height != textureHeight) {
+        resize(first.width, first.height);
+    }
+    const int grids = second != nullptr ? 2 : 1;
+    const std::size_t gridSize = first.size();
+
+    // Invalidating the whole buffer lets the driver hand out fresh storage if a texture copy from the last
+    // time this buffer was used is still in flight, instead of waiting for it.
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffers[nextBuffer]);
+    nextBuffer = (nextBuffer + 1) % bufferCount;
+    float* mapped = static_cast<float*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, grids * gridSize * sizeof(float),
+                                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (mapped == nullptr) {
+        std::cerr << "Failed to map field unpack buffer." << std::endl;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return uploadedRange;
+    }
+
+    // Copy row by row, padding included, and take the range of each interior row while it is still in cache.
+    float minimum = INFINITY;
+    float maximum = -INFINITY;
+    for (int y = 0; y < first.height + 2; y++) {
+        const bool interior = y >= 1 && y <= first.height;
+        std::memcpy(mapped + first.index(0, y), first.row(y), first.stride * sizeof(float));
+        if (second != nullptr) {
+            std::memcpy(mapped + gridSize + first.index(0, y), second->row(y), first.stride * sizeof(float));
+        }
+        if (!interior) {
+            continue;
+        }
+        const float* a = first.row(y);
+        if (second != nullptr) {
+            const float* b = second->row(y);
+            for (int x = 1; x <= first.width; x++) {
+                maximum = std::max(maximum, a[x] * a[x] + b[x] * b[x]);
+            }
+        } else {
+            for (int x = 1; x <= first.width; x++) {
+                minimum = std::min(minimum, a[x]);
+                maximum = std::max(maximum, a[x]);
+            }
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // With a buffer bound the data argument is an offset into it; the row length skips the ghost cells.
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, first.stride);
+    for (int i = 0; i < grids; i++) {
+        const std::size_t offset = (i * gridSize + first.index(1, 1)) * sizeof(float);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, first.width, first.height, GL_RED, GL_FLOAT, reinterpret_cast<const void*>(offset));
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (second != nullptr) {
+        return { 0.0f, std::sqrt(maximum) };
+    }
+    return { minimum, maximum };
+}
+
+void FieldRenderer::resize(int width, int height) {
+    glDeleteTextures(static_cast<GLsizei>(textures.size()), textures.data());
+    glGenTextures(static_cast<GLsizei>(textures.size()), textures.data());
+    for (GLuint texture : textures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Each buffer holds two padded grids, enough for both velocity components.
+    const GLsizeiptr bytes = static_cast<GLsizeiptr>(2) * (width + 2) * (height + 2) * sizeof(float);
+    for (GLuint buffer : unpackBuffers) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    textureWidth = width;
+    textureHeight = height;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "sim/simulation_thread.h"
+
+enum class DisplayField {
+    Density,
+    Velocity,
+    Pressure
+};
+
+// Display names indexed by DisplayField.
+inline constexpr const char* displayFieldNames[] = { "Density", "Velocity", "Pressure" };
+
+/*
+ * Draws a grid field over the viewport through a colormap shader. Fields are streamed into float textures
+ * through two pixel unpack buffers used in turn: each upload maps the buffer the previous frame did not
+ * use, orphaning its old storage, and copies the padded grid in one pass. The texture update then reads from
+ * the buffer on the GPU timeline, so the CPU never waits on glTexSubImage2D and goes straight back to the
+ * next frame while the copy is in flight.
+ */
+class FieldRenderer {
+public:
+    FieldRenderer();
+    ~FieldRenderer();
+
+    FieldRenderer(const FieldRenderer&) = delete;
+    FieldRenderer& operator=(const FieldRenderer&) = delete;
+
+    // Draws the chosen field of a grid frame with cells square and the grid centered in the viewport.
+    // Density is taken from the given grid, so the caller can pass the interpolated one.
+    void draw(DisplayField field, const Grid2D& density, const SimulationFrame& frame, int viewportWidth, int viewportHeight);
+
+private:
+    static constexpr int bufferCount = 2;
+
+    // Copies up to two grids of the same size into the next unpack buffer and from there into the textures.
+    // Returns the value range shown by the colormap: [min, max] for one grid, [0, max magnitude] for two.
+    std::array<float, 2> upload(const Grid2D& first, const Grid2D* second);
+    // Reallocates the textures and unpack buffers for grids of the given interior size.
+    void resize(int width, int height);
+
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    std::array<GLuint, bufferCount> unpackBuffers {};
+    std::array<GLuint, 2> textures {};
+    GLint scaleLocation = -1;
+    GLint rangeLocation = -1;
+    GLint colormapLocation = -1;
+    int nextBuffer = 0;
+    int textureWidth = 0;
+    int textureHeight = 0;
+
+    // Velocity and pressure only change with the simulation, so a new upload waits for a new step.
+    DisplayField uploadedField = DisplayField::Density;
+    std::uint64_t uploadedStep = 0;
+    std::array<float, 2> uploadedRange {};
+};
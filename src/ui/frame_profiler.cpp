@@ -0,0 +1,146 @@
+#include "frame_profiler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "imgui.h"
+
+void TimingHistory::add(double seconds) {
+    samples[next] = seconds;
+    next = (next + 1) % capacity;
+    count = std::min(count + 1, capacity);
+}
+
+TimingSummary TimingHistory::summary() const {
+    TimingSummary result;
+    if (count == 0) {
+        return result;
+    }
+    std::array<double, capacity> sorted;
+    int first = (next - count + capacity) % capacity;
+    double total = 0.0;
+    for (int i = 0; i < count; i++) {
+        sorted[i] = samples[(first + i) % capacity];
+        total += sorted[i];
+    }
+    result.last = sorted[count - 1];
+    result.average = total / count;
+    std::sort(sorted.begin(), sorted.begin() + count);
+    result.min = sorted[0];
+    result.p99 = sorted[std::min(count - 1, count * 99 / 100)];
+    return result;
+}
+
+int TimingHistory::copyMilliseconds(float* out) const {
+    int first = (next - count + capacity) % capacity;
+    for (int i = 0; i < count; i++) {
+        out[i] = static_cast<float>(samples[(first + i) % capacity] * 1000.0);
+    }
+    return count;
+}
+
+GpuTimer::GpuTimer() {
+    glGenQueries(queryCount, queries.data());
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(queryCount, queries.data());
+}
+
+void GpuTimer::begin() {
+    // Skip the measurement rather than reuse a query whose result has not been read yet.
+    if (issued - retired < queryCount) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[issued % queryCount]);
+    }
+}
+
+void GpuTimer::end() {
+    if (issued - retired < queryCount) {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued++;
+    }
+}
+
+bool GpuTimer::poll(double& seconds) {
+    if (retired == issued) {
+        return false;
+    }
+    GLuint query = queries[retired % queryCount];
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    retired++;
+    seconds = static_cast<double>(nanoseconds) * 1e-9;
+    return true;
+}
+
+void FrameProfiler::record(ProfilePhase phase, double seconds) {
+    histories[static_cast<int>(phase)].add(seconds);
+}
+
+void FrameProfiler::recordSimulation(const SimulationFrame& frame) {
+    if (frame.stepCount == lastStepCount) {
+        return;
+    }
+    // A reset restarts the step count, which still counts as a new frame.
+    lastStepCount = frame.stepCount;
+    record(ProfilePhase::SimStep, frame.solveSeconds);
+    record(ProfilePhase::SimAdvect, frame.phaseTimes.advect);
+    record(ProfilePhase::SimForces, frame.phaseTimes.forces);
+    record(ProfilePhase::SimDivergence, frame.phaseTimes.divergence);
+    record(ProfilePhase::SimPressure, frame.phaseTimes.pressure);
+    record(ProfilePhase::SimGradient, frame.phaseTimes.gradient);
+}
+
+bool drawProfilerPanel(const FrameProfiler& profiler) {
+    static int selected = static_cast<int>(ProfilePhase::Frame);
+
+    ImGui::SetNextWindowPos(ImVec2(10, 420), ImGuiCond_FirstUseEver);
+    ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    if (ImGui::BeginTable("phases", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Phase (ms)");
+        ImGui::TableSetupColumn("Last");
+        ImGui::TableSetupColumn("Min");
+        ImGui::TableSetupColumn("Avg");
+        ImGui::TableSetupColumn("P99");
+        ImGui::TableHeadersRow();
+        for (int phase = 0; phase < static_cast<int>(ProfilePhase::Count); phase++) {
+            TimingSummary summary = profiler.history(static_cast<ProfilePhase>(phase)).summary();
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            if (ImGui::Selectable(profilePhaseNames[phase], selected == phase, ImGuiSelectableFlags_SpanAllColumns)) {
+                selected = phase;
+            }
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.last * 1000.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.min * 1000.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.average * 1000.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.p99 * 1000.0);
+        }
+        ImGui::EndTable();
+    }
+
+    const TimingHistory& history = profiler.history(static_cast<ProfilePhase>(selected));
+    std::vector<float> milliseconds(TimingHistory::capacity);
+    int count = history.copyMilliseconds(milliseconds.data());
+    float scaleMax = count > 0 ? *std::max_element(milliseconds.begin(), milliseconds.begin() + count) * 1.1f : 1.0f;
+    ImGui::PlotLines("##history", milliseconds.data(), count, 0, profilePhaseNames[selected], 0.0f, scaleMax, ImVec2(360, 80));
+
+    bool recording = tracingEnabled();
+    if (ImGui::Checkbox("Record trace", &recording)) {
+        setTracingEnabled(recording);
+    }
+    ImGui::SameLine();
+    bool writeRequested = ImGui::Button("Write trace (F9)");
+
+    ImGui::End();
+    return writeRequested;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "sim/simulation_thread.h"
+#include "sim/trace.h"
+
+struct TimingSummary {
+    double last = 0.0;
+    double min = 0.0;
+    double average = 0.0;
+    double p99 = 0.0;
+};
+
+// Ring of the most recent samples of one timing, in seconds.
+class TimingHistory {
+public:
+    static constexpr int capacity = 240;
+
+    void add(double seconds);
+    TimingSummary summary() const;
+    // Writes the samples oldest first in milliseconds and returns how many were written.
+    int copyMilliseconds(float* out) const;
+
+    int size() const { return count; }
+
+private:
+    std::array<double, capacity> samples {};
+    int next = 0;
+    int count = 0;
+};
+
+/*
+ * Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries. Several queries are kept in
+ * flight and results are only read once available, so the profiler never stalls the pipeline; the reported
+ * time lags the current frame by a few frames.
+ */
+class GpuTimer {
+public:
+    GpuTimer();
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void begin();
+    void end();
+    // Returns true and the oldest finished measurement, if one is ready.
+    bool poll(double& seconds);
+
+private:
+    static constexpr int queryCount = 4;
+    std::array<GLuint, queryCount> queries {};
+    int issued = 0;
+    int retired = 0;
+};
+
+enum class ProfilePhase {
+    Frame,
+    Poll,
+    Interpolate,
+    Ui,
+    Render,
+    Swap,
+    Gpu,
+    SimStep,
+    SimAdvect,
+    SimForces,
+    SimDivergence,
+    SimPressure,
+    SimGradient,
+    Count
+};
+
+// Display names indexed by ProfilePhase.
+inline constexpr const char* profilePhaseNames[] = {
+    "Frame", "Poll events", "Interpolate", "UI", "Render", "Swap", "GPU",
+    "Sim step", "Advect", "Forces", "Divergence", "Pressure", "Gradient"
+};
+
+// Rolling timings for the render loop phases and the solver phases reported by the simulation thread.
+class FrameProfiler {
+public:
+    void record(ProfilePhase phase, double seconds);
+    // Records the solver phases once per newly published frame.
+    void recordSimulation(const SimulationFrame& frame);
+
+    const TimingHistory& history(ProfilePhase phase) const { return histories[static_cast<int>(phase)]; }
+
+private:
+    std::array<TimingHistory, static_cast<int>(ProfilePhase::Count)> histories;
+    std::uint64_t lastStepCount = 0;
+};
+
+// Records the CPU time of its scope into one profiler phase, and as a trace zone when tracing is on.
+class ScopedCpuTimer {
+public:
+    ScopedCpuTimer(FrameProfiler& profiler, ProfilePhase phase)
+        : profiler(profiler), phase(phase), zone(profilePhaseNames[static_cast<int>(phase)]), start(std::chrono::steady_clock::now()) {}
+    ~ScopedCpuTimer() {
+        profiler.record(phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    ScopedCpuTimer(const ScopedCpuTimer&) = delete;
+    ScopedCpuTimer& operator=(const ScopedCpuTimer&) = delete;
+
+private:
+    FrameProfiler& profiler;
+    ProfilePhase phase;
+    TraceZone zone;
+    std::chrono::steady_clock::time_point start;
+};
+
+// ImGui window with a last/min/avg/p99 table per phase, a plot of the selected phase's history and trace
+// recording controls. Returns true when the user asked for the trace to be written.
+bool drawProfilerPanel(const FrameProfiler& profiler);
@@ -0,0 +1,178 @@
+#include "particle_renderer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "shader_program.h"
+
+namespace {
+
+// Quad corners come from gl_VertexID, so the only vertex inputs are the per-instance positions.
+constexpr const char* vertexShaderSource = R"(#version 440 core
+layout(location = 0) in float positionX;
+layout(location = 1) in float positionY;
+uniform vec2 scale;
+uniform vec2 offset;
+uniform float radius;
+out vec2 corner;
+void main() {
+    corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec2 position = vec2(positionX, positionY) + corner * radius;
+    gl_Position = vec4(position * scale + offset, 0.0, 1.0);
+}
+)";
+
+constexpr const char* fragmentShaderSource = R"(#version 440 core
+in vec2 corner;
+out vec4 color;
+void main() {
+    float distanceSquared = dot(corner, corner);
+    if (distanceSquared > 1.0) {
+        discard;
+    }
+    color = vec4(vec3(0.25, 0.55, 0.95) * (1.0 - 0.35 * distanceSquared), 1.0);
+}
+)";
+
+// Particles are allocated in steps of this many, so small changes to the count keep the buffer.
+constexpr int capacityGranularity = 1 << 16;
+
+// Upper bound on one fence wait. The ring only waits for draws a couple of frames old, so this
+// only runs out if the GPU has hung.
+constexpr GLuint64 fenceTimeoutNanoseconds = 1000000000;
+
+}
+
+ParticleRenderer::ParticleRenderer() {
+    program = createShaderProgram("particle", vertexShaderSource, fragmentShaderSource);
+    scaleLocation = glGetUniformLocation(program, "scale");
+    offsetLocation = glGetUniformLocation(program, "offset");
+    radiusLocation = glGetUniformLocation(program, "radius");
+
+    // X and y are separate streams with their own bindings, so the solver's arrays are copied as is.
+    glGenVertexArrays(1, &vertexArray);
+    glBindVertexArray(vertexArray);
+    for (GLuint attribute = 0; attribute < 2; attribute++) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribFormat(attribute, 1, GL_FLOAT, GL_FALSE, 0);
+        glVertexAttribBinding(attribute, attribute);
+        glVertexBindingDivisor(attribute, 1);
+    }
+    glBindVertexArray(0);
+}
+
+ParticleRenderer::~ParticleRenderer() {
+    for (int i = 0; i < regionCount; i++) {
+        waitForRegion(i);
+    }
+    if (buffer != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+    }
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteProgram(program);
+}
+
+void ParticleRenderer::draw(const SimulationFrame& frame, int viewportWidth, int viewportHeight) {
+    const int count = static_cast<int>(std::min(frame.particleX.size(), frame.particleY.size()));
+    if (count == 0 || viewportWidth <= 0 || viewportHeight <= 0 || frame.domainWidth <= 0.0f || frame.domainHeight <= 0.0f) {
+        return;
+    }
+    if (uploadedCount == 0 || frame.stepCount != uploadedStep || count != uploadedCount) {
+        upload(frame);
+    }
+    if (uploadedCount == 0) {
+        return;
+    }
+
+    // Fit the domain to the viewport, centered, keeping it square in pixels.
+    const float pixelsPerMeter = std::min(viewportWidth / frame.domainWidth, viewportHeight / frame.domainHeight);
+    const float scaleX = 2.0f * pixelsPerMeter / viewportWidth;
+    const float scaleY = 2.0f * pixelsPerMeter / viewportHeight;
+    glUseProgram(program);
+    glUniform2f(scaleLocation, scaleX, scaleY);
+    glUniform2f(offsetLocation, -0.5f * frame.domainWidth * scaleX, -0.5f * frame.domainHeight * scaleY);
+    // Discs reaching the diagonal of the initial lattice cover the resting fluid without gaps; keep them
+    // at least a pixel wide.
+    glUniform1f(radiusLocation, std::max(0.75f * frame.particleSpacing, 0.5f / pixelsPerMeter));
+    glBindVertexArray(vertexArray);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, uploadedCount);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    // The region may already be fenced by an earlier draw of the same upload; the new fence covers both.
+    if (fences[region] != nullptr) {
+        glDeleteSync(fences[region]);
+    }
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void ParticleRenderer::upload(const SimulationFrame& frame) {
+    const int count = static_cast<int>(std::min(frame.particleX.size(), frame.particleY.size()));
+    if (count > capacity) {
+        reserve(count);
+    }
+    if (mapped == nullptr) {
+        return;
+    }
+    region = (region + 1) % regionCount;
+    waitForRegion(region);
+
+    const std::size_t regionOffset = static_cast<std::size_t>(region) * 2 * capacity;
+    float* x = mapped + regionOffset;
+    float* y = x + capacity;
+    std::memcpy(x, frame.particleX.data(), count * sizeof(float));
+    std::memcpy(y, frame.particleY.data(), count * sizeof(float));
+
+    glBindVertexArray(vertexArray);
+    glBindVertexBuffer(0, buffer, static_cast<GLintptr>(regionOffset * sizeof(float)), sizeof(float));
+    glBindVertexBuffer(1, buffer, static_cast<GLintptr>((regionOffset + capacity) * sizeof(float)), sizeof(float));
+    glBindVertexArray(0);
+    uploadedCount = count;
+    uploadedStep = frame.stepCount;
+}
+
+void ParticleRenderer::reserve(int count) {
+    // Immutable storage cannot grow, so every draw still reading the old buffer has to finish first.
+    for (int i = 0; i < regionCount; i++) {
+        waitForRegion(i);
+    }
+    if (buffer != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    capacity = (count + capacityGranularity - 1) / capacityGranularity * capacityGranularity;
+    const GLsizeiptr bytes = static_cast<GLsizeiptr>(regionCount) * 2 * capacity * sizeof(float);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+    mapped = static_cast<float*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (mapped == nullptr) {
+        std::cerr << "Failed to map particle buffer of " << bytes << " bytes." << std::endl;
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        capacity = 0;
+    }
+    uploadedCount = 0;
+}
+
+void ParticleRenderer::waitForRegion(int index) {
+    GLsync& fence = fences[index];
+    if (fence == nullptr) {
+        return;
+    }
+    // Flush on the wait so a fence still sitting in the command queue cannot block forever.
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, fenceTimeoutNanoseconds);
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+        std::cerr << "Failed to wait for particle buffer fence." << std::endl;
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "sim/simulation_thread.h"
+
+/*
+ * Draws the particles of a frame as instanced sprites, one quad per particle expanded in the vertex
+ * shader. Positions are written straight into a persistently and coherently mapped buffer split into
+ * three regions: each upload takes the next region and only waits for the fence of the draw that last
+ * read it, so the CPU writes one region while the GPU may still be reading the other two and neither
+ * side ever stalls on a buffer respecification.
+ */
+class ParticleRenderer {
+public:
+    ParticleRenderer();
+    ~ParticleRenderer();
+
+    ParticleRenderer(const ParticleRenderer&) = delete;
+    ParticleRenderer& operator=(const ParticleRenderer&) = delete;
+
+    // Uploads the frame's particles if it holds a new step and draws them into the viewport, with the
+    // domain scaled to fit and centered.
+    void draw(const SimulationFrame& frame, int viewportWidth, int viewportHeight);
+
+private:
+    static constexpr int regionCount = 3;
+
+    void upload(const SimulationFrame& frame);
+    // Replaces the buffer with one holding at least count particles per region.
+    void reserve(int count);
+    void waitForRegion(int index);
+
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    GLuint buffer = 0;
+    GLint scaleLocation = -1;
+    GLint offsetLocation = -1;
+    GLint radiusLocation = -1;
+    // Each region holds capacity x positions followed by capacity y positions.
+    float* mapped = nullptr;
+    int capacity = 0;
+    std::array<GLsync, regionCount> fences {};
+    int region = 0;
+    int uploadedCount = 0;
+    std::uint64_t uploadedStep = 0;
+};
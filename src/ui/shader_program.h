@@ -0,0 +1,7 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Compiles and links a vertex and fragment shader pair. Errors are logged under the given name and
+// leave a program that draws nothing, so a broken shader never takes the viewer down.
+GLuint createShaderProgram(const char* name, const char* vertexSource, const char* fragmentSource);
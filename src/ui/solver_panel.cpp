@@ -0,0 +1,339 @@
+#include "solver_panel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "imgui.h"
+
+namespace {
+
+bool drawPressureSettings(FluidSettings& settings) {
+    bool changed = false;
+    int solverIndex = static_cast<int>(settings.pressureSolver);
+    if (ImGui::Combo("Pressure solver", &solverIndex, pressureSolverNames, IM_ARRAYSIZE(pressureSolverNames))) {
+        settings.pressureSolver = static_cast<PressureSolverType>(solverIndex);
+        changed = true;
+    }
+
+    switch (settings.pressureSolver) {
+    case PressureSolverType::Jacobi:
+        changed |= ImGui::SliderInt("Iterations", &settings.jacobiIterations, 1, 500);
+        break;
+    case PressureSolverType::Multigrid:
+        changed |= ImGui::SliderInt("Max cycles", &settings.multigrid.maxCycles, 1, 20);
+        changed |= ImGui::SliderFloat("Tolerance", &settings.multigrid.tolerance, 1e-5f, 1e-1f, "%.1e", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderInt("Smoothing steps", &settings.multigrid.smoothingSteps, 1, 8);
+        changed |= ImGui::Checkbox("Full multigrid", &settings.multigrid.fullMultigrid);
+        break;
+    case PressureSolverType::ConjugateGradient:
+        changed |= ImGui::SliderInt("Max iterations", &settings.pcg.maxIterations, 1, 1000);
+        changed |= ImGui::SliderFloat("Tolerance", &settings.pcg.tolerance, 1e-5f, 1e-1f, "%.1e", ImGuiSliderFlags_Logarithmic);
+        break;
+    }
+    return changed;
+}
+
+void drawPressureStats(const PressureSolveStats& stats) {
+    ImGui::Text("Iterations: %d", stats.iterations);
+    ImGui::Text("Residual: %.2e -> %.2e", stats.initialResidual, stats.residual);
+
+    if (stats.history.empty()) {
+        return;
+    }
+    std::vector<float> logResidual;
+    logResidual.reserve(stats.history.size() + 1);
+    logResidual.push_back(std::log10(std::max(stats.initialResidual, 1e-12f)));
+    for (float residual : stats.history) {
+        logResidual.push_back(std::log10(std::max(residual, 1e-12f)));
+    }
+    ImGui::PlotLines("log10 residual", logResidual.data(), static_cast<int>(logResidual.size()), 0, nullptr, -8.0f, 0.0f, ImVec2(0, 60));
+}
+
+// Returns true when the edit needs a reset, which is how particle count changes take effect.
+bool drawParticleCount(int& particleCount, bool& changed) {
+    changed |= ImGui::SliderInt("Particles", &particleCount, 1000, 500000, "%d", ImGuiSliderFlags_Logarithmic);
+    // Rebuilding the dam on every drag step would restart the run continuously.
+    return ImGui::IsItemDeactivatedAfterEdit();
+}
+
+bool drawSphSettings(SphSettings& settings, bool& changed) {
+    bool resetNeeded = drawParticleCount(settings.particleCount, changed);
+    changed |= ImGui::SliderFloat("Sound speed", &settings.soundSpeed, 5.0f, 100.0f, "%.0f m/s");
+    changed |= ImGui::SliderFloat("Viscosity", &settings.viscosity, 0.0f, 1.0f, "%.3f");
+    changed |= ImGui::SliderInt("Max substeps", &settings.maxSubsteps, 1, 256);
+    changed |= ImGui::SliderInt("Reorder interval", &settings.reorderInterval, 0, 100);
+    return resetNeeded;
+}
+
+bool drawPbfSettings(PbfSettings& settings, bool& changed) {
+    bool resetNeeded = drawParticleCount(settings.particleCount, changed);
+    changed |= ImGui::SliderInt("Substeps", &settings.substeps, 1, 8);
+    changed |= ImGui::SliderInt("Min iterations", &settings.iterations, 1, 16);
+    changed |= ImGui::SliderInt("Max iterations", &settings.maxIterations, 1, 400);
+    changed |= ImGui::SliderFloat("Density tolerance", &settings.densityTolerance, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+    changed |= ImGui::Checkbox("Grid projection", &settings.densityProjection);
+    changed |= ImGui::SliderFloat("XSPH viscosity", &settings.xsphViscosity, 0.0f, 0.2f, "%.3f");
+    changed |= ImGui::SliderFloat("Vorticity", &settings.vorticityConfinement, 0.0f, 0.005f, "%.4f");
+    changed |= ImGui::SliderInt("Reorder interval", &settings.reorderInterval, 0, 100);
+    return resetNeeded;
+}
+
+bool drawFlipSettings(FlipSettings& settings, bool& changed) {
+    bool resetNeeded = drawParticleCount(settings.particleCount, changed);
+    int transferIndex = static_cast<int>(settings.transfer);
+    if (ImGui::Combo("Transfer", &transferIndex, flipTransferNames, IM_ARRAYSIZE(flipTransferNames))) {
+        settings.transfer = static_cast<FlipTransfer>(transferIndex);
+        changed = true;
+    }
+    if (settings.transfer == FlipTransfer::Flip) {
+        changed |= ImGui::SliderFloat("FLIP ratio", &settings.flipRatio, 0.0f, 1.0f, "%.2f");
+    }
+    changed |= ImGui::SliderFloat("Density correction", &settings.densityCorrection, 0.0f, 0.2f, "%.3f");
+    changed |= ImGui::SliderInt("Max substeps", &settings.maxSubsteps, 1, 32);
+    changed |= ImGui::SliderInt("Reorder interval", &settings.reorderInterval, 0, 100);
+    return resetNeeded;
+}
+
+bool drawLbmSettings(LbmSettings& settings, bool& changed) {
+    int collisionIndex = static_cast<int>(settings.collision);
+    if (ImGui::Combo("Collision", &collisionIndex, lbmCollisionNames, IM_ARRAYSIZE(lbmCollisionNames))) {
+        settings.collision = static_cast<LbmCollision>(collisionIndex);
+        changed = true;
+    }
+    changed |= ImGui::SliderFloat("Reynolds number", &settings.reynolds, 10.0f, 5000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+    changed |= ImGui::SliderFloat("Inflow speed", &settings.inflowVelocity, 0.01f, 0.15f, "%.3f");
+    changed |= ImGui::SliderInt("Steps per update", &settings.stepsPerUpdate, 1, 100);
+    changed |= ImGui::SliderFloat("Obstacle radius", &settings.obstacleRadius, 0.0f, 0.25f, "%.2f");
+    // Moving the obstacle rebuilds the lattice, so wait for the drag to end as with particle counts.
+    bool resetNeeded = ImGui::IsItemDeactivatedAfterEdit();
+    int simdIndex = static_cast<int>(settings.simd);
+    if (ImGui::Combo("Kernel", &simdIndex, simdLevelNames, static_cast<int>(detectSimdLevel()) + 1)) {
+        settings.simd = static_cast<SimdLevel>(simdIndex);
+        changed = true;
+    }
+    return resetNeeded;
+}
+
+void drawLbmStats(const LbmStats& stats) {
+    ImGui::Text("Throughput: %.1f MLUPS", stats.mlups);
+    ImGui::Text("Lattice steps: %llu", static_cast<unsigned long long>(stats.totalSteps));
+    ImGui::Text("Relaxation time: %.4f", stats.tau);
+    if (stats.tau < 0.51f) {
+        ImGui::TextDisabled("Near the stability limit of 0.5: lower the Reynolds number or use MRT.");
+    }
+    // The lattice sound speed is 1 / sqrt(3) cells per step.
+    ImGui::Text("Max speed: %.3f (Mach %.2f)", stats.maxSpeed, stats.maxSpeed * 1.7320508f);
+}
+
+bool drawVolumeSettings(FluidSettings3D& settings, VolumeDisplay& display, bool& changed) {
+    int viewIndex = static_cast<int>(display.view);
+    if (ImGui::Combo("View", &viewIndex, volumeViewNames, IM_ARRAYSIZE(volumeViewNames))) {
+        display.view = static_cast<VolumeView>(viewIndex);
+        changed = true;
+    }
+    int axisIndex = static_cast<int>(display.axis);
+    if (ImGui::Combo("Axis", &axisIndex, viewAxisNames, IM_ARRAYSIZE(viewAxisNames))) {
+        display.axis = static_cast<ViewAxis>(axisIndex);
+        changed = true;
+    }
+    if (display.view == VolumeView::Slice) {
+        changed |= ImGui::SliderFloat("Slice position", &display.position, 0.0f, 1.0f, "%.2f");
+    }
+    changed |= ImGui::SliderFloat("Buoyancy", &settings.buoyancy, 0.0f, 100.0f, "%.1f");
+    changed |= ImGui::SliderFloat("Density dissipation", &settings.densityDissipation, 0.0f, 2.0f, "%.2f");
+    changed |= ImGui::SliderFloat("Velocity dissipation", &settings.velocityDissipation, 0.0f, 2.0f, "%.2f");
+    changed |= ImGui::SliderInt("Max iterations", &settings.pcg.maxIterations, 1, 500);
+    changed |= ImGui::SliderFloat("Tolerance", &settings.pcg.tolerance, 1e-5f, 1e-1f, "%.1e", ImGuiSliderFlags_Logarithmic);
+    // Resizing rebuilds every field, so wait for the edit to end as with particle counts.
+    // A sparse grid only stores the bricks near smoke, so its domain can be far larger.
+    bool resetNeeded = false;
+    if (ImGui::Checkbox("Sparse", &settings.sparse)) {
+        changed = true;
+        resetNeeded = true;
+    }
+    int size[3] = { settings.width, settings.height, settings.depth };
+    if (ImGui::SliderInt3("Size", size, 8, settings.sparse ? 1024 : 256)) {
+        settings.width = size[0];
+        settings.height = size[1];
+        settings.depth = size[2];
+        changed = true;
+    }
+    resetNeeded |= ImGui::IsItemDeactivatedAfterEdit();
+    return resetNeeded;
+}
+
+// Returns true when the CFL number or substep cap changed.
+bool drawSubstepSettings(float& cflNumber, int& maxSubsteps) {
+    bool changed = ImGui::SliderFloat("CFL number", &cflNumber, 0.0f, 8.0f, "%.2f");
+    changed |= ImGui::SliderInt("Max CFL substeps", &maxSubsteps, 1, 32);
+    return changed;
+}
+
+// Substep lines shared by the grid and particle modes. unit is the length unit of maxSpeed.
+void drawSubstepStats(int substeps, double substepSeconds, double simulatedSeconds, float maxSpeed, double stepSeconds, const char* unit) {
+    ImGui::Text("Substeps: %d of %.2e s", substeps, substepSeconds);
+    if (stepSeconds > 0.0 && simulatedSeconds < 0.999 * stepSeconds) {
+        ImGui::TextDisabled("Substeps capped: running at %.0f%% speed", 100.0 * simulatedSeconds / stepSeconds);
+    }
+    ImGui::Text("Max speed: %.2f %s/s (%.2f %s per step)", maxSpeed, unit, maxSpeed * stepSeconds, unit);
+}
+
+void drawParticleStats(const ParticleStats& stats, double stepSeconds) {
+    drawSubstepStats(stats.substeps, stats.substepSeconds, stats.simulatedSeconds, stats.maxSpeed, stepSeconds, "m");
+    // FLIP has no neighbor lists or density constraint, so it leaves these at zero.
+    if (stats.averageNeighbors > 0.0f) {
+        ImGui::Text("Neighbors: %.1f", stats.averageNeighbors);
+    }
+    if (stats.densityError > 0.0f) {
+        ImGui::Text("Density error: %.2f%%", 100.0f * stats.densityError);
+    }
+    if (stats.iterations > 0.0f) {
+        ImGui::Text("Iterations: %.1f per substep", stats.iterations);
+    }
+    // 1/16 when particles are in cell order, near 1 when every neighbor read starts a new cache line.
+    ImGui::Text("Gather cache lines: %.3f per particle", stats.gatherCacheLines);
+}
+
+void drawArchiveStats(const FrameArchiveStats& stats) {
+    ImGui::Text("File: %s", viewerArchivePath);
+    ImGui::Text("Frames: %llu written, %llu dropped", static_cast<unsigned long long>(stats.framesWritten),
+                static_cast<unsigned long long>(stats.framesDropped));
+    // All buffers in flight means the workers cannot keep up, and further frames are dropped.
+    ImGui::Text("Buffers in flight: %d of %d", stats.buffersInUse, stats.bufferCount);
+    ImGui::Text("Size: %.1f MB -> %.1f MB (%.2fx)", stats.rawBytes / 1048576.0, stats.storedBytes / 1048576.0,
+                stats.storedBytes > 0 ? static_cast<double>(stats.rawBytes) / stats.storedBytes : 0.0);
+    ImGui::Text("Compression: %.0f MB/s per worker", stats.compressSeconds > 0.0 ? stats.rawBytes / stats.compressSeconds / 1048576.0 : 0.0);
+    if (stats.failed) {
+        ImGui::TextDisabled("Writing the archive failed.");
+    }
+}
+
+}
+
+SolverPanelResult drawSolverPanel(SimulationControls& controls, SceneType& scene, DisplayField& displayField, const SimulationFrame& frame,
+                                  int threadCount, double frameSeconds) {
+    SolverPanelResult result;
+    ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+    ImGui::Begin("Simulation", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    ImGui::Text("Frame: %.2f ms (%.0f FPS)", frameSeconds * 1000.0, frameSeconds > 0.0 ? 1.0 / frameSeconds : 0.0);
+    ImGui::Text("Sim step: %.2f ms, %llu steps", frame.solveSeconds * 1000.0, static_cast<unsigned long long>(frame.stepCount));
+    if (frame.mode == SimulationMode::Grid) {
+        ImGui::Text("Grid: %d x %d on %d threads", frame.density.width, frame.density.height, threadCount);
+    } else if (frame.mode == SimulationMode::Lbm) {
+        ImGui::Text("Lattice: %d x %d on %d threads", frame.density.width, frame.density.height, threadCount);
+    } else if (frame.mode == SimulationMode::Grid3D) {
+        ImGui::Text("Grid: %d x %d x %d in 8^3 bricks on %d threads", frame.volumeWidth, frame.volumeHeight, frame.volumeDepth, threadCount);
+    } else {
+        ImGui::Text("Particles: %zu on %d threads", frame.particleX.size(), threadCount);
+    }
+
+    int modeIndex = static_cast<int>(controls.mode);
+    if (ImGui::Combo("Mode", &modeIndex, simulationModeNames, IM_ARRAYSIZE(simulationModeNames))) {
+        controls.mode = static_cast<SimulationMode>(modeIndex);
+        result.controlsChanged = true;
+    }
+    const bool gridMode = controls.mode == SimulationMode::Grid;
+    const bool lbmMode = controls.mode == SimulationMode::Lbm;
+    const bool grid3dMode = controls.mode == SimulationMode::Grid3D;
+
+    int sceneIndex = static_cast<int>(scene);
+    if (gridMode && ImGui::Combo("Scene", &sceneIndex, sceneNames, IM_ARRAYSIZE(sceneNames))) {
+        scene = static_cast<SceneType>(sceneIndex);
+        result.resetRequested = true;
+    }
+    int displayIndex = static_cast<int>(displayField);
+    if ((gridMode || lbmMode || grid3dMode) && ImGui::Combo("Display", &displayIndex, displayFieldNames, IM_ARRAYSIZE(displayFieldNames))) {
+        displayField = static_cast<DisplayField>(displayIndex);
+    }
+    // Only list the instruction sets this CPU can run; the scalar kernel is the reference.
+    int simdIndex = static_cast<int>(controls.settings.simd);
+    if (gridMode && ImGui::Combo("Advection", &simdIndex, simdLevelNames, static_cast<int>(detectSimdLevel()) + 1)) {
+        controls.settings.simd = static_cast<SimdLevel>(simdIndex);
+        result.controlsChanged = true;
+    }
+    // Second-order schemes cost two to three advection passes for sharper density and velocity.
+    int schemeIndex = static_cast<int>(gridMode ? controls.settings.advection : controls.grid3d.advection);
+    if ((gridMode || grid3dMode) && ImGui::Combo("Scheme", &schemeIndex, advectionSchemeNames, IM_ARRAYSIZE(advectionSchemeNames))) {
+        controls.settings.advection = controls.grid3d.advection = static_cast<AdvectionScheme>(schemeIndex);
+        result.controlsChanged = true;
+    }
+    if (gridMode && frame.hasObstacles && controls.settings.pressureSolver != PressureSolverType::ConjugateGradient) {
+        ImGui::TextDisabled("Only PCG respects obstacles in the pressure solve.");
+    }
+
+    if (ImGui::CollapsingHeader("Timestep", ImGuiTreeNodeFlags_DefaultOpen)) {
+        float stepHz = static_cast<float>(controls.stepHz);
+        if (ImGui::SliderFloat("Sim rate (Hz)", &stepHz, 10.0f, 240.0f, "%.0f")) {
+            controls.stepHz = stepHz;
+            result.controlsChanged = true;
+        }
+        result.controlsChanged |= ImGui::SliderInt("Max substeps", &controls.maxSubsteps, 1, 16);
+        result.controlsChanged |= ImGui::Checkbox("Paused", &controls.paused);
+        ImGui::Text("Steps last update: %d", frame.stepsLastUpdate);
+        ImGui::Text("Dropped sim time: %.2f s", frame.droppedSeconds);
+        // The grid solvers split each step further to hold the CFL number.
+        if (gridMode) {
+            result.controlsChanged |= drawSubstepSettings(controls.settings.cflNumber, controls.settings.maxSubsteps);
+        } else if (grid3dMode) {
+            result.controlsChanged |= drawSubstepSettings(controls.grid3d.cflNumber, controls.grid3d.maxSubsteps);
+        }
+        if ((gridMode || grid3dMode) && frame.mode == controls.mode) {
+            const SubstepStats& stats = frame.substepStats;
+            drawSubstepStats(stats.substeps, stats.substepSeconds, stats.simulatedSeconds, stats.maxSpeed, frame.stepSeconds, "cells");
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Archive")) {
+        result.controlsChanged |= ImGui::Checkbox("Record", &controls.recordArchive);
+        result.controlsChanged |= ImGui::SliderInt("Every N steps", &controls.archiveEvery, 1, 120);
+        if (frame.archiving || frame.archiveStats.framesWritten > 0) {
+            drawArchiveStats(frame.archiveStats);
+        }
+    }
+
+    if (gridMode && ImGui::CollapsingHeader("Pressure", ImGuiTreeNodeFlags_DefaultOpen)) {
+        result.controlsChanged |= drawPressureSettings(controls.settings);
+        drawPressureStats(frame.pressureStats);
+    }
+
+    if (lbmMode && ImGui::CollapsingHeader("Lattice Boltzmann", ImGuiTreeNodeFlags_DefaultOpen)) {
+        result.resetRequested |= drawLbmSettings(controls.lbm, result.controlsChanged);
+        if (frame.mode == SimulationMode::Lbm) {
+            drawLbmStats(frame.lbmStats);
+        }
+    }
+
+    if (grid3dMode && ImGui::CollapsingHeader("Volume", ImGuiTreeNodeFlags_DefaultOpen)) {
+        result.resetRequested |= drawVolumeSettings(controls.grid3d, controls.volumeDisplay, result.controlsChanged);
+        if (frame.mode == SimulationMode::Grid3D) {
+            ImGui::Text("Active bricks: %d of %d (%.1f%%)", frame.activeBricks, frame.totalBricks,
+                        frame.totalBricks > 0 ? 100.0 * frame.activeBricks / frame.totalBricks : 0.0);
+            drawPressureStats(frame.pressureStats);
+        }
+    }
+
+    if (!gridMode && !lbmMode && !grid3dMode && ImGui::CollapsingHeader("Particles", ImGuiTreeNodeFlags_DefaultOpen)) {
+        if (controls.mode == SimulationMode::Sph) {
+            result.resetRequested |= drawSphSettings(controls.sph, result.controlsChanged);
+        } else if (controls.mode == SimulationMode::Pbf) {
+            result.resetRequested |= drawPbfSettings(controls.pbf, result.controlsChanged);
+        } else {
+            result.resetRequested |= drawFlipSettings(controls.flip, result.controlsChanged);
+        }
+        if (frame.mode == controls.mode) {
+            drawParticleStats(frame.particleStats, frame.stepSeconds);
+            if (frame.mode == SimulationMode::Flip || (frame.mode == SimulationMode::Pbf && controls.pbf.densityProjection)) {
+                drawPressureStats(frame.pressureStats);
+            }
+        }
+    }
+
+    if (ImGui::Button("Reset")) {
+        result.resetRequested = true;
+    }
+
+    ImGui::End();
+    return result;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "sim/scene.h"
+#include "sim/simulation_thread.h"
+#include "ui/field_renderer.h"
+
+struct SolverPanelResult {
+    // The controls were edited and should be sent to the simulation thread.
+    bool controlsChanged = false;
+    // The scene should be rebuilt from scratch.
+    bool resetRequested = false;
+};
+
+// ImGui window with the solver and timestep settings, pressure convergence and frame timings.
+SolverPanelResult drawSolverPanel(SimulationControls& controls, SceneType& scene, DisplayField& displayField, const SimulationFrame& frame,
+                                  int threadCount, double frameSeconds);